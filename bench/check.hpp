@@ -0,0 +1,123 @@
+/**
+ *
+ * check.hpp - Comparing the results of the tokenizer modes
+ *
+ * Copyright (c) 2022 Anamitra Ghorui
+ *
+ * LICENSE_HERE
+ *
+ * Every mode of the tokenizer has to give exactly the same result as
+ * `tokenize`. These compare two results field by field. They are included after
+ * the sources of the tokenizer.
+ *
+ */
+
+#ifndef BLINDFORTH_BENCH_CHECK_HPP
+#define BLINDFORTH_BENCH_CHECK_HPP
+
+#include <string.h>
+
+static bool same_token(const TokenResult &ra, const Token &a,
+                       const TokenResult &rb, const Token &b)
+{
+	if (a.type != b.type || a.offset != b.offset) {
+		return false;
+	}
+
+	switch (a.type) {
+	case TOKEN_TYPE_INT:
+		return a.data.i == b.data.i;
+	case TOKEN_TYPE_REAL:
+		return memcmp(&a.data.r, &b.data.r, sizeof(double)) == 0;
+	case TOKEN_TYPE_STRING:
+	case TOKEN_TYPE_ID:
+	case TOKEN_TYPE_DEBUG_COMMAND:
+		return token_length(ra, a) == token_length(rb, b) &&
+		       memcmp(token_text(ra, a), token_text(rb, b), token_length(ra, a)) == 0;
+	default:
+		return true;
+	}
+}
+
+static bool same_error(const TokenError &a, const TokenError &b)
+{
+	return a.curr_offset == b.curr_offset &&
+	       a.line_pos == b.line_pos &&
+	       a.col_pos == b.col_pos &&
+	       a.curr_guess == b.curr_guess &&
+	       a.curr_input == b.curr_input &&
+	       a.curr_input_val == b.curr_input_val;
+}
+
+// A result from TOKENIZE_STREAM is compared token by token through
+// token_stream_get.
+static bool same_result(int ret_a, const TokenResult &a, int ret_b, const TokenResult &b)
+{
+	bool stream = token_stream_size(b.stream) > 0 || b.tokens.empty();
+	size_t count = stream ? token_stream_size(b.stream) : b.tokens.size();
+
+	if (ret_a != ret_b ||
+	    a.characters_processed != b.characters_processed ||
+	    a.lines_processed != b.lines_processed ||
+	    a.tokens.size() != count) {
+		return false;
+	}
+
+	if (ret_a < 0 && !same_error(a.error, b.error)) {
+		return false;
+	}
+
+	for (size_t i = 0; i < a.tokens.size(); i++) {
+		Token token = stream ? token_stream_get(b.stream, i) : b.tokens[i];
+		if (!same_token(a, a.tokens[i], b, token)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// Every way of interning the same input has to give each symbol the same id.
+static bool same_symbols(const TokenResult &result, SymbolTable &first, bool &have_first)
+{
+	if (!result.symbols) {
+		return true;
+	}
+	if (!have_first) {
+		first = *result.symbols;
+		have_first = true;
+		return true;
+	}
+	return first.text == result.symbols->text;
+}
+
+// Feeds `input` to a Tokenizer in `mode`, in pieces of the sizes in `pieces`.
+// Unless the tokens are views, every piece is a copy that is freed again as
+// soon as it has been fed, like a buffer read from a socket, so that anything
+// left pointing into it is caught by the address sanitizer.
+static int feed_pieces(int mode, std::vector<char> &input, const std::vector<size_t> &pieces,
+                       TokenResult &result)
+{
+	Tokenizer tokenizer(mode);
+	size_t pos = 0;
+	int ret = 0;
+
+	for (size_t i = 0; i < pieces.size() && ret == 0; i++) {
+		bool end = (pos + pieces[i] == input.size());
+
+		if (mode & TOKENIZE_VIEWS) {
+			ret = tokenizer_feed(tokenizer, input.data() + pos, pieces[i], end, result);
+		} else {
+			std::vector<char> piece(input.begin() + pos, input.begin() + pos + pieces[i]);
+			ret = tokenizer_feed(tokenizer, piece.data(), piece.size(), end, result);
+		}
+		pos += pieces[i];
+	}
+
+	if (ret == 0) {
+		ret = tokenizer_feed(tokenizer, input.data() + pos, 0, true, result);
+	}
+	return ret;
+}
+
+#endif
@@ -0,0 +1,300 @@
+/**
+ *
+ * corpus.hpp - Synthetic Forth inputs for the benchmarks
+ *
+ * Copyright (c) 2022 Anamitra Ghorui
+ *
+ * LICENSE_HERE
+ *
+ */
+
+#ifndef BLINDFORTH_BENCH_CORPUS_HPP
+#define BLINDFORTH_BENCH_CORPUS_HPP
+
+#include <vector>
+#include <string.h>
+
+// A few representative lines of Forth, repeated with some variation until the
+// corpus reaches the requested size.
+static const char *corpus_lines[] = {
+	"2 4 3 + * print_stack_top\n",
+	"    1 2 + dup * swap drop\n",
+	"\t:break 'a single quoted string' -12 .5 3.142\n",
+	"apple_1 ball_2 \"a double quoted string with words\" +3 -2.718\n",
+	"        over over rot 100000 200000 300000 */mod\n",
+	":stack_trace\r\n",
+	"1000000007 -42 0.000001 65536 3.14159265358979 -273.15 299792458\n",
+};
+
+// A small linear congruential generator, so that corpora are the same on every
+// run and every platform.
+static inline unsigned int corpus_rand(unsigned int &seed)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 16;
+}
+
+// The corpus always ends on a whole line, so it can be tokenized without
+// errors.
+static inline std::vector<char> make_corpus(size_t size)
+{
+	std::vector<char> corpus;
+	size_t n = sizeof(corpus_lines) / sizeof(corpus_lines[0]);
+	unsigned int seed = 1;
+
+	corpus.reserve(size + 128);
+	while (corpus.size() < size) {
+		const char *line = corpus_lines[corpus_rand(seed) % n];
+		corpus.insert(corpus.end(), line, line + strlen(line));
+	}
+	return corpus;
+}
+
+// Corpora with one kind of content each, so that a change to one part of the
+// tokenizer shows up clearly in the numbers.
+typedef enum CorpusShape {
+	CORPUS_MIXED       = 0, // make_corpus
+	CORPUS_IDENTIFIERS = 1, // Words only
+	CORPUS_NUMBERS     = 2, // Tables of integer and real constants
+	CORPUS_STRINGS     = 3, // Long quoted strings
+	CORPUS_CRLF        = 4, // make_corpus with every line ending in "\r\n"
+	CORPUS_SHORT_LINES = 5, // One or two tokens to a line
+	CORPUS_SCRIPT      = 6, // make_generated_corpus with corpus_script_mix
+	CORPUS_SHAPE_SIZE
+} CorpusShape;
+
+static const char *const corpus_shape_names[CORPUS_SHAPE_SIZE] = {
+	"mixed", "identifiers", "numbers", "strings", "crlf", "short_lines", "script"
+};
+
+static inline void corpus_append(std::vector<char> &corpus, const char *s)
+{
+	corpus.insert(corpus.end(), s, s + strlen(s));
+}
+
+static inline void corpus_append_word(std::vector<char> &corpus, unsigned int &seed)
+{
+	static const char first[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_";
+	static const char rest[] = "abcdefghijklmnopqrstuvwxyz_0123456789*/!?";
+	size_t len = 1 + corpus_rand(seed) % 12;
+
+	corpus.push_back(first[corpus_rand(seed) % (sizeof(first) - 1)]);
+	for (size_t i = 1; i < len; i++) {
+		corpus.push_back(rest[corpus_rand(seed) % (sizeof(rest) - 1)]);
+	}
+}
+
+static inline void corpus_append_number(std::vector<char> &corpus, unsigned int &seed)
+{
+	unsigned int kind = corpus_rand(seed) % 4;
+	size_t digits = 1 + corpus_rand(seed) % 12;
+
+	if (corpus_rand(seed) % 3 == 0) {
+		corpus.push_back('-');
+	}
+	for (size_t i = 0; i < digits; i++) {
+		corpus.push_back('0' + corpus_rand(seed) % 10);
+	}
+	if (kind > 1) {
+		size_t places = 1 + corpus_rand(seed) % 8;
+		corpus.push_back('.');
+		for (size_t i = 0; i < places; i++) {
+			corpus.push_back('0' + corpus_rand(seed) % 10);
+		}
+	}
+}
+
+// A string of `min` to `min + span - 1` symbols.
+static inline void corpus_append_string(std::vector<char> &corpus, unsigned int &seed,
+                                        size_t min = 32, size_t span = 480)
+{
+	static const char body[] = "abcdefghijklmnopqrstuvwxyz      .,;:!?0123456789";
+	char quote = (corpus_rand(seed) % 2) ? '"' : '\'';
+	size_t len = min + corpus_rand(seed) % span;
+
+	corpus.push_back(quote);
+	for (size_t i = 0; i < len; i++) {
+		corpus.push_back(body[corpus_rand(seed) % (sizeof(body) - 1)]);
+	}
+	corpus.push_back(quote);
+}
+
+// Corpora can also be made to order, with a given mix of tokens and line
+// endings. The same inputs can then be both checked (see tokenize_fuzz.cpp)
+// and timed.
+typedef enum CorpusLineEnding {
+	CORPUS_ENDING_LF    = 0,
+	CORPUS_ENDING_CRLF  = 1,
+	CORPUS_ENDING_CR    = 2,
+	CORPUS_ENDING_MIXED = 3, // Any of the three, picked for each line
+	CORPUS_ENDING_SIZE
+} CorpusLineEnding;
+
+typedef struct CorpusMix {
+	// How often each kind of token appears, relative to the others
+	unsigned int ints;
+	unsigned int reals;
+	unsigned int strings;
+	unsigned int words;
+	unsigned int debug;       // `:break`, `:stack_trace` and `:` before a name
+
+	unsigned int utf8;        // Percentage of words with a non-ASCII letter
+	unsigned int line_tokens; // Most tokens to a line, at least 1
+	unsigned int indent;      // Most blanks before the first token of a line
+	CorpusLineEnding ending;
+} CorpusMix;
+
+// Roughly what our scripts look like: mostly words and small numbers, a few
+// short strings, and indented definitions.
+static const CorpusMix corpus_script_mix = {
+	20, 3, 6, 68, 3,
+	2, 8, 8, CORPUS_ENDING_LF
+};
+
+static inline void corpus_append_digits(std::vector<char> &corpus, unsigned int &seed, size_t n)
+{
+	for (size_t i = 0; i < n; i++) {
+		corpus.push_back('0' + corpus_rand(seed) % 10);
+	}
+}
+
+static inline void corpus_append_token(std::vector<char> &corpus, unsigned int &seed,
+                                       const CorpusMix &mix)
+{
+	static const char *const letters[] = { "\xc3\xa9", "\xce\xbb", "\xe2\x82\xac", "\xf0\x9f\x99\x82" };
+	static const char *const debug[] = { ":break", ":stack_trace", ":" };
+	unsigned int total = mix.ints + mix.reals + mix.strings + mix.words + mix.debug;
+	unsigned int pick = corpus_rand(seed) % (total ? total : 1);
+
+	if (pick < mix.ints) {
+		if (corpus_rand(seed) % 4 == 0) {
+			corpus.push_back((corpus_rand(seed) % 2) ? '-' : '+');
+		}
+		corpus_append_digits(corpus, seed, 1 + corpus_rand(seed) % 9);
+	} else if ((pick -= mix.ints) < mix.reals) {
+		if (corpus_rand(seed) % 4 == 0) {
+			corpus.push_back('-');
+		}
+		corpus_append_digits(corpus, seed, corpus_rand(seed) % 6);
+		corpus.push_back('.');
+		corpus_append_digits(corpus, seed, 1 + corpus_rand(seed) % 8);
+	} else if ((pick -= mix.reals) < mix.strings) {
+		corpus_append_string(corpus, seed, 0, 40);
+	} else if ((pick -= mix.strings) < mix.words || !total) {
+		corpus_append_word(corpus, seed);
+		if (corpus_rand(seed) % 100 < mix.utf8) {
+			corpus_append(corpus, letters[corpus_rand(seed) % 4]);
+		}
+	} else {
+		const char *command = debug[corpus_rand(seed) % 3];
+		corpus_append(corpus, command);
+		if (command[1] == '\0') {
+			corpus.push_back(' ');
+			corpus_append_word(corpus, seed);
+		}
+	}
+}
+
+// Ends on a whole line, so that it can be tokenized without errors.
+static inline std::vector<char> make_generated_corpus(const CorpusMix &mix, size_t size,
+                                                      unsigned int seed = 1)
+{
+	static const char *const endings[] = { "\n", "\r\n", "\r" };
+	std::vector<char> corpus;
+
+	corpus.reserve(size + 1024);
+	while (corpus.size() < size) {
+		size_t count = 1 + corpus_rand(seed) % (mix.line_tokens ? mix.line_tokens : 1);
+		size_t indent = corpus_rand(seed) % (mix.indent + 1);
+
+		corpus.insert(corpus.end(), indent, ' ');
+		for (size_t i = 0; i < count; i++) {
+			if (i > 0) {
+				corpus.push_back(' ');
+			}
+			corpus_append_token(corpus, seed, mix);
+		}
+
+		unsigned int ending = (mix.ending == CORPUS_ENDING_MIXED) ?
+		                      corpus_rand(seed) % 3 : (unsigned int) mix.ending;
+		corpus_append(corpus, endings[ending]);
+	}
+	return corpus;
+}
+
+// The sizes of the pieces to feed `size` bytes of input in, each at most
+// `max`, and some of them empty.
+static inline std::vector<size_t> corpus_pieces(size_t size, size_t max, unsigned int &seed)
+{
+	std::vector<size_t> pieces;
+
+	while (size > 0) {
+		size_t n = corpus_rand(seed) % (max + 1);
+		n = (n < size) ? n : size;
+		pieces.push_back(n);
+		size -= n;
+	}
+	return pieces;
+}
+
+// Like make_corpus, every shape ends on a whole line.
+static inline std::vector<char> make_shaped_corpus(CorpusShape shape, size_t size)
+{
+	std::vector<char> corpus;
+	unsigned int seed = 1;
+
+	if (shape == CORPUS_MIXED) {
+		return make_corpus(size);
+	} else if (shape == CORPUS_SCRIPT) {
+		return make_generated_corpus(corpus_script_mix, size);
+	} else if (shape == CORPUS_CRLF) {
+		std::vector<char> lf = make_corpus(size);
+		for (size_t i = 0; i < lf.size(); i++) {
+			if (lf[i] == '\n' && (i == 0 || lf[i - 1] != '\r')) {
+				corpus.push_back('\r');
+			}
+			corpus.push_back(lf[i]);
+		}
+		return corpus;
+	}
+
+	corpus.reserve(size + 1024);
+	while (corpus.size() < size) {
+		size_t count = 1 + corpus_rand(seed) % 10;
+
+		if (shape == CORPUS_SHORT_LINES) {
+			count = 1 + corpus_rand(seed) % 2;
+		} else if (shape == CORPUS_STRINGS) {
+			count = 1 + corpus_rand(seed) % 3;
+		}
+
+		for (size_t i = 0; i < count; i++) {
+			if (i > 0) {
+				corpus.push_back(' ');
+			}
+
+			switch (shape) {
+			case CORPUS_IDENTIFIERS:
+				corpus_append_word(corpus, seed);
+				break;
+			case CORPUS_NUMBERS:
+				corpus_append_number(corpus, seed);
+				break;
+			case CORPUS_STRINGS:
+				corpus_append_string(corpus, seed);
+				break;
+			default:
+				if (corpus_rand(seed) % 2) {
+					corpus_append_word(corpus, seed);
+				} else {
+					corpus_append_number(corpus, seed);
+				}
+				break;
+			}
+		}
+		corpus_append(corpus, "\n");
+	}
+	return corpus;
+}
+
+#endif
@@ -0,0 +1,218 @@
+/**
+ *
+ * dfa_bench.cpp - Checks and times the optimized tokenizer modes against tokenize
+ *
+ * Copyright (c) 2022 Anamitra Ghorui
+ *
+ * LICENSE_HERE
+ *
+ * Build and run with:
+ *
+ *     c++ -std=c++17 -O2 -pthread -o dfa_bench bench/dfa_bench.cpp
+ *     ./dfa_bench [corpus size in MB] [random inputs]
+ *
+ * Before timing anything, every mode (and every vector implementation the CPU
+ * supports) is run over the corpus, over a megabyte of every shape that
+ * tokenize_bench times, and over a set of random inputs, both in one go, fed in
+ * random pieces and split between threads, and the results are compared field
+ * by field against `tokenize`.
+ *
+ */
+
+#include "../tokenizer.cpp"
+#include "../util.cpp"
+#include "../source.cpp"
+#include "../symbol.cpp"
+#include "check.hpp"
+#include "corpus.hpp"
+
+#include <chrono>
+#include <stdlib.h>
+
+typedef int (*TokenizeFn)(char *input, int size, bool end, TokenResult &result);
+
+static int run_tokenizer(TokenizeFn fn, std::vector<char> &input, TokenResult &result)
+{
+	return fn(input.data(), input.size(), true, result);
+}
+
+// Feeds the input to a Tokenizer in pieces of random sizes, including empty
+// ones, splitting tokens wherever they happen to fall.
+static int run_chunked(int mode, std::vector<char> &input, TokenResult &result)
+{
+	static unsigned int seed = 1;
+
+	return feed_pieces(mode, input, corpus_pieces(input.size(), 7, seed), result);
+}
+
+static const int feed_modes[] = {
+	TOKENIZE_REFERENCE, TOKENIZE_DFA, TOKENIZE_DFA | TOKENIZE_SKIP,
+	TOKENIZE_VIEWS, TOKENIZE_DFA | TOKENIZE_SKIP | TOKENIZE_VIEWS,
+	TOKENIZE_STREAM, TOKENIZE_DFA | TOKENIZE_SKIP | TOKENIZE_VIEWS | TOKENIZE_STREAM,
+	TOKENIZE_INTERN, TOKENIZE_DFA | TOKENIZE_SKIP | TOKENIZE_VIEWS | TOKENIZE_INTERN,
+	TOKENIZE_DFA | TOKENIZE_SKIP | TOKENIZE_STREAM | TOKENIZE_INTERN
+};
+#define FEED_MODE_COUNT (sizeof(feed_modes) / sizeof(feed_modes[0]))
+
+static const TokenizeFn modes[] = {
+	tokenize_dfa, tokenize_fast, tokenize_views, tokenize_stream, tokenize_interned
+};
+static const char *mode_names[] = { "dfa", "fast", "views", "stream", "interned" };
+#define MODE_COUNT (sizeof(modes) / sizeof(modes[0]))
+
+static bool check(std::vector<char> &input)
+{
+	TokenResult ref;
+	int ret_ref = run_tokenizer(tokenize, input, ref);
+	SymbolTable first;
+	bool have_first = false;
+
+	for (size_t m = 0; m < MODE_COUNT; m++) {
+		TokenResult result;
+		SymbolTable symbols;
+		result.symbols = (modes[m] == tokenize_interned) ? &symbols : NULL;
+
+		int ret = run_tokenizer(modes[m], input, result);
+		if (!same_result(ret_ref, ref, ret, result)) {
+			printf("Error: mode '%s' differs from tokenize.\n", mode_names[m]);
+			return false;
+		}
+		if (ret > 0 && !same_symbols(result, first, have_first)) {
+			printf("Error: mode '%s' numbers the symbols differently.\n", mode_names[m]);
+			return false;
+		}
+	}
+
+	for (size_t m = 0; m < FEED_MODE_COUNT; m++) {
+		TokenResult result;
+		SymbolTable symbols;
+		result.symbols = (feed_modes[m] & TOKENIZE_INTERN) ? &symbols : NULL;
+
+		int ret = run_chunked(feed_modes[m], input, result);
+		if (!same_result(ret_ref, ref, ret, result)) {
+			printf("Error: chunked mode %d differs from tokenize.\n", feed_modes[m]);
+			return false;
+		}
+		if (ret > 0 && !same_symbols(result, first, have_first)) {
+			printf("Error: chunked mode %d numbers the symbols differently.\n", feed_modes[m]);
+			return false;
+		}
+	}
+
+	// Small inputs are split into as many chunks as there are threads, so
+	// that even the random inputs get split up.
+	for (size_t m = 0; m < FEED_MODE_COUNT; m++) {
+		TokenResult result;
+		SymbolTable symbols;
+		result.symbols = (feed_modes[m] & TOKENIZE_INTERN) ? &symbols : NULL;
+
+		int ret = tokenize_parallel(input.data(), input.size(), feed_modes[m], 3, result);
+		if (!same_result(ret_ref, ref, ret, result)) {
+			printf("Error: parallel mode %d differs from tokenize.\n", feed_modes[m]);
+			return false;
+		}
+		if (ret > 0 && !same_symbols(result, first, have_first)) {
+			printf("Error: parallel mode %d numbers the symbols differently.\n", feed_modes[m]);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// Random inputs are drawn from an alphabet that hits every input class, with
+// extra weight on blanks and quotes so that the skipping paths see long runs.
+static std::vector<char> make_random(unsigned int &seed)
+{
+	static const char alphabet[] =
+		"        \t\t\n\r0123456789.+-:''\"\"abcXYZ_*/\\\x01\x7f\x80\xff";
+	std::vector<char> input;
+	size_t len = corpus_rand(seed) % 256;
+
+	for (size_t i = 0; i < len; i++) {
+		input.push_back(alphabet[corpus_rand(seed) % (sizeof(alphabet) - 1)]);
+	}
+	return input;
+}
+
+static double time_tokenizer(TokenizeFn fn, std::vector<char> &input, int rounds)
+{
+	double best = 1e30;
+
+	for (int r = 0; r < rounds; r++) {
+		TokenResult result;
+		SymbolTable symbols;
+		result.symbols = (fn == tokenize_interned) ? &symbols : NULL;
+
+		auto start = std::chrono::steady_clock::now();
+		run_tokenizer(fn, input, result);
+		auto stop = std::chrono::steady_clock::now();
+		double secs = std::chrono::duration<double>(stop - start).count();
+		if (secs < best) {
+			best = secs;
+		}
+	}
+
+	return (input.size() / (1024.0 * 1024.0)) / best;
+}
+
+static const char *simd_names[] = { "scalar", "sse2", "avx2", "neon" };
+
+int main(int argc, char **argv)
+{
+	size_t mb = (argc > 1) ? strtoul(argv[1], NULL, 10) : 16;
+	size_t random_inputs = (argc > 2) ? strtoul(argv[2], NULL, 10) : 100000;
+	std::vector<char> corpus = make_corpus(mb * 1024 * 1024);
+	UtilSimd best = util_simd_detect();
+	std::vector<std::vector<char>> shapes;
+
+	for (int shape = 0; shape < CORPUS_SHAPE_SIZE; shape++) {
+		shapes.push_back(make_shaped_corpus((CorpusShape) shape, 1024 * 1024));
+	}
+
+	printf("corpus: %zu MB, %zu random inputs\n", mb, random_inputs);
+
+	for (int level = UTIL_SIMD_NONE; level <= UTIL_SIMD_NEON; level++) {
+		unsigned int seed = 1;
+
+		if (util_simd_select((UtilSimd) level) < 0) {
+			continue;
+		}
+
+		if (!check(corpus)) {
+			printf("Error: results differ on the corpus (%s).\n", simd_names[level]);
+			return 1;
+		}
+
+		for (int shape = 0; shape < CORPUS_SHAPE_SIZE; shape++) {
+			if (!check(shapes[shape])) {
+				printf("Error: results differ on the %s corpus (%s).\n",
+				       corpus_shape_names[shape], simd_names[level]);
+				return 1;
+			}
+		}
+
+		for (size_t i = 0; i < random_inputs; i++) {
+			std::vector<char> input = make_random(seed);
+			if (!check(input)) {
+				printf("Error: results differ on random input %zu (%s).\n",
+				       i, simd_names[level]);
+				return 1;
+			}
+		}
+
+		printf("%-10s results identical\n", simd_names[level]);
+	}
+
+	util_simd_select(best);
+
+	double loop = time_tokenizer(tokenize, corpus, 5);
+	printf("%-10s %10.1f MB/s\n", "tokenize", loop);
+
+	for (size_t m = 0; m < MODE_COUNT; m++) {
+		double mbps = time_tokenizer(modes[m], corpus, 5);
+		printf("%-10s %10.1f MB/s (%.2fx)\n", mode_names[m], mbps, mbps / loop);
+	}
+
+	return 0;
+}
@@ -0,0 +1,108 @@
+/**
+ *
+ * dialect_check.cpp - Checking what each dialect accepts
+ *
+ * Copyright (c) 2022 Anamitra Ghorui
+ *
+ * LICENSE_HERE
+ *
+ * Build and run once for each dialect worth checking (see `TokenDialect`):
+ *
+ *     c++ -std=c++17 -O1 -o dialect_check bench/dialect_check.cpp
+ *     ./dialect_check
+ *     c++ -std=c++17 -O1 -DBLINDFORTH_DIALECT='(TOKEN_DIALECT_ALL&~TOKEN_DIALECT_DEBUG)' \
+ *         -o dialect_check_nodebug bench/dialect_check.cpp
+ *     ./dialect_check_nodebug
+ *     c++ -std=c++17 -O1 -DBLINDFORTH_DIALECT=0 -o dialect_check_bare bench/dialect_check.cpp
+ *     ./dialect_check_bare
+ *
+ * Every dialect has to be able to define and run words, since a `:` on its
+ * own is a token in all of them. Each of the parts that can be left out has
+ * to be a syntax error exactly when it is left out, and tokenize the same way
+ * with and without the DFA table.
+ *
+ */
+
+#include "../tokenizer.cpp"
+#include "../util.cpp"
+#include "../symbol.cpp"
+#include "../interpreter.cpp"
+#include "../jit.cpp"
+
+#include <stdlib.h>
+#include <string>
+
+static int failures = 0;
+
+static void fail(const char *what, const char *input)
+{
+	printf("Error: %s for '%s' (dialect %d).\n", what, input, BLINDFORTH_DIALECT);
+	failures++;
+}
+
+// Tokenizes `input` with the state table and with the DFA table, which have to
+// agree. Returns what tokenizing returned.
+static int tokenize_both(const char *input, TokenResult &result)
+{
+	std::string text = input;
+	TokenResult dfa;
+	Tokenizer reference(TOKENIZE_REFERENCE);
+	Tokenizer fast(TOKENIZE_DFA | TOKENIZE_SKIP);
+	int ret = tokenizer_feed(reference, &text[0], text.size(), true, result);
+
+	if (tokenizer_feed(fast, &text[0], text.size(), true, dfa) != ret ||
+	    dfa.tokens.size() != result.tokens.size() ||
+	    (ret < 0 && dfa.error.curr_offset != result.error.curr_offset)) {
+		fail("the DFA table differs", input);
+	}
+	return ret;
+}
+
+static void check_accepts(const char *input, bool accepted)
+{
+	TokenResult result;
+
+	if ((tokenize_both(input, result) > 0) != accepted) {
+		fail(accepted ? "unexpected syntax error" : "no syntax error", input);
+	}
+}
+
+static void check_runs(const char *input, Cell top)
+{
+	TokenResult result;
+	Program program;
+	Interpreter interpreter;
+	InterpreterError error;
+
+	if (tokenize_both(input, result) < 0) {
+		fail("syntax error", input);
+	} else if (interpreter_compile(program, result, error) < 0) {
+		fail(error.message, input);
+	} else if (interpreter_run(interpreter, program) < 0) {
+		fail(interpreter.error.message, input);
+	} else if (interpreter.depth != 1 || interpreter_peek(interpreter, 0) != top) {
+		fail("wrong result", input);
+	}
+}
+
+int main()
+{
+	const int dialect = BLINDFORTH_DIALECT;
+
+	check_runs(": sq dup * ;\n3 sq", 9);
+	check_runs(": sq dup * ; : quad sq sq ;\n2 quad", 16);
+	check_accepts(":", true);
+	check_accepts(": ", true);
+	check_accepts(":break", dialect & TOKEN_DIALECT_DEBUG);
+	check_accepts("1 :stack_trace 2", dialect & TOKEN_DIALECT_DEBUG);
+	check_accepts("1.5", dialect & TOKEN_DIALECT_REAL);
+	check_accepts(".5", dialect & TOKEN_DIALECT_REAL);
+	check_accepts("'a string'", dialect & TOKEN_DIALECT_SQUOTE);
+	check_accepts("\"a string\"", dialect & TOKEN_DIALECT_DQUOTE);
+
+	if (failures > 0) {
+		return 1;
+	}
+	printf("Dialect %d: all checks passed\n", dialect);
+	return 0;
+}
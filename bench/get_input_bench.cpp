@@ -0,0 +1,84 @@
+/**
+ *
+ * get_input_bench.cpp - Compares get_input against token_input_table
+ *
+ * Copyright (c) 2022 Anamitra Ghorui
+ *
+ * LICENSE_HERE
+ *
+ * Build and run with:
+ *
+ *     c++ -std=c++17 -O2 -o get_input_bench bench/get_input_bench.cpp
+ *     ./get_input_bench [corpus size in MB]
+ *
+ * The tokenizer internals are not exported, so the tokenizer source is
+ * included directly.
+ *
+ */
+
+#include "../tokenizer.cpp"
+#include "../util.cpp"
+#include "../symbol.cpp"
+#include "corpus.hpp"
+
+#include <chrono>
+#include <stdlib.h>
+
+// Histogram of the classes, so that the compiler can't throw the work away.
+typedef struct Histogram {
+	size_t count[TOKEN_INPUT_SIZE];
+} Histogram;
+
+static void classify_function(const std::vector<char> &corpus, Histogram &h)
+{
+	for (size_t i = 0; i < corpus.size(); i++) {
+		h.count[get_input((unsigned char) corpus[i])]++;
+	}
+}
+
+static void classify_table(const std::vector<char> &corpus, Histogram &h)
+{
+	for (size_t i = 0; i < corpus.size(); i++) {
+		h.count[get_input_fast(corpus[i])]++;
+	}
+}
+
+static double run(const char *name, void (*fn)(const std::vector<char> &, Histogram &),
+                  const std::vector<char> &corpus, Histogram &h, int rounds)
+{
+	double best = 1e30;
+
+	for (int r = 0; r < rounds; r++) {
+		memset(&h, 0, sizeof(h));
+		auto start = std::chrono::steady_clock::now();
+		fn(corpus, h);
+		auto stop = std::chrono::steady_clock::now();
+		double secs = std::chrono::duration<double>(stop - start).count();
+		if (secs < best) {
+			best = secs;
+		}
+	}
+
+	double mbps = (corpus.size() / (1024.0 * 1024.0)) / best;
+	printf("%-10s %10.1f MB/s\n", name, mbps);
+	return mbps;
+}
+
+int main(int argc, char **argv)
+{
+	size_t mb = (argc > 1) ? strtoul(argv[1], NULL, 10) : 16;
+	std::vector<char> corpus = make_corpus(mb * 1024 * 1024);
+	Histogram a, b;
+
+	printf("corpus: %zu MB\n", mb);
+	double fn = run("function", classify_function, corpus, a, 5);
+	double table = run("table", classify_table, corpus, b, 5);
+
+	if (memcmp(&a, &b, sizeof(a)) != 0) {
+		printf("Error: table and function disagree.\n");
+		return 1;
+	}
+
+	printf("speedup: %.2fx\n", table / fn);
+	return 0;
+}
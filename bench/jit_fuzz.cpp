@@ -0,0 +1,312 @@
+/**
+ *
+ * jit_fuzz.cpp - Running generated programs with and without the JIT
+ *
+ * Copyright (c) 2022 Anamitra Ghorui
+ *
+ * LICENSE_HERE
+ *
+ * Build and run:
+ *
+ *     c++ -std=c++17 -g -O1 -fsanitize=address,undefined -o jit_fuzz bench/jit_fuzz.cpp
+ *     ./jit_fuzz [programs]
+ *     ./jit_fuzz --print SEED
+ *
+ * Every program is run as it is by default, with the JIT, and while profiling.
+ * Each of them has to end with the same stack, the same error message, and the
+ * error at the same offset. Anything else aborts, and prints the seed of the
+ * program, which `--print` writes out again.
+ *
+ * A program is a few words, each taking a number and leaving one, made of
+ * random arithmetic, stack shuffling, conditionals, loops, reals and calls to
+ * the words before it. Some of them also recurse. Each word is then called
+ * from a loop more than JIT_THRESHOLD times, so that it is compiled into
+ * machine code partway through. Some of the words have a trap, which fails in
+ * one of the ways a word can fail (division by zero or overflow, either stack
+ * running over or under) on one call late enough for the word to have been
+ * compiled.
+ *
+ */
+
+#include "../tokenizer.cpp"
+#include "../util.cpp"
+#include "../symbol.cpp"
+#include "../interpreter.cpp"
+#include "../jit.cpp"
+#include "corpus.hpp"
+
+#include <stdlib.h>
+#include <string>
+
+#define JIT_FUZZ_DEPTH 6  // Most cells a word keeps on the stack
+#define JIT_FUZZ_NESTING 3 // Most conditionals and loops inside each other
+
+typedef struct ProgramGen {
+	std::string text;
+	unsigned int seed;
+	int words;   // Words defined so far
+	int nesting; // Conditionals and loops around what is being generated
+	int loops;   // Loops around it, within the word
+} ProgramGen;
+
+static unsigned int gen_rand(ProgramGen &gen, unsigned int n)
+{
+	return corpus_rand(gen.seed) % n;
+}
+
+static void gen_append(ProgramGen &gen, const std::string &s)
+{
+	gen.text += s;
+	gen.text += ' ';
+}
+
+// Mostly small numbers, so that loops and comparisons go either way, and now
+// and then one that overflows when multiplied.
+static void gen_int(ProgramGen &gen)
+{
+	if (gen_rand(gen, 8) == 0) {
+		gen_append(gen, std::to_string((long long) gen_rand(gen, 1u << 31) << 20));
+	} else {
+		gen_append(gen, std::to_string((int) gen_rand(gen, 41) - 20));
+	}
+}
+
+// Code that leaves `depth` cells as it found them, but for their values.
+static void gen_code(ProgramGen &gen, int depth, int length);
+
+static void gen_step(ProgramGen &gen, int &depth)
+{
+	static const char *const unary[] = { "negate", "abs", "invert", "dup *" };
+	static const char *const binary[] = {
+		"+", "-", "*", "and", "or", "xor", "min", "max",
+		"=", "<>", "<", ">", "<=", ">=", "nip"
+	};
+	static const char *const compare[] = { "<", ">", "=", "<>" };
+	unsigned int pick = gen_rand(gen, 16);
+
+	if (depth == 0 || (pick < 3 && depth < JIT_FUZZ_DEPTH)) {
+		gen_int(gen);
+		depth++;
+	} else if (pick < 5) {
+		gen_append(gen, unary[gen_rand(gen, 4)]);
+	} else if (pick < 8 && depth >= 2) {
+		gen_append(gen, binary[gen_rand(gen, 15)]);
+		depth--;
+	} else if (pick < 9) {
+		// Never by zero, which the traps are for.
+		int n = 1 + gen_rand(gen, 9);
+		gen_append(gen, std::to_string(gen_rand(gen, 2) ? n : -n));
+		gen_append(gen, gen_rand(gen, 2) ? "/" : "mod");
+	} else if (pick < 10 && depth < JIT_FUZZ_DEPTH) {
+		gen_append(gen, gen_rand(gen, 2) ? "dup" : (depth >= 2 ? "over" : "dup"));
+		depth++;
+	} else if (pick < 11 && depth >= 2) {
+		gen_append(gen, (depth >= 3 && gen_rand(gen, 2)) ? "rot" : "swap");
+	} else if (pick < 12 && depth >= 2) {
+		gen_append(gen, "drop");
+		depth--;
+	} else if (pick < 13) {
+		// Halving a cell always fits back into one.
+		gen_append(gen, "to_real 0.5 fmul to_int");
+	} else if (pick < 14 && gen.words > 0) {
+		gen_append(gen, "w" + std::to_string(gen_rand(gen, gen.words)));
+	} else if (pick < 15 && gen.nesting < JIT_FUZZ_NESTING) {
+		gen_append(gen, "dup");
+		gen_int(gen);
+		gen_append(gen, compare[gen_rand(gen, 4)]);
+		gen_append(gen, "if");
+		gen.nesting++;
+		gen_code(gen, depth, 1 + gen_rand(gen, 6));
+		if (gen_rand(gen, 2)) {
+			gen_append(gen, "else");
+			gen_code(gen, depth, 1 + gen_rand(gen, 6));
+		}
+		gen.nesting--;
+		gen_append(gen, "then");
+	} else if (gen.nesting < JIT_FUZZ_NESTING && depth < JIT_FUZZ_DEPTH) {
+		// The body adds `i` (and `j`, if there is one) to the top cell.
+		gen_append(gen, std::to_string(gen_rand(gen, 12)));
+		gen_append(gen, std::to_string(gen_rand(gen, 3)));
+		gen_append(gen, "do");
+		gen.nesting++;
+		gen.loops++;
+		gen_code(gen, depth, 1 + gen_rand(gen, 4));
+		gen_append(gen, (gen.loops > 1 && gen_rand(gen, 2)) ? "j +" : "i +");
+		gen.loops--;
+		gen.nesting--;
+		gen_append(gen, "loop");
+	}
+}
+
+static void gen_code(ProgramGen &gen, int depth, int length)
+{
+	int now = depth;
+
+	for (int i = 0; i < length; i++) {
+		gen_step(gen, now);
+	}
+	for (; now > depth; now--) {
+		gen_append(gen, gen_rand(gen, 2) ? "+" : "drop");
+	}
+	for (; now < depth; now++) {
+		gen_int(gen);
+	}
+}
+
+// Fails when the word is given `n`.
+static void gen_trap(ProgramGen &gen, int n)
+{
+	gen_append(gen, "dup " + std::to_string(n) + " = if");
+	switch (gen_rand(gen, 5)) {
+	case 0:
+		gen_append(gen, "dup dup " + std::to_string(n) + " - / drop");
+		break;
+	case 4:
+		// INT64_MIN / -1, made from the argument so that it isn't folded.
+		gen_append(gen, "dup " + std::to_string(n) + " - -9223372036854775807 + 1 - -1 / drop");
+		break;
+	case 1:
+		gen_append(gen, "drop drop drop");
+		break;
+	case 2:
+		gen_append(gen, "begin dup again");
+		break;
+	default:
+		gen_append(gen, "recurse");
+		break;
+	}
+	gen_append(gen, "then");
+}
+
+static std::string make_program(unsigned int seed)
+{
+	ProgramGen gen;
+	int count = 1 + seed % 6;
+	int calls = JIT_THRESHOLD + 1 + seed % JIT_THRESHOLD;
+
+	gen.seed = seed;
+	gen.words = 0;
+	gen.nesting = 0;
+	gen.loops = 0;
+
+	for (int w = 0; w < count; w++) {
+		gen_append(gen, ": w" + std::to_string(w));
+		if (gen_rand(gen, 10) == 0) {
+			gen_trap(gen, JIT_THRESHOLD + 1 + gen_rand(gen, calls - JIT_THRESHOLD));
+		}
+		if (gen_rand(gen, 5) == 0) {
+			// Counts down to a few calls deep, whatever it is given.
+			gen_append(gen, "dup 8 mod abs dup 0 > if 1 - recurse + else drop then");
+		}
+		gen_code(gen, 1, 2 + gen_rand(gen, 12));
+		gen_append(gen, ";\n");
+		gen.words++;
+	}
+
+	gen_append(gen, "0");
+	for (int w = 0; w < count; w++) {
+		gen_append(gen, std::to_string(calls) + " 0 do i w" + std::to_string(w) + " + loop\n");
+	}
+	return gen.text;
+}
+
+typedef struct RunResult {
+	int ret;
+	std::vector<Cell> stack;
+	const char *message;
+	unsigned int offset;
+} RunResult;
+
+static const char *const run_names[] = { "normal", "profile", "jit" };
+
+static RunResult run_program(const std::string &text, int mode)
+{
+	RunResult run;
+	TokenResult tokens;
+	Interpreter interpreter;
+	InterpreterProfile profile;
+	Program program;
+	InterpreterError error;
+	std::vector<char> input(text.begin(), text.end());
+
+	if (tokenize(input.data(), input.size(), true, tokens) < 0 ||
+	    interpreter_compile(program, tokens, error) < 0) {
+		printf("Error: generated program doesn't compile:\n%s\n", text.c_str());
+		fflush(stdout);
+		abort();
+	}
+
+	interpreter.profile = (mode == RUN_PROFILE) ? &profile : NULL;
+	interpreter.jit = (mode == RUN_JIT);
+	interpreter.error.message = NULL;
+	interpreter.error.offset = 0;
+
+	run.ret = interpreter_run(interpreter, program);
+	for (size_t i = interpreter.depth; i > 0; i--) {
+		run.stack.push_back(interpreter_peek(interpreter, i - 1));
+	}
+	run.message = (run.ret < 0) ? interpreter.error.message : NULL;
+	run.offset = (run.ret < 0) ? interpreter.error.offset : 0;
+	return run;
+}
+
+static bool same_run(const RunResult &a, const RunResult &b)
+{
+	return a.ret == b.ret && a.stack == b.stack && a.offset == b.offset &&
+	       (a.message == b.message ||
+	        (a.message && b.message && strcmp(a.message, b.message) == 0));
+}
+
+static void print_run(const char *name, const RunResult &run)
+{
+	printf("  %-7s returned %d, %s at %u, stack:", name, run.ret,
+	       run.message ? run.message : "no error", run.offset);
+	for (Cell c : run.stack) {
+		printf(" %lld", (long long) c);
+	}
+	printf("\n");
+}
+
+// Returns whether the program ended in an error, which should be the case for
+// some but not most of them.
+static int check_program(unsigned int seed)
+{
+	std::string text = make_program(seed);
+	RunResult normal = run_program(text, RUN_NORMAL);
+
+	for (int mode : { RUN_PROFILE, RUN_JIT }) {
+		RunResult run = run_program(text, mode);
+		if (!same_run(normal, run)) {
+			printf("Error: program %u differs when run with %s:\n", seed, run_names[mode]);
+			print_run(run_names[RUN_NORMAL], normal);
+			print_run(run_names[mode], run);
+			fflush(stdout);
+			abort();
+		}
+	}
+	return normal.ret < 0;
+}
+
+int main(int argc, char **argv)
+{
+	size_t count = 1000;
+	size_t failed = 0;
+
+	if (argc > 2 && strcmp(argv[1], "--print") == 0) {
+		printf("%s", make_program(strtoul(argv[2], NULL, 10)).c_str());
+		return 0;
+	} else if (argc > 1) {
+		count = strtoul(argv[1], NULL, 10);
+	}
+
+#ifndef INTERPRETER_JIT
+	printf("Warning: no JIT in this build, only the interpreter is checked.\n");
+#endif
+
+	for (size_t i = 0; i < count; i++) {
+		failed += check_program(i + 1);
+	}
+
+	printf("%zu programs (%zu ending in an error): results identical\n", count, failed);
+	return 0;
+}
@@ -0,0 +1,262 @@
+/**
+ *
+ * tokenize_bench.cpp - Throughput of every tokenizer mode over corpora of
+ *                      different shapes
+ *
+ * Copyright (c) 2022 Anamitra Ghorui
+ *
+ * LICENSE_HERE
+ *
+ * Build and run with:
+ *
+ *     c++ -std=c++17 -O2 -pthread -o tokenize_bench bench/tokenize_bench.cpp
+ *     ./tokenize_bench [options]
+ *
+ * Options:
+ *
+ *     --size MB          Size of each corpus (default 8)
+ *     --rounds N         Number of timed runs, the best is kept (default 5)
+ *     --json FILE        Write the results to FILE as JSON
+ *     --compare FILE     Compare against the results in FILE, which was written
+ *                        by --json, and fail if anything got slower
+ *     --threshold PCT    How much slower counts as slower (default 10)
+ *
+ * For every corpus shape (see corpus.hpp) and every mode, this reports the
+ * bytes and tokens tokenized per second, and the number of allocations made
+ * per token. Allocations are counted by replacing the global `operator new`,
+ * and by counting the blocks of the string buffer, which are allocated with
+ * `malloc`. The allocations of the symbol table count too, for `interned`.
+ *
+ */
+
+#include "../tokenizer.cpp"
+#include "../util.cpp"
+#include "../symbol.cpp"
+#include "../source.cpp"
+#include "corpus.hpp"
+
+#include <chrono>
+#include <new>
+#include <stdlib.h>
+
+static size_t allocations = 0;
+
+void *operator new(size_t size)
+{
+	allocations++;
+	void *p = malloc(size ? size : 1);
+	if (!p) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void operator delete(void *p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+	free(p);
+}
+
+typedef int (*TokenizeFn)(char *input, int size, bool end, TokenResult &result);
+
+// tokenize_stream, split between all of the CPUs.
+static int tokenize_parallel_stream(char *input, int size, bool, TokenResult &result)
+{
+	return tokenize_parallel(input, size,
+	                         TOKENIZE_DFA | TOKENIZE_SKIP | TOKENIZE_VIEWS | TOKENIZE_STREAM,
+	                         0, result);
+}
+
+static const TokenizeFn modes[] = {
+	tokenize, tokenize_dfa, tokenize_fast, tokenize_views, tokenize_stream,
+	tokenize_interned, tokenize_parallel_stream
+};
+static const char *mode_names[] = {
+	"tokenize", "dfa", "fast", "views", "stream", "interned", "parallel"
+};
+#define MODE_COUNT (sizeof(modes) / sizeof(modes[0]))
+
+typedef struct BenchResult {
+	const char *shape;
+	const char *mode;
+	double bytes_per_sec;
+	double tokens_per_sec;
+	double allocs_per_token;
+} BenchResult;
+
+static size_t token_count(const TokenResult &result)
+{
+	return result.tokens.size() + token_stream_size(result.stream);
+}
+
+// Returns -1 if the corpus could not be tokenized, which would make the
+// numbers meaningless.
+static int run_bench(TokenizeFn fn, std::vector<char> &input, int rounds, BenchResult &out)
+{
+	double best = 1e30;
+	size_t tokens = 0;
+	size_t allocs = 0;
+
+	for (int r = 0; r < rounds; r++) {
+		TokenResult result;
+		SymbolTable symbols;
+		result.symbols = (fn == tokenize_interned) ? &symbols : NULL;
+		size_t before = allocations;
+
+		auto start = std::chrono::steady_clock::now();
+		int ret = fn(input.data(), input.size(), true, result);
+		auto stop = std::chrono::steady_clock::now();
+
+		if (ret != 1) {
+			return -1;
+		}
+
+		double secs = std::chrono::duration<double>(stop - start).count();
+		if (secs < best) {
+			best = secs;
+		}
+
+		tokens = token_count(result);
+		allocs = allocations - before + result.buffer.blocks.size();
+	}
+
+	out.bytes_per_sec = input.size() / best;
+	out.tokens_per_sec = tokens / best;
+	out.allocs_per_token = tokens ? (double) allocs / tokens : 0;
+	return 0;
+}
+
+static int write_json(const char *path, size_t size, const std::vector<BenchResult> &results)
+{
+	FILE *f = fopen(path, "w");
+	if (!f) {
+		printf("Error: cannot write '%s'.\n", path);
+		return -1;
+	}
+
+	// One result to a line, so that --compare can read it back without a
+	// JSON parser.
+	fprintf(f, "{\n\t\"corpus_size\": %zu,\n\t\"results\": [\n", size);
+	for (size_t i = 0; i < results.size(); i++) {
+		const BenchResult &r = results[i];
+		fprintf(f, "\t\t{\"shape\": \"%s\", \"mode\": \"%s\", "
+		        "\"bytes_per_sec\": %.0f, \"tokens_per_sec\": %.0f, "
+		        "\"allocs_per_token\": %.6f}%s\n",
+		        r.shape, r.mode, r.bytes_per_sec, r.tokens_per_sec,
+		        r.allocs_per_token, (i + 1 < results.size()) ? "," : "");
+	}
+	fprintf(f, "\t]\n}\n");
+	fclose(f);
+	return 0;
+}
+
+// Returns the number of results that are slower than in `path` by more than
+// `threshold` percent, or -1 if the file can't be read.
+static int compare_json(const char *path, double threshold, const std::vector<BenchResult> &results)
+{
+	FILE *f = fopen(path, "r");
+	char line[512];
+	int slower = 0;
+
+	if (!f) {
+		printf("Error: cannot read '%s'.\n", path);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		char shape[64], mode[64];
+		double old_bps;
+
+		if (sscanf(line, " {\"shape\": \"%63[^\"]\", \"mode\": \"%63[^\"]\", "
+		           "\"bytes_per_sec\": %lf", shape, mode, &old_bps) != 3) {
+			continue;
+		}
+
+		for (size_t i = 0; i < results.size(); i++) {
+			const BenchResult &r = results[i];
+			if (strcmp(r.shape, shape) != 0 || strcmp(r.mode, mode) != 0) {
+				continue;
+			}
+
+			double change = (r.bytes_per_sec / old_bps - 1) * 100;
+			bool worse = change < -threshold;
+			printf("%-12s %-10s %+7.1f%%%s\n", shape, mode, change,
+			       worse ? "  SLOWER" : "");
+			slower += worse;
+		}
+	}
+
+	fclose(f);
+	return slower;
+}
+
+int main(int argc, char **argv)
+{
+	size_t mb = 8;
+	int rounds = 5;
+	double threshold = 10;
+	const char *json = NULL;
+	const char *compare = NULL;
+	std::vector<BenchResult> results;
+
+	for (int i = 1; i < argc; i++) {
+		bool has_value = i + 1 < argc;
+
+		if (!strcmp(argv[i], "--size") && has_value) {
+			mb = strtoul(argv[++i], NULL, 10);
+		} else if (!strcmp(argv[i], "--rounds") && has_value) {
+			rounds = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--json") && has_value) {
+			json = argv[++i];
+		} else if (!strcmp(argv[i], "--compare") && has_value) {
+			compare = argv[++i];
+		} else if (!strcmp(argv[i], "--threshold") && has_value) {
+			threshold = strtod(argv[++i], NULL);
+		} else {
+			printf("Usage: %s [--size MB] [--rounds N] [--json FILE] "
+			       "[--compare FILE] [--threshold PCT]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	printf("%-12s %-10s %12s %14s %14s\n",
+	       "shape", "mode", "MB/s", "Mtokens/s", "allocs/token");
+
+	for (int shape = 0; shape < CORPUS_SHAPE_SIZE; shape++) {
+		std::vector<char> corpus = make_shaped_corpus((CorpusShape) shape, mb * 1024 * 1024);
+
+		for (size_t m = 0; m < MODE_COUNT; m++) {
+			BenchResult r;
+			r.shape = corpus_shape_names[shape];
+			r.mode = mode_names[m];
+
+			if (run_bench(modes[m], corpus, rounds, r) < 0) {
+				printf("Error: the %s corpus does not tokenize in mode '%s'.\n",
+				       r.shape, r.mode);
+				return 1;
+			}
+
+			printf("%-12s %-10s %12.1f %14.2f %14.4f\n", r.shape, r.mode,
+			       r.bytes_per_sec / (1024 * 1024), r.tokens_per_sec / 1e6,
+			       r.allocs_per_token);
+			results.push_back(r);
+		}
+	}
+
+	if (json && write_json(json, mb * 1024 * 1024, results) < 0) {
+		return 1;
+	}
+
+	if (compare) {
+		int slower = compare_json(compare, threshold, results);
+		if (slower != 0) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,446 @@
+/**
+ *
+ * tokenize_fuzz.cpp - Fuzzing every tokenizer mode against tokenize
+ *
+ * Copyright (c) 2022 Anamitra Ghorui
+ *
+ * LICENSE_HERE
+ *
+ * Build and run with libFuzzer:
+ *
+ *     clang++ -std=c++17 -g -O1 -fsanitize=fuzzer,address,undefined \
+ *         -o tokenize_fuzz bench/tokenize_fuzz.cpp
+ *     ./tokenize_fuzz [libFuzzer options] [corpus directory]
+ *
+ * Or without it, from the inputs of corpus.hpp:
+ *
+ *     c++ -std=c++17 -g -O1 -pthread -fsanitize=address,undefined \
+ *         -DBLINDFORTH_NO_LIBFUZZER -o tokenize_fuzz bench/tokenize_fuzz.cpp
+ *     ./tokenize_fuzz [inputs]
+ *     ./tokenize_fuzz FILE...
+ *     ./tokenize_fuzz --seeds DIR [inputs]
+ *
+ * The threads that share a `SourceReader`, a `TokenQueue`, or the vector
+ * scanners are best checked with ThreadSanitizer instead, which can't be used
+ * along with AddressSanitizer:
+ *
+ *     c++ -std=c++17 -g -O1 -pthread -fsanitize=thread \
+ *         -DBLINDFORTH_NO_LIBFUZZER -o tokenize_fuzz_tsan bench/tokenize_fuzz.cpp
+ *     ./tokenize_fuzz_tsan [inputs]
+ *
+ * Every input is tokenized by `tokenize` in one go, and then by every
+ * combination of `TokenizeMode` flags, fed in random pieces, with
+ * `tokenize_parallel`, and as four documents of a batch on four threads, with
+ * every vector implementation the CPU supports. A few random edits are then
+ * made to it, one after another, each brought into the result of the last by
+ * `tokenize_edit`. It is also written to a file and read back in blocks by a
+ * `SourceReader`, and handed from one thread to another through a small
+ * `TokenQueue`. Any result that differs from that of `tokenize` in any field,
+ * or in where the error is, aborts.
+ *
+ * Without libFuzzer, the inputs are made by `make_generated_corpus` with a
+ * random mix each (1000 of them by default), and some of them have a few bytes
+ * overwritten so that they hit errors too. FILEs are run instead, such as the
+ * crashes libFuzzer leaves. `--seeds` writes the inputs to DIR instead, to
+ * start libFuzzer off with inputs that look like real scripts.
+ *
+ */
+
+#include "../tokenizer.cpp"
+#include "../util.cpp"
+#include "../symbol.cpp"
+#include "../source.cpp"
+#include "check.hpp"
+#include "corpus.hpp"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+
+static void differs(const char *how, int mode, int level)
+{
+	printf("Error: %s mode %d differs from tokenize (vector level %d).\n", how, mode, level);
+	fflush(stdout);
+	abort();
+}
+
+// Every document of a batch made of copies of the input has to come out as
+// the input alone does. Views count from the start of each document, so they
+// are read through a result with `source` set to it.
+static bool same_batch(int ret_ref, const TokenResult &ref, int ret, const TokenBatch &batch,
+                       const TokenSpan *spans, size_t count, int mode)
+{
+	if (ret != ret_ref || batch.status.size() != count ||
+	    batch.result.characters_processed != ref.characters_processed * count ||
+	    batch.result.lines_processed != ref.lines_processed * count) {
+		return false;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		TokenResult doc;
+		doc.source = (mode & TOKENIZE_VIEWS) ? spans[i].input : NULL;
+		doc.symbols = batch.result.symbols;
+
+		if (batch.status[i] != ret_ref ||
+		    (ret_ref < 0 && !same_error(ref.error, batch.errors[i])) ||
+		    batch.starts[i + 1] - batch.starts[i] != ref.tokens.size()) {
+			return false;
+		}
+		for (size_t j = 0; j < ref.tokens.size(); j++) {
+			Token token = token_stream_get(batch.result.stream, batch.starts[i] + j);
+			if (!same_token(ref, ref.tokens[j], doc, token)) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+// A few random edits to `input`, each brought into the result of the one
+// before by `tokenize_edit`, and compared with tokenizing the edited input
+// afresh. The inserted bytes are the ones most likely to join, split, or open
+// tokens.
+static void check_edits(const std::vector<char> &input, int mode, int level, unsigned int &seed)
+{
+	static const char bytes[] = " \n\t'\"ab_1.-:";
+	std::vector<char> text = input;
+	TokenResult result;
+	SymbolTable symbols;
+	Tokenizer tokenizer(mode);
+
+	result.symbols = (mode & TOKENIZE_INTERN) ? &symbols : NULL;
+	tokenizer_feed(tokenizer, text.data(), text.size(), true, result);
+
+	for (int i = 0; i < 4; i++) {
+		TokenEdit edit;
+		edit.offset = corpus_rand(seed) % (text.size() + 1);
+		edit.removed = corpus_rand(seed) % (text.size() - edit.offset + 1);
+		edit.removed = (edit.removed < 32) ? edit.removed : corpus_rand(seed) % 32;
+		edit.inserted = corpus_rand(seed) % 32;
+
+		std::vector<char> edited(text.begin(), text.begin() + edit.offset);
+		for (size_t j = 0; j < edit.inserted; j++) {
+			edited.push_back(bytes[corpus_rand(seed) % (sizeof(bytes) - 1)]);
+		}
+		edited.insert(edited.end(), text.begin() + edit.offset + edit.removed, text.end());
+		text.swap(edited);
+
+		TokenResult ref;
+		int ret_ref = tokenize(text.data(), text.size(), true, ref);
+		int ret = tokenize_edit(text.data(), text.size(), mode, edit, result);
+		if (!same_result(ret_ref, ref, ret, result)) {
+			differs("edited", mode, level);
+		}
+	}
+}
+
+// Reads `path`, which holds `input`, through a `SourceReader` with blocks of
+// `block_size` bytes.
+static void check_reader(const char *path, const std::vector<char> &input, size_t block_size,
+                         int mode, int level)
+{
+	TokenResult ref;
+	int ret_ref = tokenize((char *) input.data(), input.size(), true, ref);
+	TokenResult result;
+	SymbolTable symbols;
+	SourceReader reader;
+	int ret;
+
+	result.symbols = (mode & TOKENIZE_INTERN) ? &symbols : NULL;
+	if (source_reader_open(reader, path, mode, block_size) < 0) {
+		differs("read", mode, level);
+	}
+	while ((ret = source_reader_next(reader, result)) == 0) {
+	}
+	if (reader.failed || !same_result(ret_ref, ref, ret, result)) {
+		differs("read", mode, level);
+	}
+	source_reader_close(reader);
+}
+
+// A file that isn't there can't be opened, and a directory can be opened but
+// not read. Neither is a syntax error.
+static void check_reader_errors()
+{
+	SourceReader missing;
+	SourceReader directory;
+	TokenResult result;
+
+	errno = 0;
+	if (source_reader_open(missing, "/nonexistent/tokenize_fuzz", 0) >= 0 || errno != ENOENT) {
+		differs("unopenable", 0, 0);
+	}
+
+	if (source_reader_open(directory, "/", 0) == 0) {
+		for (int i = 0; i < 2; i++) {
+			errno = 0;
+			if (source_reader_next(directory, result) >= 0 || !directory.failed ||
+			    errno != EISDIR || token_result_failed(result)) {
+				differs("unreadable", 0, 0);
+			}
+		}
+		source_reader_close(directory);
+	}
+}
+
+// The input is written to a temporary file, and read back with a small random
+// block size, and with one that the size of the input is a multiple of, so
+// that the last block is full.
+static void check_readers(const std::vector<char> &input, int level, unsigned int &seed)
+{
+	char path[] = "/tmp/tokenize_fuzz_XXXXXX";
+	int fd = mkstemp(path);
+	size_t multiple = 1 + corpus_rand(seed) % 64;
+
+	if (fd < 0 || write(fd, input.data(), input.size()) != (ssize_t) input.size()) {
+		printf("Error: cannot write '%s'.\n", path);
+		abort();
+	}
+	close(fd);
+
+	while (input.size() % multiple != 0) {
+		multiple--;
+	}
+
+	for (int mode = 0; mode < TOKENIZE_MODE_SIZE; mode++) {
+		// The blocks are reused, so the tokens can't be views into them.
+		if (!(mode & TOKENIZE_VIEWS)) {
+			check_reader(path, input, 1 + corpus_rand(seed) % 64, mode, level);
+			check_reader(path, input, multiple, mode, level);
+		}
+	}
+	unlink(path);
+}
+
+// Tokenizes the input into a queue of a few tokens, on a thread of its own,
+// in small pieces, while this thread pops a few tokens at a time. Together
+// with `queue.status` and `queue.error`, the tokens popped have to be those of
+// `tokenize`, and their text is read from the result the pushing side filled.
+static void check_queue(std::vector<char> &input, const TokenResult &ref, int ret_ref,
+                        int level, unsigned int &seed)
+{
+	for (int mode = 0; mode < TOKENIZE_MODE_SIZE; mode++) {
+		if (mode & (TOKENIZE_STREAM | TOKENIZE_INTERN)) {
+			continue;
+		}
+
+		TokenQueue queue;
+		TokenResult result;
+		std::vector<Token> popped;
+		Token tokens[8];
+		size_t piece = 1 + corpus_rand(seed) % 64;
+		size_t max = 1 + corpus_rand(seed) % 8;
+		size_t n;
+		int ret = 0;
+
+		token_queue_init(queue, 1 + corpus_rand(seed) % 8);
+		std::thread pusher([&] {
+			ret = tokenize_queued(input.data(), input.size(), mode, result, queue, piece);
+		});
+		while ((n = token_queue_pop(queue, tokens, max)) > 0) {
+			popped.insert(popped.end(), tokens, tokens + n);
+		}
+		pusher.join();
+
+		if (ret != ret_ref || queue.status != ret_ref ||
+		    (ret_ref < 0 && !same_error(ref.error, queue.error)) ||
+		    popped.size() != ref.tokens.size()) {
+			differs("queued", mode, level);
+		}
+		for (size_t i = 0; i < popped.size(); i++) {
+			if (!same_token(ref, ref.tokens[i], result, popped[i])) {
+				differs("queued", mode, level);
+			}
+		}
+	}
+}
+
+static void check_input(std::vector<char> &input, unsigned int seed)
+{
+	TokenResult ref;
+	int ret_ref = tokenize(input.data(), input.size(), true, ref);
+	UtilSimd best = util_simd_detect();
+	static bool checked_errors = false;
+
+	if (!checked_errors) {
+		check_reader_errors();
+		checked_errors = true;
+	}
+
+	for (int level = UTIL_SIMD_NONE; level <= UTIL_SIMD_NEON; level++) {
+		if (util_simd_select((UtilSimd) level) < 0) {
+			continue;
+		}
+
+		for (int mode = 0; mode < TOKENIZE_MODE_SIZE; mode++) {
+			SymbolTable first;
+			bool have_first = false;
+
+			// In one piece, in pieces that split most tokens, and in pieces
+			// that split some.
+			for (size_t max : { input.size(), (size_t) 8, (size_t) 100 }) {
+				std::vector<size_t> pieces = corpus_pieces(input.size(), max ? max : 1, seed);
+				TokenResult result;
+				SymbolTable symbols;
+				result.symbols = (mode & TOKENIZE_INTERN) ? &symbols : NULL;
+
+				int ret = feed_pieces(mode, input, pieces, result);
+				if (!same_result(ret_ref, ref, ret, result)) {
+					differs("fed", mode, level);
+				}
+				if (ret > 0 && !same_symbols(result, first, have_first)) {
+					differs("interned", mode, level);
+				}
+			}
+
+			TokenResult result;
+			SymbolTable symbols;
+			result.symbols = (mode & TOKENIZE_INTERN) ? &symbols : NULL;
+
+			int ret = tokenize_parallel(input.data(), input.size(), mode, 3, result);
+			if (!same_result(ret_ref, ref, ret, result)) {
+				differs("parallel", mode, level);
+			}
+
+			TokenSpan spans[4];
+			TokenBatch batch;
+			SymbolTable batch_symbols;
+			batch.result.symbols = (mode & TOKENIZE_INTERN) ? &batch_symbols : NULL;
+			for (size_t i = 0; i < 4; i++) {
+				spans[i].input = input.data();
+				spans[i].size = input.size();
+			}
+
+			ret = tokenize_batch(spans, 4, mode, 4, batch);
+			if (!same_batch(ret_ref, ref, ret, batch, spans, 4, mode)) {
+				differs("batched", mode, level);
+			}
+
+			check_edits(input, mode, level, seed);
+		}
+	}
+
+	// The reader and the queue only add a thread handing blocks or tokens
+	// over, which doesn't depend on the vector implementation.
+	util_simd_select(best);
+	check_readers(input, best, seed);
+	check_queue(input, ref, ret_ref, best, seed);
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	std::vector<char> input(data, data + size);
+	unsigned int seed = (unsigned int) size;
+
+	// The pieces are picked from the input itself, so that a crash can be
+	// run again from the input alone.
+	for (size_t i = 0; i < size; i++) {
+		seed = seed * 31 + data[i];
+	}
+
+	check_input(input, seed);
+	return 0;
+}
+
+#ifdef BLINDFORTH_NO_LIBFUZZER
+
+// An input of up to 4096 bytes with a random mix of tokens. Every other input
+// has a few bytes overwritten, with the bytes most likely to end something
+// early or to be invalid.
+static std::vector<char> make_input(unsigned int &seed)
+{
+	static const char bytes[] = " \n\r.+-:'\"\\\x01\x80\xbf\xc3\xe2\xf0\xff";
+	CorpusMix mix;
+
+	mix.ints = corpus_rand(seed) % 10;
+	mix.reals = corpus_rand(seed) % 10;
+	mix.strings = corpus_rand(seed) % 10;
+	mix.words = corpus_rand(seed) % 10;
+	mix.debug = corpus_rand(seed) % 10;
+	mix.utf8 = corpus_rand(seed) % 50;
+	mix.line_tokens = 1 + corpus_rand(seed) % 16;
+	mix.indent = corpus_rand(seed) % 16;
+	mix.ending = (CorpusLineEnding) (corpus_rand(seed) % CORPUS_ENDING_SIZE);
+
+	std::vector<char> input = make_generated_corpus(mix, corpus_rand(seed) % 4096,
+	                                                corpus_rand(seed));
+	if (corpus_rand(seed) % 2 && !input.empty()) {
+		for (size_t n = 1 + corpus_rand(seed) % 4; n > 0; n--) {
+			input[corpus_rand(seed) % input.size()] =
+				bytes[corpus_rand(seed) % (sizeof(bytes) - 1)];
+		}
+	}
+	return input;
+}
+
+static int run_file(const char *path)
+{
+	FILE *f = fopen(path, "rb");
+	std::vector<uint8_t> data;
+	int c;
+
+	if (!f) {
+		printf("Error: cannot read '%s'.\n", path);
+		return -1;
+	}
+	while ((c = fgetc(f)) != EOF) {
+		data.push_back(c);
+	}
+	fclose(f);
+
+	LLVMFuzzerTestOneInput(data.data(), data.size());
+	return 0;
+}
+
+static int write_seeds(const char *dir, size_t count)
+{
+	unsigned int seed = 1;
+
+	for (size_t i = 0; i < count; i++) {
+		std::vector<char> input = make_input(seed);
+		std::string path = std::string(dir) + "/seed_" + std::to_string(i);
+		FILE *f = fopen(path.c_str(), "wb");
+
+		if (!f) {
+			printf("Error: cannot write '%s'.\n", path.c_str());
+			return -1;
+		}
+		fwrite(input.data(), 1, input.size(), f);
+		fclose(f);
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	size_t count = 1000;
+	unsigned int seed = 1;
+
+	if (argc > 2 && strcmp(argv[1], "--seeds") == 0) {
+		count = (argc > 3) ? strtoul(argv[3], NULL, 10) : 100;
+		return (write_seeds(argv[2], count) < 0) ? 1 : 0;
+	}
+
+	if (argc > 1 && strspn(argv[1], "0123456789") != strlen(argv[1])) {
+		for (int i = 1; i < argc; i++) {
+			if (run_file(argv[i]) < 0) {
+				return 1;
+			}
+		}
+		printf("%d files: results identical\n", argc - 1);
+		return 0;
+	} else if (argc > 1) {
+		count = strtoul(argv[1], NULL, 10);
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		std::vector<char> input = make_input(seed);
+		LLVMFuzzerTestOneInput((const uint8_t *) input.data(), input.size());
+	}
+
+	printf("%zu inputs: results identical\n", count);
+	return 0;
+}
+
+#endif
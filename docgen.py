@@ -1,16 +1,39 @@
 # Generates Markdown files from each of the source code files.
 # Markdown comment sections in the source files are marked by "\**md".
-
-from typing import List, Dict
+#
+# Usage: python3 docgen.py [--force] [--jobs N]
+#
+# Only the files that changed since the last run are converted again. The hash
+# of each source file is kept in a manifest in DEST_DIR, along with the hash of
+# this script, so that changing it converts everything again. --force ignores
+# the manifest. The files that need converting are converted in parallel, by
+# N processes (by default, one for each CPU).
+
+from concurrent.futures import ProcessPoolExecutor
+from typing import List, Dict, Optional, TextIO, Tuple
+import argparse
+import hashlib
+import json
+import os
 import re
 import sys
 
 # Constants
 DEST_DIR = "doc"
 SRC_DIR  = "."
+MANIFEST = ".docgen_manifest.json"
 
 DOC_NAMES: List[Dict] = [
-	{ 'src': "tokenizer.cpp", 'dest': "tokenizer.md" }
+	{ 'src': "tokenizer.cpp",   'dest': "tokenizer.md" },
+	{ 'src': "tokenizer.hpp",   'dest': "tokenizer_types.md" },
+	{ 'src': "source.cpp",      'dest': "source.md" },
+	{ 'src': "symbol.cpp",      'dest': "symbol.md" },
+	{ 'src': "interpreter.cpp", 'dest': "interpreter.md" },
+	{ 'src': "interpreter.hpp", 'dest': "interpreter_types.md" },
+	{ 'src': "jit.cpp",         'dest': "jit.md" },
+	{ 'src': "jit.hpp",         'dest': "jit_types.md" },
+	{ 'src': "image.cpp",       'dest': "image.md" },
+	{ 'src': "image.hpp",       'dest': "image_types.md" }
 ]
 
 
@@ -29,10 +52,12 @@ class State:
 	NOBLOCK = 1
 	START = 2
 
+# Writes the document to `out` as it goes, rather than building it up in
+# memory. Returns False on an error, in which case what was written to `out`
+# is incomplete.
 # TODO: Create separate code block buffer to determine inclusion of blocks.
-def prepare_document(src) -> str:
+def prepare_document(src: TextIO, out: TextIO) -> bool:
 	state: int = State.NOBLOCK_START
-	ret: str = ""
 	linecount: int = 0
 
 	# This variable checks whether the leading lines of a noncomment block are
@@ -65,9 +90,9 @@ def prepare_document(src) -> str:
 
 			if m:
 				state = State.START
-				ret += m.group(1) + '\n'
+				out.write(m.group(1) + '\n')
 			else:
-				ret += '```\n'
+				out.write('```\n')
 				state = State.NOBLOCK
 
 		# Document-ongoing commentblock detection
@@ -85,10 +110,10 @@ def prepare_document(src) -> str:
 
 			if m:
 				state = State.START
-				ret += '```\n'
-				ret += m.group(1) + '\n'
+				out.write('```\n')
+				out.write(m.group(1) + '\n')
 			else:
-				ret += line
+				out.write(line)
 
 
 
@@ -101,15 +126,15 @@ def prepare_document(src) -> str:
 				if m:
 					#DEBUG print("start matched")
 					print("Error at line " + str(linecount) + ": Repeated comment start sequence.")
-					return ""
+					return False
 
 				# Commen end matching. Takes precedence over prefix match.
 				m = md_comment_end.match(line)
 				if m:
 					#DEBUG print("end matched")
-					ret += m.group(1) + '\n'
-					ret += '```' + '\n'
-					ret += (m.group(2) + '\n') if m.group(2) != '' else ''
+					out.write(m.group(1) + '\n')
+					out.write('```' + '\n')
+					out.write((m.group(2) + '\n') if m.group(2) != '' else '')
 
 					# Reset leading_empty flag.
 					leading_empty = True
@@ -121,57 +146,118 @@ def prepare_document(src) -> str:
 				m  = md_comment_prefix.match(line)
 				if m:
 					#DEBUG print("prefix matched")
-					ret += m.group(1) + '\n'
+					out.write(m.group(1) + '\n')
 					break
 
 				# Normal '*' prefixed line with no spacing.
 				m = md_comment_prefix_nospace.match(line)
 				if m:
 					#DEBUG print("prefix nospace matched")
-					ret += m.group(1) + '\n'
+					out.write(m.group(1) + '\n')
 					break
 
 				# If no match, we assume there are no special cases. Just copy
 				# -paste in the line.
 				#DEBUG print("default matched")
-				ret += line
+				out.write(line)
 				break
 
 	if state == State.NOBLOCK:
-		ret += '\n```\n'
-
-	return ret
+		out.write('\n```\n')
+
+	return linecount > 0
+
+def file_hash(path: str) -> str:
+	h = hashlib.sha256()
+	with open(path, 'rb') as f:
+		for block in iter(lambda: f.read(1 << 16), b''):
+			h.update(block)
+	return h.hexdigest()
+
+def load_manifest(path: str) -> Dict[str, str]:
+	try:
+		with open(path) as f:
+			return json.load(f)
+	except (IOError, ValueError):
+		return {}
+
+def save_manifest(path: str, manifest: Dict[str, str]):
+	with open(path + '.tmp', 'w') as f:
+		json.dump(manifest, f, indent='\t', sort_keys=True)
+		f.write('\n')
+	os.replace(path + '.tmp', path)
+
+# Converts one file. The document is written next to where it goes, and only
+# moved there once it's complete, so that an error never leaves half of one
+# behind. Runs in a worker process, so it returns what it has to say instead of
+# printing it. The message is None if it worked.
+def convert(srcpath: str, destpath: str) -> Tuple[str, Optional[str]]:
+	temppath: str = destpath + '.tmp'
+
+	try:
+		with open(srcpath) as src, open(temppath, 'w') as dest:
+			ok: bool = prepare_document(src, dest)
+	except FileNotFoundError:
+		return (srcpath, "Error: '" + srcpath + "' not found.")
+	except IOError:
+		return (srcpath, "Error: Could not open '" + destpath + "'.")
+
+	if not ok:
+		os.remove(temppath)
+		return (srcpath, "Error: Could not convert '" + srcpath + "'.")
+
+	os.replace(temppath, destpath)
+	return (srcpath, None)
 
 def main():
-	# Iterate over files and generate each
+	parser = argparse.ArgumentParser()
+	parser.add_argument('--force', action='store_true', help="convert every file")
+	parser.add_argument('--jobs', type=int, default=None, help="number of processes")
+	args = parser.parse_args()
+
+	os.makedirs(DEST_DIR, exist_ok=True)
+	manifest_path: str = DEST_DIR + '/' + MANIFEST
+	manifest: Dict[str, str] = {} if args.force else load_manifest(manifest_path)
+	script: str = file_hash(os.path.abspath(__file__))
+	hashes: Dict[str, str] = {}
+	jobs: List[Tuple[str, str]] = []
+
+	# Find the files that changed
 	for name in DOC_NAMES:
 		srcpath: str = SRC_DIR + '/' + name['src']
 		destpath: str = DEST_DIR + "/" + name['dest']
-		file = None
+
 		try:
-			file = open(srcpath)
+			hashes[srcpath] = script + ':' + file_hash(srcpath)
 		except FileNotFoundError:
 			print("Error: '" + srcpath + "' not found.")
 			return 1
 
-		print("Converting '" + srcpath + "' -> '" + destpath + "'")
-		text: str = prepare_document(file)
-		if text == '':
-			print("Exiting due to error.")
-			return 2
-
-		try:
-			dest = open(destpath, 'w')
-		except IOError:
-			print("Error: Could not open '" + destpath + "'.")
-			return 1
-		dest.write(text)
+		if manifest.get(srcpath) == hashes[srcpath] and os.path.exists(destpath):
+			print("Unchanged '" + srcpath + "'")
+			continue
 
-		dest.close()
-		file.close()
+		print("Converting '" + srcpath + "' -> '" + destpath + "'")
+		jobs.append((srcpath, destpath))
+
+	failed: bool = False
+	if jobs:
+		with ProcessPoolExecutor(max_workers=args.jobs) as pool:
+			for srcpath, message in pool.map(convert, *zip(*jobs)):
+				if message:
+					print(message)
+					failed = True
+					manifest.pop(srcpath, None)
+				else:
+					manifest[srcpath] = hashes[srcpath]
+
+	save_manifest(manifest_path, manifest)
+	if failed:
+		print("Exiting due to error.")
+		return 2
 
 	print("Done.")
 	return 0
 
 if __name__ == '__main__':
-	sys.exit(main())
\ No newline at end of file
+	sys.exit(main())
@@ -8,8 +8,17 @@
  *
  */
 
+#ifndef BLINDFORTH_GRAPHVIZ_HPP
+#define BLINDFORTH_GRAPHVIZ_HPP
+
 #include <stdio.h>
 
+/**
+ * Writes a directed graph to `f`. Nodes are numbered, so that they can be
+ * enum values, and are given a name with `node`, `accept` or `trap` before
+ * any edge goes to them. Names and labels are written as they are, so they
+ * must not hold a '"'.
+ */
 struct Graphviz {
 	FILE *f;
 
@@ -17,23 +26,41 @@ struct Graphviz {
 		f = fp;
 	}
 
-	static inline void start() {
-
+	inline void start(const char *name) {
+		fprintf(f, "digraph %s {\n", name);
+		fprintf(f, "\trankdir=LR;\n");
+		fprintf(f, "\tnode [shape=circle];\n");
 	}
 
-	static inline void end() {
-
+	inline void end() {
+		fprintf(f, "}\n");
 	}
 
-	static inline void accept() {
-
+	inline void node(int id, const char *name) {
+		fprintf(f, "\tn%d [label=\"%s\"];\n", id, name);
 	}
 
-	static inline void trap() {
-
+	// A state the input may end in.
+	inline void accept(int id, const char *name) {
+		fprintf(f, "\tn%d [label=\"%s\", shape=doublecircle];\n", id, name);
 	}
 
-	static inline void edge(char start, char end, char label) {
+	// A state nothing leaves again.
+	inline void trap(int id, const char *name) {
+		fprintf(f, "\tn%d [label=\"%s\", shape=box, style=dashed];\n", id, name);
+	}
 
+	// An edge with a width of 1 to 8, for how heavily it is used, or 0 to draw
+	// it faintly.
+	inline void edge(int start, int end, const char *label, int width) {
+		if (width <= 0) {
+			fprintf(f, "\tn%d -> n%d [label=\"%s\", style=dashed, color=gray];\n",
+			        start, end, label);
+		} else {
+			fprintf(f, "\tn%d -> n%d [label=\"%s\", penwidth=%d];\n",
+			        start, end, label, width);
+		}
 	}
-};
\ No newline at end of file
+};
+
+#endif
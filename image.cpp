@@ -0,0 +1,440 @@
+/**
+ *
+ * image.cpp - Caching tokenized programs in files
+ *
+ * Copyright (c) 2022 Anamitra Ghorui
+ *
+ * LICENSE_HERE
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+#include "image.hpp"
+#include "util.hpp"
+
+/**md
+ *
+ * Images
+ * ======
+ *
+ * An image is laid out as a header (`ImageHeader`), followed by its sections,
+ * each starting at a multiple of 8 bytes so that it can be used in place as an
+ * array once the file is mapped:
+ *
+ *     header | types | data | offsets | text | symbols | slots | symbol text
+ *
+ * The arrays are written just as they are in memory. This means an image can
+ * only be read by a machine with the same byte order and the same layout of
+ * `TokenData`, which is why both are checked (the layout only through the
+ * version, so it must go up whenever any of these structs changes).
+ *
+ * Strings are the one thing in a `TokenResult` that point outside of it, into
+ * the input (see `TokenView`). The image keeps a copy of the text of every
+ * string, and the views are rewritten to point into that instead, so an image
+ * doesn't need the source to be used.
+ *
+ */
+
+#define IMAGE_MAGIC "BFIMAGE"
+#define IMAGE_BYTE_ORDER 0x01020304u
+
+static_assert(sizeof(unsigned int) == sizeof(uint32_t),
+              "token offsets are written as 32 bit numbers");
+
+/**md
+ *
+ * ### Hashing
+ *
+ * The hash of the source is what tells us whether an image belongs to it, so
+ * every byte of the source goes into it. Since this is done on every run, the
+ * source is read 8 bytes at a time, into four separate hashes, so that the
+ * multiplications of one don't wait on those of the others. They are mixed
+ * together at the end.
+ *
+ * This is not meant to hold up against someone who is trying to make two
+ * sources with the same hash. The size of the source is checked as well, which
+ * makes an accidental match even less likely.
+ *
+ */
+
+#define IMAGE_HASH_PRIME1 0x9e3779b185ebca87ull
+#define IMAGE_HASH_PRIME2 0xc2b2ae3d27d4eb4full
+
+static inline uint64_t image_rotate(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t image_hash_word(uint64_t hash, uint64_t word)
+{
+	hash += word * IMAGE_HASH_PRIME2;
+	hash = image_rotate(hash, 31);
+	return hash * IMAGE_HASH_PRIME1;
+}
+
+static inline uint64_t image_hash_finish(uint64_t hash)
+{
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdull;
+	hash ^= hash >> 33;
+	hash *= 0xc4ceb9fe1a85ec53ull;
+	hash ^= hash >> 33;
+	return hash;
+}
+
+uint64_t image_hash(const char *s, size_t n)
+{
+	uint64_t lanes[4] = {
+		IMAGE_HASH_PRIME1 + IMAGE_HASH_PRIME2,
+		IMAGE_HASH_PRIME2,
+		0,
+		(uint64_t) 0 - IMAGE_HASH_PRIME1,
+	};
+	size_t i = 0;
+	uint64_t word;
+
+	for (; i + 32 <= n; i += 32) {
+		for (int j = 0; j < 4; j++) {
+			memcpy(&word, s + i + j * 8, 8);
+			lanes[j] = image_hash_word(lanes[j], word);
+		}
+	}
+
+	uint64_t hash = image_rotate(lanes[0], 1) + image_rotate(lanes[1], 7) +
+	                image_rotate(lanes[2], 12) + image_rotate(lanes[3], 18);
+
+	for (; i + 8 <= n; i += 8) {
+		memcpy(&word, s + i, 8);
+		hash = image_hash_word(hash, word);
+	}
+
+	// The last few bytes, padded with zeros. The size is mixed in below, so
+	// padding can't make two sources look the same.
+	if (i < n) {
+		word = 0;
+		memcpy(&word, s + i, n - i);
+		hash = image_hash_word(hash, word);
+	}
+
+	return image_hash_finish(hash ^ (uint64_t) n);
+}
+
+std::string image_path(const char *dir, uint64_t hash)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.bfi", (unsigned long long) hash);
+
+	std::string path = dir;
+	if (!path.empty() && path.back() != '/') {
+		path += '/';
+	}
+	return path + name;
+}
+
+/**md
+ *
+ * ### Writing
+ *
+ * The image is written to a temporary file next to where it should go, which
+ * is then renamed over it. Renaming replaces the file in one step, so anyone
+ * opening the image gets either all of the old one or all of the new one, and
+ * one that was cut short (because we ran out of space, say) is never seen at
+ * all.
+ *
+ */
+
+static inline uint64_t image_align(uint64_t offset)
+{
+	return (offset + 7) & ~(uint64_t) 7;
+}
+
+int image_write(const char *path, const TokenResult &result, uint64_t hash, size_t size)
+{
+	const TokenStream &stream = result.stream;
+	size_t count = token_stream_size(stream);
+
+	if (!result.symbols || !result.tokens.empty()) {
+		return -1;
+	}
+
+	// Copy out the text of the strings, and point the views at the copy.
+	std::vector<TokenData> data(stream.data);
+	std::vector<char> text;
+	for (size_t i = 0; i < count; i++) {
+		if (stream.types[i] == TOKEN_TYPE_STRING) {
+			TokenView &v = data[i].v;
+			const char *s = result.source + v.offset;
+			v.offset = text.size();
+			text.insert(text.end(), s, s + v.length);
+		}
+	}
+
+	const SymbolTable &symbols = *result.symbols;
+	const void *contents[IMAGE_SECTION_SIZE];
+	ImageHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, IMAGE_MAGIC, sizeof(header.magic));
+	header.version = IMAGE_VERSION;
+	header.byte_order = IMAGE_BYTE_ORDER;
+	header.source_hash = hash;
+	header.source_size = size;
+	header.mode = IMAGE_MODE;
+	header.dialect = BLINDFORTH_DIALECT;
+	header.characters_processed = result.characters_processed;
+	header.lines_processed = result.lines_processed;
+
+	header.sections[IMAGE_SECTION_TYPES].size = count;
+	header.sections[IMAGE_SECTION_DATA].size = count * sizeof(TokenData);
+	header.sections[IMAGE_SECTION_OFFSETS].size = stream.offsets.size() * sizeof(uint32_t);
+	header.sections[IMAGE_SECTION_TEXT].size = text.size();
+	header.sections[IMAGE_SECTION_SYMBOLS].size = symbols.symbols.size() * sizeof(Symbol);
+	header.sections[IMAGE_SECTION_SLOTS].size = symbols.slots.size() * sizeof(SymbolSlot);
+	header.sections[IMAGE_SECTION_SYMBOL_TEXT].size = symbols.text.size();
+
+	contents[IMAGE_SECTION_TYPES] = stream.types.data();
+	contents[IMAGE_SECTION_DATA] = data.data();
+	contents[IMAGE_SECTION_OFFSETS] = stream.offsets.data();
+	contents[IMAGE_SECTION_TEXT] = text.data();
+	contents[IMAGE_SECTION_SYMBOLS] = symbols.symbols.data();
+	contents[IMAGE_SECTION_SLOTS] = symbols.slots.data();
+	contents[IMAGE_SECTION_SYMBOL_TEXT] = symbols.text.data();
+
+	uint64_t offset = sizeof(header);
+	for (int i = 0; i < IMAGE_SECTION_SIZE; i++) {
+		header.sections[i].offset = image_align(offset);
+		offset = header.sections[i].offset + header.sections[i].size;
+	}
+
+	// The checksum is taken over the file as it will be written, padding and
+	// all, so the sections are put together in memory first.
+	std::vector<char> body(offset - sizeof(header), 0);
+	for (int i = 0; i < IMAGE_SECTION_SIZE; i++) {
+		if (header.sections[i].size > 0) {
+			memcpy(body.data() + (header.sections[i].offset - sizeof(header)),
+			       contents[i], header.sections[i].size);
+		}
+	}
+	header.checksum = image_hash(body.data(), body.size());
+
+	std::string temp = path;
+#if defined(__unix__) || defined(__APPLE__)
+	temp += "." + std::to_string((long) getpid());
+#endif
+	temp += ".tmp";
+
+	FILE *f = fopen(temp.c_str(), "wb");
+	if (!f) {
+		return -1;
+	}
+
+	int ret = 0;
+	if (fwrite(&header, 1, sizeof(header), f) != sizeof(header) ||
+	    fwrite(body.data(), 1, body.size(), f) != body.size()) {
+		ret = -1;
+	}
+
+	if (fclose(f) != 0) {
+		ret = -1;
+	}
+	if (ret == 0 && rename(temp.c_str(), path) != 0) {
+		ret = -1;
+	}
+	if (ret < 0) {
+		remove(temp.c_str());
+	}
+	return ret;
+}
+
+/**md
+ *
+ * ### Reading
+ *
+ * An image is a file like any other, so it can be cut short, or be an image
+ * of something else entirely, or simply be garbage. Before anything in it is
+ * used, the header is checked against what we expect, every section must lie
+ * within the file, and every view and symbol id must point within its
+ * section. Any of this going wrong simply means that the source is tokenized
+ * again, as if there were no image at all.
+ *
+ * The checksum catches an image that was damaged in a way that still looks
+ * valid, such as a changed number. It costs about as much as hashing the
+ * source did, which is still far less than tokenizing it.
+ *
+ */
+
+static bool image_check_sections(const ImageHeader &header, size_t size)
+{
+	for (int i = 0; i < IMAGE_SECTION_SIZE; i++) {
+		const ImageSection &section = header.sections[i];
+		if (section.offset % 8 != 0 || section.offset < sizeof(header) ||
+		    section.offset > size || section.size > size - section.offset) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool image_check_symbols(const Image &image, const ImageHeader &header)
+{
+	const char *base = (const char *) image.file.data;
+	const Symbol *symbols = (const Symbol *) (base + header.sections[IMAGE_SECTION_SYMBOLS].offset);
+	const SymbolSlot *slots = (const SymbolSlot *) (base + header.sections[IMAGE_SECTION_SLOTS].offset);
+	uint64_t symbol_count = header.sections[IMAGE_SECTION_SYMBOLS].size / sizeof(Symbol);
+	uint64_t slot_count = header.sections[IMAGE_SECTION_SLOTS].size / sizeof(SymbolSlot);
+	uint64_t text = header.sections[IMAGE_SECTION_SYMBOL_TEXT].size;
+
+	if (header.sections[IMAGE_SECTION_SYMBOLS].size % sizeof(Symbol) != 0 ||
+	    header.sections[IMAGE_SECTION_SLOTS].size % sizeof(SymbolSlot) != 0) {
+		return false;
+	}
+
+	// The table must have room to spare, or looking a name up would never end.
+	if ((slot_count & (slot_count - 1)) != 0 || symbol_count * 2 > slot_count ||
+	    (slot_count == 0 && symbol_count != 0)) {
+		return false;
+	}
+
+	for (uint64_t i = 0; i < symbol_count; i++) {
+		if (symbols[i].offset > text || symbols[i].length >= text - symbols[i].offset) {
+			return false;
+		}
+	}
+	for (uint64_t i = 0; i < slot_count; i++) {
+		if (slots[i].id > symbol_count) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool image_check_tokens(const Image &image, const ImageHeader &header)
+{
+	uint64_t symbol_count = header.sections[IMAGE_SECTION_SYMBOLS].size / sizeof(Symbol);
+	uint64_t text = header.sections[IMAGE_SECTION_TEXT].size;
+
+	for (size_t i = 0; i < image.count; i++) {
+		switch (image.types[i]) {
+		case TOKEN_TYPE_STRING:
+			if (image.data[i].v.offset > text ||
+			    image.data[i].v.length > text - image.data[i].v.offset) {
+				return false;
+			}
+			break;
+		case TOKEN_TYPE_ID:
+		case TOKEN_TYPE_DEBUG_COMMAND:
+			if (image.data[i].sym >= symbol_count) {
+				return false;
+			}
+			break;
+		case TOKEN_TYPE_INT:
+		case TOKEN_TYPE_REAL:
+			break;
+		default:
+			return false;
+		}
+	}
+	return true;
+}
+
+int image_open(Image &image, const char *path, uint64_t hash, size_t size)
+{
+	if (source_open(image.file, path) < 0) {
+		return -1;
+	}
+
+	const char *base = (const char *) image.file.data;
+	ImageHeader header;
+	bool valid = image.file.size >= sizeof(header);
+
+	if (valid) {
+		memcpy(&header, base, sizeof(header));
+		valid = memcmp(header.magic, IMAGE_MAGIC, sizeof(header.magic)) == 0 &&
+		        header.version == IMAGE_VERSION &&
+		        header.byte_order == IMAGE_BYTE_ORDER &&
+		        header.source_hash == hash &&
+		        header.source_size == size &&
+		        header.mode == IMAGE_MODE &&
+		        header.dialect == BLINDFORTH_DIALECT &&
+		        header.checksum == image_hash(base + sizeof(header), image.file.size - sizeof(header)) &&
+		        image_check_sections(header, image.file.size);
+	}
+
+	if (valid) {
+		image.count = header.sections[IMAGE_SECTION_TYPES].size;
+		valid = header.sections[IMAGE_SECTION_DATA].size == image.count * sizeof(TokenData) &&
+		        (header.sections[IMAGE_SECTION_OFFSETS].size == 0 ||
+		         header.sections[IMAGE_SECTION_OFFSETS].size == image.count * sizeof(uint32_t));
+	}
+
+	if (valid) {
+		image.header = (const ImageHeader *) base;
+		image.types = (const uint8_t *) (base + header.sections[IMAGE_SECTION_TYPES].offset);
+		image.data = (const TokenData *) (base + header.sections[IMAGE_SECTION_DATA].offset);
+		image.offsets = (const uint32_t *) (base + header.sections[IMAGE_SECTION_OFFSETS].offset);
+		image.text = base + header.sections[IMAGE_SECTION_TEXT].offset;
+		valid = image_check_symbols(image, header) && image_check_tokens(image, header);
+	}
+
+	if (!valid) {
+		image_close(image);
+		return -1;
+	}
+	return 0;
+}
+
+void image_close(Image &image)
+{
+	source_close(image.file);
+	image = Image();
+}
+
+/**md
+ *
+ * ### Using an image
+ *
+ * Nothing is copied out of an image to use it: the token stream and the
+ * symbol table are made to refer to its sections where they are mapped (see
+ * `token_stream_share` and `symbol_share`). The pages of a mapped file are
+ * the same pages for every process that maps it, so any number of processes
+ * running the same source at once only keep one copy of its tokens in memory
+ * between them, and none of them has to build one first.
+ *
+ */
+
+static_assert(sizeof(unsigned int) == sizeof(uint32_t), "offsets are stored as uint32_t");
+
+template <typename T>
+static const T *image_section(const Image &image, ImageSectionKind kind, size_t &count)
+{
+	const ImageSection &section = image.header->sections[kind];
+	count = section.size / sizeof(T);
+	return (const T *) ((const char *) image.file.data + section.offset);
+}
+
+void image_result(const Image &image, TokenResult &result, SymbolTable &symbols)
+{
+	size_t slot_count, symbol_count, text_size;
+	const SymbolSlot *slots = image_section<SymbolSlot>(image, IMAGE_SECTION_SLOTS, slot_count);
+	const Symbol *entries = image_section<Symbol>(image, IMAGE_SECTION_SYMBOLS, symbol_count);
+	const char *text = image_section<char>(image, IMAGE_SECTION_SYMBOL_TEXT, text_size);
+
+	token_result_reset(result);
+	token_stream_share(result.stream, image.count, image.types, image.data,
+	                   image.header->sections[IMAGE_SECTION_OFFSETS].size ?
+	                   (const unsigned int *) image.offsets : NULL);
+	symbol_share(symbols, slots, slot_count, entries, symbol_count, text, text_size);
+
+	result.characters_processed = image.header->characters_processed;
+	result.lines_processed = image.header->lines_processed;
+	result.source = image.text;
+	result.symbols = &symbols;
+}
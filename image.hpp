@@ -0,0 +1,124 @@
+/**
+ *
+ * image.hpp - Caching tokenized programs in files
+ *
+ * Copyright (c) 2022 Anamitra Ghorui
+ *
+ * LICENSE_HERE
+ *
+ */
+
+#ifndef BLINDFORTH_IMAGE_HPP
+#define BLINDFORTH_IMAGE_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#include "source.hpp"
+#include "symbol.hpp"
+#include "tokenizer.hpp"
+
+/**md
+ *
+ * ### Images
+ *
+ * An image is a file holding everything the tokenizer made out of a source
+ * file, so that the next time the same source is run, it doesn't have to be
+ * tokenized again: the token stream, with strings as offsets into a section
+ * of text, and the symbol table of the identifiers.
+ *
+ * Nothing in an image is a pointer, so it can be used right where it's
+ * mapped, without going through it to fix anything up. An `Image` simply
+ * points at each of its sections. The file is loaded with `source_open`, so it
+ * is mapped into memory wherever a source file would be, and every process
+ * that runs the same source shares the one image, read only.
+ *
+ * An image only holds for the exact source it was made from, so it's looked
+ * up by a hash of the source (`image_hash`). The header records the hash and
+ * the size of the source, the version of the format, the tokenizer mode and
+ * dialect and a checksum of the rest of the file, and an image that doesn't
+ * match all of them is not used.
+ *
+ */
+
+#define IMAGE_VERSION 2
+
+// The mode images are tokenized in. Tokens must be in a stream, as views, and
+// interned.
+#define IMAGE_MODE (TOKENIZE_DFA | TOKENIZE_SKIP | TOKENIZE_VIEWS | TOKENIZE_STREAM | TOKENIZE_INTERN)
+
+typedef enum ImageSectionKind {
+	IMAGE_SECTION_TYPES = 0,    // uint8_t for each token
+	IMAGE_SECTION_DATA,         // TokenData for each token
+	IMAGE_SECTION_OFFSETS,      // uint32_t for each token
+	IMAGE_SECTION_TEXT,         // The text of the strings
+	IMAGE_SECTION_SYMBOLS,      // Symbol for each symbol id
+	IMAGE_SECTION_SLOTS,        // The SymbolSlots of the symbol table
+	IMAGE_SECTION_SYMBOL_TEXT,  // The names of the symbols
+	IMAGE_SECTION_SIZE          // This simply marks the number of sections
+} ImageSectionKind;
+
+typedef struct ImageSection {
+	uint64_t offset; // From the start of the file, a multiple of 8
+	uint64_t size;   // In bytes
+} ImageSection;
+
+typedef struct ImageHeader {
+	char magic[8];              // IMAGE_MAGIC
+	uint32_t version;           // IMAGE_VERSION
+	uint32_t byte_order;        // IMAGE_BYTE_ORDER, as written by this machine
+	uint64_t source_hash;
+	uint64_t source_size;
+	uint32_t mode;              // IMAGE_MODE
+	uint32_t characters_processed;
+	uint32_t lines_processed;
+	uint32_t dialect;           // BLINDFORTH_DIALECT
+	uint64_t checksum;          // `image_hash` of everything after the header
+	ImageSection sections[IMAGE_SECTION_SIZE];
+} ImageHeader;
+
+typedef struct Image {
+	SourceFile file;            // The whole file, mapped if possible
+
+	const ImageHeader *header;
+	size_t count;               // Number of tokens
+	const uint8_t *types;
+	const TokenData *data;
+	const uint32_t *offsets;
+	const char *text;
+
+	Image() {
+		header = NULL;
+		count = 0;
+		types = NULL;
+		data = NULL;
+		offsets = NULL;
+		text = NULL;
+	}
+} Image;
+
+// A hash of the source, to look its image up with.
+uint64_t image_hash(const char *s, size_t n);
+
+// Where the image of a source with `hash` is kept in the directory `dir`.
+std::string image_path(const char *dir, uint64_t hash);
+
+// Writes the image of `result`, which must have been tokenized from all of a
+// source of `size` bytes in IMAGE_MODE, to `path`. The file is replaced as a
+// whole, so a process reading the old image at the same time never sees half
+// of the new one. Returns a value less than 0 on an error.
+int image_write(const char *path, const TokenResult &result, uint64_t hash, size_t size);
+
+// Opens the image at `path`, if it is one for a source with `hash` and `size`.
+// Returns a value less than 0 if it isn't, or can't be read.
+int image_open(Image &image, const char *path, uint64_t hash, size_t size);
+void image_close(Image &image);
+
+// Fills in `result` and `symbols` from the image, so that it looks just like
+// it would after tokenizing the source. Both only refer to the arrays in the
+// image, which must stay open for as long as they are used. The stream can
+// only be read, and the table is copied out if a name is added to it.
+void image_result(const Image &image, TokenResult &result, SymbolTable &symbols);
+
+#endif
@@ -0,0 +1,1895 @@
+/**
+ *
+ * interpreter.cpp - Compiling tokens into threaded code, and running it
+ *
+ * Copyright (c) 2022 Anamitra Ghorui
+ *
+ * LICENSE_HERE
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <new>
+#include <algorithm>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define INTERPRETER_GUARD_PAGES
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "interpreter.hpp"
+#include "jit.hpp"
+
+/**md
+ *
+ * The Interpreter
+ * ===============
+ *
+ * The obvious way to run a Forth program would be to go through the tokens one
+ * after another, look each identifier up in the dictionary, and do what it
+ * says. That means looking up every word by its name again each time it is
+ * run, and a loop that runs a million times does that a million times over.
+ *
+ * Instead, we first compile the tokens into a flat array of instructions,
+ * where each word has already been replaced by what it does: an instruction of
+ * its own for the built in words, or a call to the code of a word that the
+ * program defined. Numbers and strings become an instruction that pushes them
+ * onto the stack, and control structures such as `if` and `do` become jumps.
+ * After that, running the program never has to look at the tokens again.
+ *
+ * The Language
+ * ------------
+ *
+ * The words are mostly those of a standard Forth, with a few differences that
+ * come from the tokenizer:
+ *
+ * * A sign can only be the whole of a token, or the start of a number, so
+ *   words like `f+` or `1+` can't be written. The words that work on reals are
+ *   called `fadd`, `fsub`, `fmul` and `fdiv` instead.
+ * * A lone `.` isn't a valid token either, so `.` is called `print`, and `f.`
+ *   is called `fprint`.
+ * * `:` on its own is a debug command with no name, which is what starts a
+ *   definition, as in `: square dup * ;`. The other debug commands are
+ *   `:stack_trace`, which prints the stack, and `:break`, which also prints
+ *   where it is.
+ *
+ * There is no `unloop`: `exit` takes care of the counters of any loops it
+ * leaves by itself.
+ *
+ * The stack holds 64 bit cells. Reals are kept on the same stack, as the bits
+ * of a `double`, so it's up to the program to use the right words on them.
+ * Truth values are -1 for true and 0 for false, and a string literal pushes
+ * the address of its text, which `type` prints.
+ *
+ */
+
+#define INTERPRETER_OP_POPS(name, operands, pops, pushes) pops,
+#define INTERPRETER_OP_PUSHES(name, operands, pops, pushes) pushes,
+
+static const uint8_t op_pops[OP_SIZE] = {
+	INTERPRETER_OPS(INTERPRETER_OP_POPS)
+};
+
+static const uint8_t op_pushes[OP_SIZE] = {
+	INTERPRETER_OPS(INTERPRETER_OP_PUSHES)
+};
+
+typedef struct Builtin {
+	const char *name;
+	Op op;
+} Builtin;
+
+static const Builtin builtins[] = {
+	{ "+", OP_ADD },          { "-", OP_SUB },         { "*", OP_MUL },
+	{ "/", OP_DIV },          { "mod", OP_MOD },       { "negate", OP_NEGATE },
+	{ "abs", OP_ABS },        { "min", OP_MIN },       { "max", OP_MAX },
+	{ "=", OP_EQ },           { "<>", OP_NE },         { "<", OP_LT },
+	{ ">", OP_GT },           { "<=", OP_LE },         { ">=", OP_GE },
+	{ "and", OP_AND },        { "or", OP_OR },         { "xor", OP_XOR },
+	{ "invert", OP_INVERT },  { "dup", OP_DUP },       { "drop", OP_DROP },
+	{ "swap", OP_SWAP },      { "over", OP_OVER },     { "rot", OP_ROT },
+	{ "nip", OP_NIP },        { "tuck", OP_TUCK },     { "fadd", OP_FADD },
+	{ "fsub", OP_FSUB },      { "fmul", OP_FMUL },     { "fdiv", OP_FDIV },
+	{ "to_real", OP_TO_REAL },{ "to_int", OP_TO_INT }, { "print", OP_PRINT },
+	{ "fprint", OP_FPRINT },  { "emit", OP_EMIT },     { "cr", OP_CR },
+	{ "type", OP_TYPE },
+};
+
+#define BUILTIN_COUNT (sizeof(builtins) / sizeof(builtins[0]))
+
+// Words that the compiler handles itself, rather than compiling into a single
+// instruction.
+typedef enum Keyword {
+	KEYWORD_NONE = 0,
+	KEYWORD_IF,
+	KEYWORD_ELSE,
+	KEYWORD_THEN,
+	KEYWORD_BEGIN,
+	KEYWORD_UNTIL,
+	KEYWORD_AGAIN,
+	KEYWORD_WHILE,
+	KEYWORD_REPEAT,
+	KEYWORD_DO,
+	KEYWORD_LOOP,
+	KEYWORD_I,
+	KEYWORD_J,
+	KEYWORD_END_DEFINITION,
+	KEYWORD_RECURSE,
+	KEYWORD_EXIT
+} Keyword;
+
+typedef struct KeywordName {
+	const char *name;
+	Keyword keyword;
+} KeywordName;
+
+static const KeywordName keywords[] = {
+	{ "if", KEYWORD_IF },       { "else", KEYWORD_ELSE },     { "then", KEYWORD_THEN },
+	{ "begin", KEYWORD_BEGIN }, { "until", KEYWORD_UNTIL },   { "again", KEYWORD_AGAIN },
+	{ "while", KEYWORD_WHILE }, { "repeat", KEYWORD_REPEAT }, { "do", KEYWORD_DO },
+	{ "loop", KEYWORD_LOOP },   { "i", KEYWORD_I },           { "j", KEYWORD_J },
+	{ ";", KEYWORD_END_DEFINITION }, { "recurse", KEYWORD_RECURSE },
+	{ "exit", KEYWORD_EXIT },
+};
+
+#define KEYWORD_COUNT (sizeof(keywords) / sizeof(keywords[0]))
+
+static inline double cell_real(Cell cell)
+{
+	double r;
+	memcpy(&r, &cell, sizeof(r));
+	return r;
+}
+
+static inline Cell real_cell(double r)
+{
+	Cell cell;
+	memcpy(&cell, &r, sizeof(cell));
+	return cell;
+}
+
+// Arithmetic is done on unsigned numbers, so that overflowing wraps around
+// instead of being undefined.
+static inline Cell wrap_add(Cell a, Cell b)
+{
+	return (Cell) ((uint64_t) a + (uint64_t) b);
+}
+
+static inline Cell wrap_sub(Cell a, Cell b)
+{
+	return (Cell) ((uint64_t) a - (uint64_t) b);
+}
+
+static inline Cell wrap_mul(Cell a, Cell b)
+{
+	return (Cell) ((uint64_t) a * (uint64_t) b);
+}
+
+// Whether a real can be turned into an integer. This is written so that it
+// also fails for NaN.
+static inline bool real_fits_int(double r)
+{
+	return r >= -9223372036854775808.0 && r < 9223372036854775808.0;
+}
+
+static Keyword find_keyword(const char *s, size_t n)
+{
+	for (size_t i = 0; i < KEYWORD_COUNT; i++) {
+		if (strlen(keywords[i].name) == n && memcmp(keywords[i].name, s, n) == 0) {
+			return keywords[i].keyword;
+		}
+	}
+	return KEYWORD_NONE;
+}
+
+// The built in words are looked up through a symbol table of their own, which
+// is filled in the first time it's needed.
+static int find_builtin(const char *s, size_t n)
+{
+	static SymbolTable table;
+
+	if (symbol_count(table) == 0) {
+		for (size_t i = 0; i < BUILTIN_COUNT; i++) {
+			const char *name = builtins[i].name;
+			symbol_intern(table, name, strlen(name), symbol_hash(name, strlen(name)));
+		}
+	}
+
+	uint32_t id = symbol_find(table, s, n);
+	return (id == SYMBOL_NONE) ? -1 : builtins[id].op;
+}
+
+/**md
+ *
+ * Compiling
+ * ---------
+ *
+ * The compiler goes through the tokens once, appending instructions to the
+ * end of the code. Whatever isn't inside a definition is the main code, which
+ * is run by `interpreter_run`. A definition is compiled right where it is, with
+ * a jump around it, so that the main code doesn't run into it.
+ *
+ * Control structures need to jump to places that haven't been compiled yet.
+ * `if` compiles a `JZ` (jump if zero) whose target is left empty, and pushes
+ * its position onto a stack of open control structures. `then` fills in the
+ * target once it knows where that is. The loops work the same way, except that
+ * `begin` and `do` only remember where the loop starts, so that `until` and
+ * `loop` can jump back there.
+ *
+ * If anything goes wrong, everything compiled so far is undone again. This
+ * includes any words that were defined, which is why the old definition of
+ * each word is remembered before it's replaced.
+ *
+ */
+
+typedef enum ControlKind {
+	CONTROL_IF,
+	CONTROL_ELSE,
+	CONTROL_BEGIN,
+	CONTROL_WHILE,
+	CONTROL_DO,
+	CONTROL_DEFINITION
+} ControlKind;
+
+typedef struct Control {
+	ControlKind kind;
+	size_t address; // The slot to fill in later, or the slot to jump back to
+	size_t extra;   // The `begin` of a `while`, or the id of a definition
+} Control;
+
+// What a word turned out to be, see `resolve`.
+typedef enum WordKind {
+	WORD_UNRESOLVED = 0,
+	WORD_DEFINED,   // `value` is its id in `program.words`
+	WORD_KEYWORD,   // `value` is a Keyword
+	WORD_BUILTIN,   // `value` is an Op
+	WORD_UNKNOWN
+} WordKind;
+
+typedef struct ResolvedWord {
+	WordKind kind;
+	uint32_t value;
+} ResolvedWord;
+
+typedef struct Compiler {
+	Program &program;
+	const TokenResult &tokens;
+	InterpreterError &error;
+	unsigned int offset;            // Offset of the current token
+	std::vector<Control> control;
+	std::vector<std::pair<uint32_t, int64_t>> replaced; // Old definitions
+	std::vector<ResolvedWord> resolved; // By symbol id, if the tokens are interned
+	bool defining;                  // Whether the next token names a word
+	size_t literals;                // Number of numbers just pushed, see `fold`
+
+	Compiler(Program &program, const TokenResult &tokens, InterpreterError &error)
+		: program(program), tokens(tokens), error(error)
+	{
+		offset = 0;
+		defining = false;
+		literals = 0;
+	}
+} Compiler;
+
+static inline size_t emit(Compiler &c, Slot slot)
+{
+	c.program.code.push_back(slot);
+	c.program.offsets.push_back(c.offset);
+	return c.program.code.size() - 1;
+}
+
+static inline size_t emit_op(Compiler &c, Op op)
+{
+	Slot slot;
+	slot.op = op;
+	return emit(c, slot);
+}
+
+static inline size_t emit_int(Compiler &c, Cell value)
+{
+	Slot slot;
+	slot.i = value;
+	return emit(c, slot);
+}
+
+static inline size_t here(const Compiler &c)
+{
+	return c.program.code.size();
+}
+
+static inline void patch(Compiler &c, size_t slot, size_t target)
+{
+	c.program.code[slot].i = target;
+}
+
+static int fail(Compiler &c, const char *message)
+{
+	c.error.message = message;
+	c.error.offset = c.offset;
+	return -1;
+}
+
+// The number of `do` loops that are open in the code being compiled. Loops
+// outside of the current definition don't count, since the loop counters are
+// not where `i` would look for them.
+static size_t open_loops(const Compiler &c)
+{
+	size_t loops = 0;
+
+	for (size_t i = c.control.size(); i > 0; i--) {
+		if (c.control[i - 1].kind == CONTROL_DEFINITION) {
+			break;
+		}
+		if (c.control[i - 1].kind == CONTROL_DO) {
+			loops++;
+		}
+	}
+	return loops;
+}
+
+static const Control *current_definition(const Compiler &c)
+{
+	for (size_t i = c.control.size(); i > 0; i--) {
+		if (c.control[i - 1].kind == CONTROL_DEFINITION) {
+			return &c.control[i - 1];
+		}
+	}
+	return NULL;
+}
+
+static void define(Compiler &c, uint32_t id, int64_t address)
+{
+	if (id >= c.program.definitions.size()) {
+		c.program.definitions.resize(id + 1, -1);
+	}
+	c.replaced.push_back(std::make_pair(id, c.program.definitions[id]));
+	c.program.definitions[id] = address;
+}
+
+/**md
+ *
+ * ### Constant Folding
+ *
+ * Something like `2 4 3 + *` always pushes the same number, 14. There's no
+ * need to push three numbers and do two additions every time it's run, when
+ * we can work it out once while compiling, and push 14 instead.
+ *
+ * The compiler keeps count of how many numbers it has just compiled pushes
+ * of, one after another, in `literals`. When it gets to a built in word that
+ * takes no more numbers than that, and doesn't do anything but work out a new
+ * one, it takes the pushes back out and works the word out on the numbers
+ * itself. The result is pushed instead, and counts as a number just pushed,
+ * so that whole expressions fold into one number.
+ *
+ * Anything else sets the count back to 0. This includes every word that makes a
+ * place that can be jumped to, such as `then` or `begin`, so the pushes that
+ * are taken out are always run one after another.
+ *
+ * A word that would fail when it's run, like a division by 0, is not folded,
+ * so that it still fails when it's run, and where it should.
+ *
+ */
+
+// Works out `op` on `a` and `b`, or only on `a` if it takes one number, the
+// same way running it would. Returns false if it can't be, or shouldn't be.
+static bool fold_op(Op op, Cell a, Cell b, Cell &out)
+{
+	switch (op) {
+	case OP_ADD:    out = wrap_add(a, b); break;
+	case OP_SUB:    out = wrap_sub(a, b); break;
+	case OP_MUL:    out = wrap_mul(a, b); break;
+	case OP_NEGATE: out = wrap_sub(0, a); break;
+	case OP_ABS:    out = (a < 0) ? wrap_sub(0, a) : a; break;
+	case OP_MIN:    out = (a < b) ? a : b; break;
+	case OP_MAX:    out = (a > b) ? a : b; break;
+	case OP_EQ:     out = (a == b) ? -1 : 0; break;
+	case OP_NE:     out = (a != b) ? -1 : 0; break;
+	case OP_LT:     out = (a < b) ? -1 : 0; break;
+	case OP_GT:     out = (a > b) ? -1 : 0; break;
+	case OP_LE:     out = (a <= b) ? -1 : 0; break;
+	case OP_GE:     out = (a >= b) ? -1 : 0; break;
+	case OP_AND:    out = a & b; break;
+	case OP_OR:     out = a | b; break;
+	case OP_XOR:    out = a ^ b; break;
+	case OP_INVERT: out = ~a; break;
+	case OP_NIP:    out = b; break;
+	case OP_FADD:   out = real_cell(cell_real(a) + cell_real(b)); break;
+	case OP_FSUB:   out = real_cell(cell_real(a) - cell_real(b)); break;
+	case OP_FMUL:   out = real_cell(cell_real(a) * cell_real(b)); break;
+	case OP_FDIV:   out = real_cell(cell_real(a) / cell_real(b)); break;
+	case OP_TO_REAL: out = real_cell((double) a); break;
+
+	case OP_DIV:
+	case OP_MOD:
+		if (b == 0 || (b == -1 && a == INT64_MIN)) {
+			return false;
+		}
+		out = (op == OP_DIV) ? a / b : a % b;
+		break;
+
+	case OP_TO_INT:
+		if (!real_fits_int(cell_real(a))) {
+			return false;
+		}
+		out = (Cell) cell_real(a);
+		break;
+
+	default:
+		return false;
+	}
+
+	return true;
+}
+
+// Folds `op` into the `literals` numbers pushed just before it, if it can.
+// Returns false if it has to be compiled as it is.
+static bool fold(Compiler &c, Op op, size_t literals)
+{
+	std::vector<Slot> &code = c.program.code;
+	size_t pops = op_pops[op];
+
+	if (pops == 0 || pops > literals) {
+		return false;
+	}
+
+	// Each push is two slots: LIT, and the number.
+	size_t first = code.size() - 2 * pops;
+	Cell a = code[first + 1].i;
+	Cell b = (pops > 1) ? code[first + 3].i : 0;
+	Cell result;
+	unsigned int offset = c.program.offsets[first];
+
+	if (op == OP_DROP) {
+		code.resize(first);
+		c.program.offsets.resize(first);
+		c.literals = literals - 1;
+		return true;
+	}
+
+	if (op_pushes[op] != 1 || !fold_op(op, a, b, result)) {
+		return false;
+	}
+
+	code.resize(first);
+	c.program.offsets.resize(first);
+
+	// The number gets the offset of the first number it replaces.
+	std::swap(c.offset, offset);
+	emit_op(c, OP_LIT);
+	emit_int(c, result);
+	std::swap(c.offset, offset);
+
+	c.literals = literals - pops + 1;
+	return true;
+}
+
+static int compile_keyword(Compiler &c, Keyword keyword)
+{
+	Control control;
+
+	switch (keyword) {
+	case KEYWORD_IF:
+		emit_op(c, OP_JZ);
+		control.kind = CONTROL_IF;
+		control.address = emit_int(c, 0);
+		c.control.push_back(control);
+		break;
+
+	case KEYWORD_ELSE:
+		if (c.control.empty() || c.control.back().kind != CONTROL_IF) {
+			return fail(c, "'else' without 'if'");
+		}
+		emit_op(c, OP_JUMP);
+		control.kind = CONTROL_ELSE;
+		control.address = emit_int(c, 0);
+		patch(c, c.control.back().address, here(c));
+		c.control.back() = control;
+		break;
+
+	case KEYWORD_THEN:
+		if (c.control.empty() ||
+		    (c.control.back().kind != CONTROL_IF && c.control.back().kind != CONTROL_ELSE)) {
+			return fail(c, "'then' without 'if'");
+		}
+		patch(c, c.control.back().address, here(c));
+		c.control.pop_back();
+		break;
+
+	case KEYWORD_BEGIN:
+		control.kind = CONTROL_BEGIN;
+		control.address = here(c);
+		c.control.push_back(control);
+		break;
+
+	case KEYWORD_UNTIL:
+	case KEYWORD_AGAIN:
+		if (c.control.empty() || c.control.back().kind != CONTROL_BEGIN) {
+			return fail(c, "loop end without 'begin'");
+		}
+		emit_op(c, (keyword == KEYWORD_UNTIL) ? OP_JZ : OP_JUMP);
+		emit_int(c, c.control.back().address);
+		c.control.pop_back();
+		break;
+
+	case KEYWORD_WHILE:
+		if (c.control.empty() || c.control.back().kind != CONTROL_BEGIN) {
+			return fail(c, "'while' without 'begin'");
+		}
+		emit_op(c, OP_JZ);
+		control.kind = CONTROL_WHILE;
+		control.extra = c.control.back().address;
+		control.address = emit_int(c, 0);
+		c.control.back() = control;
+		break;
+
+	case KEYWORD_REPEAT:
+		if (c.control.empty() || c.control.back().kind != CONTROL_WHILE) {
+			return fail(c, "'repeat' without 'while'");
+		}
+		emit_op(c, OP_JUMP);
+		emit_int(c, c.control.back().extra);
+		patch(c, c.control.back().address, here(c));
+		c.control.pop_back();
+		break;
+
+	case KEYWORD_DO:
+		emit_op(c, OP_DO);
+		control.kind = CONTROL_DO;
+		control.address = here(c);
+		c.control.push_back(control);
+		break;
+
+	case KEYWORD_LOOP:
+		if (c.control.empty() || c.control.back().kind != CONTROL_DO) {
+			return fail(c, "'loop' without 'do'");
+		}
+		emit_op(c, OP_LOOP);
+		emit_int(c, c.control.back().address);
+		c.control.pop_back();
+		break;
+
+	case KEYWORD_I:
+	case KEYWORD_J:
+		if (open_loops(c) < ((keyword == KEYWORD_I) ? 1u : 2u)) {
+			return fail(c, "loop counter used outside of a loop");
+		}
+		emit_op(c, (keyword == KEYWORD_I) ? OP_I : OP_J);
+		break;
+
+	case KEYWORD_END_DEFINITION:
+		if (c.control.empty() || c.control.back().kind != CONTROL_DEFINITION) {
+			return fail(c, "';' without ':', or inside a control structure");
+		}
+		emit_op(c, OP_EXIT);
+		patch(c, c.control.back().address, here(c));
+		c.control.pop_back();
+		break;
+
+	case KEYWORD_RECURSE:
+	case KEYWORD_EXIT: {
+		const Control *definition = current_definition(c);
+		if (!definition) {
+			return fail(c, "'recurse' or 'exit' outside of a definition");
+		}
+		if (keyword == KEYWORD_RECURSE) {
+			emit_op(c, OP_CALL);
+			emit_int(c, definition->address + 1);
+		} else {
+			for (size_t i = open_loops(c); i > 0; i--) {
+				emit_op(c, OP_UNLOOP);
+			}
+			emit_op(c, OP_EXIT);
+		}
+		break;
+	}
+
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+/**md
+ *
+ * ### Resolving Words
+ *
+ * A call is bound to the word's definition when it's compiled, as in any
+ * Forth: a `CALL` holds the address of the code, and once the code is linked
+ * (see below), a pointer to it. Defining a word again only changes what the
+ * calls compiled after that will call. Nothing that is run ever looks a name
+ * up, so there are no call sites to go back and fix.
+ *
+ * Finding what a name means is left to the compiler, which has to try the
+ * words defined so far, then the keywords, then the built in words, for every
+ * single word in the input. With interned tokens (see `TOKENIZE_INTERN`), the
+ * same name always has the same symbol id, so the compiler remembers what each
+ * id resolved to in `resolved`, and every later use of it is a single lookup
+ * in an array. The one thing that can change what a name means is defining it
+ * as a word, and the definition is a token with the same symbol id, so its
+ * entry is simply overwritten right there.
+ *
+ */
+
+static ResolvedWord find_word(Compiler &c, const char *s, size_t n)
+{
+	ResolvedWord word;
+	uint32_t id = symbol_find(c.program.words, s, n);
+
+	if (id != SYMBOL_NONE && id < c.program.definitions.size() &&
+	    c.program.definitions[id] >= 0) {
+		word.kind = WORD_DEFINED;
+		word.value = id;
+		return word;
+	}
+
+	Keyword keyword = find_keyword(s, n);
+	if (keyword != KEYWORD_NONE) {
+		word.kind = WORD_KEYWORD;
+		word.value = keyword;
+		return word;
+	}
+
+	int op = find_builtin(s, n);
+	word.kind = (op >= 0) ? WORD_BUILTIN : WORD_UNKNOWN;
+	word.value = (op >= 0) ? op : 0;
+	return word;
+}
+
+static inline void remember_word(Compiler &c, uint32_t sym, ResolvedWord word)
+{
+	if (sym >= c.resolved.size()) {
+		ResolvedWord none = { WORD_UNRESOLVED, 0 };
+		c.resolved.resize(symbol_count(*c.tokens.symbols), none);
+	}
+	c.resolved[sym] = word;
+}
+
+// `sym` is the symbol id of the word in `c.tokens`, or SYMBOL_NONE if the
+// tokens aren't interned.
+static ResolvedWord resolve(Compiler &c, const char *s, size_t n, uint32_t sym)
+{
+	if (sym == SYMBOL_NONE) {
+		return find_word(c, s, n);
+	} else if (sym < c.resolved.size() && c.resolved[sym].kind != WORD_UNRESOLVED) {
+		return c.resolved[sym];
+	}
+
+	ResolvedWord word = find_word(c, s, n);
+	remember_word(c, sym, word);
+	return word;
+}
+
+// `literals` is what `c.literals` was before this word.
+static int compile_word(Compiler &c, const char *s, size_t n, uint32_t sym, size_t literals)
+{
+	if (c.defining) {
+		// The body starts after the jump around it, which is two slots.
+		uint32_t id = symbol_intern(c.program.words, s, n, symbol_hash(s, n));
+		Control control;
+
+		emit_op(c, OP_JUMP);
+		control.kind = CONTROL_DEFINITION;
+		control.address = emit_int(c, 0);
+		control.extra = id;
+		c.control.push_back(control);
+		define(c, id, here(c));
+		if (sym != SYMBOL_NONE) {
+			ResolvedWord word = { WORD_DEFINED, id };
+			remember_word(c, sym, word);
+		}
+		c.defining = false;
+		return 0;
+	}
+
+	ResolvedWord word = resolve(c, s, n, sym);
+	switch (word.kind) {
+	case WORD_DEFINED:
+		emit_op(c, OP_CALL);
+		emit_int(c, c.program.definitions[word.value]);
+		return 0;
+
+	case WORD_KEYWORD:
+		return compile_keyword(c, (Keyword) word.value);
+
+	case WORD_BUILTIN:
+		if (!fold(c, (Op) word.value, literals)) {
+			emit_op(c, (Op) word.value);
+		}
+		return 0;
+
+	default:
+		return fail(c, "unknown word");
+	}
+}
+
+static int compile_debug(Compiler &c, const char *s, size_t n)
+{
+	if (n == 0) {
+		if (c.defining || current_definition(c)) {
+			return fail(c, "definitions can't be nested");
+		}
+		c.defining = true;
+		return 0;
+	}
+
+	if (n == 11 && memcmp(s, "stack_trace", n) == 0) {
+		emit_op(c, OP_STACK_TRACE);
+	} else if (n == 5 && memcmp(s, "break", n) == 0) {
+		emit_op(c, OP_BREAK);
+	} else {
+		return fail(c, "unknown debug command");
+	}
+	return 0;
+}
+
+static int compile_token(Compiler &c, const Token &token)
+{
+	size_t literals = c.literals;
+	Slot slot;
+
+	c.offset = token.offset;
+	c.literals = 0;
+
+	if (c.defining && token.type != TOKEN_TYPE_ID) {
+		return fail(c, "':' must be followed by the name of a word");
+	}
+
+	switch (token.type) {
+	case TOKEN_TYPE_INT:
+		emit_op(c, OP_LIT);
+		emit_int(c, token.data.i);
+		c.literals = literals + 1;
+		break;
+
+	case TOKEN_TYPE_REAL:
+		emit_op(c, OP_LIT);
+		slot.r = token.data.r;
+		emit(c, slot);
+		c.literals = literals + 1;
+		break;
+
+	case TOKEN_TYPE_STRING:
+		c.program.strings.emplace_back(token_text(c.tokens, token), token_length(c.tokens, token));
+		emit_op(c, OP_LIT);
+		slot.p = c.program.strings.back().c_str();
+		emit(c, slot);
+		break;
+
+	case TOKEN_TYPE_ID:
+		return compile_word(c, token_text(c.tokens, token), token_length(c.tokens, token),
+		                    token_is_symbol(c.tokens, token) ? token.data.sym : SYMBOL_NONE,
+		                    literals);
+
+	case TOKEN_TYPE_DEBUG_COMMAND:
+		return compile_debug(c, token_text(c.tokens, token), token_length(c.tokens, token));
+
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+int interpreter_compile(Program &program, const TokenResult &tokens, InterpreterError &error)
+{
+	Compiler c(program, tokens, error);
+	size_t start = program.code.size();
+	size_t strings = program.strings.size();
+	bool stream = token_stream_size(tokens.stream) > 0;
+	size_t count = stream ? token_stream_size(tokens.stream) : tokens.tokens.size();
+	int ret = 0;
+
+	for (size_t i = 0; i < count && ret == 0; i++) {
+		ret = compile_token(c, stream ? token_stream_get(tokens.stream, i) : tokens.tokens[i]);
+	}
+
+	if (ret == 0) {
+		c.offset = tokens.characters_processed;
+		if (c.defining) {
+			ret = fail(c, "':' must be followed by the name of a word");
+		} else if (!c.control.empty()) {
+			ret = fail(c, (c.control.back().kind == CONTROL_DEFINITION) ?
+			              "unterminated definition" : "unterminated control structure");
+		}
+	}
+
+	if (ret < 0) {
+		// Undo everything, newest first.
+		for (size_t i = c.replaced.size(); i > 0; i--) {
+			program.definitions[c.replaced[i - 1].first] = c.replaced[i - 1].second;
+		}
+		program.code.resize(start);
+		program.offsets.resize(start);
+		program.strings.resize(strings);
+		return -1;
+	}
+
+	emit_op(c, OP_HALT);
+	program.entry = start;
+	program.linked.clear();
+	return 0;
+}
+
+// Both stacks are allocated together, each followed by a guard page, and the
+// first one preceded by one:
+//
+//     | guard | data stack | guard | return stack | guard |
+//
+// Without guard pages, the same layout is kept, only with nothing stopping
+// anything from going past the end of a stack.
+static inline size_t round_up(size_t n, size_t to)
+{
+	return (n + to - 1) / to * to;
+}
+
+Interpreter::Interpreter()
+{
+	size_t page = 4096;
+#ifdef INTERPRETER_GUARD_PAGES
+	page = sysconf(_SC_PAGESIZE);
+#endif
+	size_t data_size = round_up((INTERPRETER_STACK_SIZE + 1) * sizeof(Cell), page);
+	size_t return_size = round_up(INTERPRETER_RSTACK_SIZE * sizeof(Cell), page);
+	char *start;
+
+	memory_size = 3 * page + data_size + return_size;
+#ifdef INTERPRETER_GUARD_PAGES
+	memory = mmap(NULL, memory_size, PROT_NONE, MAP_PRIVATE | MAP_ANON, -1, 0);
+	if (memory == MAP_FAILED) {
+		throw std::bad_alloc();
+	}
+	start = (char *) memory;
+	if (mprotect(start + page, data_size, PROT_READ | PROT_WRITE) < 0 ||
+	    mprotect(start + 2 * page + data_size, return_size, PROT_READ | PROT_WRITE) < 0) {
+		munmap(memory, memory_size);
+		throw std::bad_alloc();
+	}
+#else
+	memory = calloc(1, memory_size + page);
+	if (!memory) {
+		throw std::bad_alloc();
+	}
+	start = (char *) round_up((uintptr_t) memory, page);
+#endif
+
+	stack = (Cell *) (start + page);
+	rstack = (Cell *) (start + 2 * page + data_size);
+	depth = 0;
+	profile = NULL;
+	jit = false;
+	error.message = NULL;
+	error.offset = 0;
+}
+
+Interpreter::~Interpreter()
+{
+#ifdef INTERPRETER_GUARD_PAGES
+	munmap(memory, memory_size);
+#else
+	free(memory);
+#endif
+}
+
+/**md
+ *
+ * Running
+ * -------
+ *
+ * ### Threading
+ *
+ * The usual way to write the loop that runs the code is a `switch` on the
+ * instruction, inside a loop. Every instruction then ends by jumping back to
+ * the top of the loop, where a single indirect jump picks where to go next.
+ * Since that one jump is shared by all of the instructions, the CPU has a
+ * hard time guessing where it goes.
+ *
+ * GCC and Clang allow taking the address of a label (`&&label`), and jumping
+ * to an address (`goto *address`). With that, we can replace every
+ * instruction in the code with the address of the code that carries it out,
+ * and end each instruction with its own jump to the next one. This is called
+ * ''direct threading'', and it saves both the bounds check of the `switch` and
+ * the jump back to the top, and gives each instruction's jump a history of its
+ * own for the CPU to guess from.
+ *
+ * Other compilers get the `switch` instead. The same code is used for both: the
+ * `CASE` and `NEXT` macros turn into either labels and jumps, or `case`s and
+ * `continue`. Building with `BLINDFORTH_NO_COMPUTED_GOTO` defined forces the
+ * `switch`.
+ *
+ * ### Caching the Top of the Stack
+ *
+ * Almost every instruction reads or replaces the top of the stack. Keeping it
+ * in a local variable (`tos`), which the compiler can keep in a register,
+ * saves a load and a store in most of them. `+`, for instance, becomes a single
+ * load of the second cell and an addition.
+ *
+ * `sp` points at where `tos` would be stored if something was pushed on top of
+ * it. To push, we store `tos` there, and move the new value into `tos`. This
+ * works even if the stack is empty: `tos` then holds a meaningless value, which
+ * pushing stores into `stack[0]`. That's the slot that is never used, and the
+ * reason it exists. So the stack always holds `sp - base` cells.
+ *
+ */
+
+/**md
+ *
+ * ### Checking the Stacks
+ *
+ * An instruction must not pop more cells than are on the stack, or push more
+ * than fit. Checking that in every single instruction would make most of them
+ * twice as long as they need to be. But within a block of code that is always
+ * run from start to end, with no jumps into or out of the middle of it, we
+ * know exactly how deep the stack gets relative to where it started. So when
+ * the code is linked, it is split into such blocks, and each block gets a
+ * single `CHECK` in front of it. It checks that there are enough cells on the
+ * stack for the whole block, and enough room for the most it will push. The
+ * instructions themselves then don't check anything.
+ *
+ * A block ends at every jump, call and return, and starts at every place that
+ * is jumped to. It also ends after anything that prints, since a check at the
+ * start of the block would otherwise report an error before the output that
+ * should have come before it. A loop whose body is a single block jumps back to its start
+ * at the end of every run through it. If the body leaves the stack as deep as
+ * it found it, which most loops do, the check would only pass again. So the
+ * jump back goes to just after the `CHECK`, and the check is done once, when
+ * the loop is entered.
+ *
+ * When a check fails, the block is gone through once more, this time one
+ * instruction at a time, to find the one that would have failed, so that the
+ * error still points at the right word.
+ *
+ */
+
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(BLINDFORTH_NO_COMPUTED_GOTO)
+#define INTERPRETER_THREADED 1
+#endif
+
+typedef struct Block {
+	size_t end;    // Index in `code` right after the block
+	size_t last;   // Index of its last instruction
+	int64_t need;  // Number of cells it needs on the stack
+	int64_t room;  // Number of cells it pushes at most
+	int64_t delta; // Change in depth from its start to its end
+} Block;
+
+static inline bool is_branch(Op op)
+{
+	return op == OP_JUMP || op == OP_JZ || op == OP_CALL || op == OP_LOOP;
+}
+
+// Instructions whose effects can be seen from outside, which have to happen
+// before any error that comes after them.
+static inline bool is_output(Op op)
+{
+	return op == OP_PRINT || op == OP_FPRINT || op == OP_EMIT || op == OP_CR ||
+	       op == OP_TYPE || op == OP_STACK_TRACE || op == OP_BREAK;
+}
+
+static Block find_block(const Program &program, const std::vector<bool> &leaders, size_t start)
+{
+	const std::vector<Slot> &code = program.code;
+	Block block = { start, start, 0, 0, 0 };
+	size_t i = start;
+
+	do {
+		Op op = (Op) code[i].op;
+
+		block.last = i;
+		block.delta -= op_pops[op];
+		if (-block.delta > block.need) {
+			block.need = -block.delta;
+		}
+		block.delta += op_pushes[op];
+		if (block.delta > block.room) {
+			block.room = block.delta;
+		}
+		i += 1 + op_operands[op];
+	} while (i < code.size() && !leaders[i]);
+
+	block.end = i;
+	return block;
+}
+
+/**md
+ *
+ * ### Superinstructions
+ *
+ * With the stack checks out of the way, most instructions are only a couple
+ * of machine instructions long, and what a program mostly spends its time on
+ * is getting from one instruction to the next. The only way to do less of
+ * that is to have fewer instructions. So some sequences of instructions that
+ * are common enough are replaced with a single instruction that does the work
+ * of all of them, a ''superinstruction''. `1 +` becomes `LIT_ADD 1`, for
+ * instance, which adds its operand to the top of the stack directly, instead
+ * of pushing it first.
+ *
+ * The set was picked from profiles (see `InterpreterProfile`) of loops and
+ * recursive words: adding and comparing with a number, squaring, `2dup` as
+ * `over over`, adding the loop counter, and comparisons that are immediately
+ * followed by an `if`, `until` or `while`.
+ *
+ * Like the checks, this is done while linking, one block at a time, so that
+ * nothing is ever fused across a place that is jumped to.
+ *
+ */
+
+typedef struct Fusion {
+	Op ops[3];
+	size_t length;
+	Op fused;
+} Fusion;
+
+// Longer sequences come first, so that they are preferred.
+static const Fusion fusions[] = {
+	{ { OP_LIT, OP_EQ, OP_JZ }, 3, OP_LIT_EQ_JZ },
+	{ { OP_LIT, OP_LT, OP_JZ }, 3, OP_LIT_LT_JZ },
+	{ { OP_LIT, OP_GT, OP_JZ }, 3, OP_LIT_GT_JZ },
+	{ { OP_LIT, OP_ADD },       2, OP_LIT_ADD },
+	{ { OP_LIT, OP_SUB },       2, OP_LIT_SUB },
+	{ { OP_LIT, OP_MUL },       2, OP_LIT_MUL },
+	{ { OP_LIT, OP_EQ },        2, OP_LIT_EQ },
+	{ { OP_LIT, OP_LT },        2, OP_LIT_LT },
+	{ { OP_LIT, OP_GT },        2, OP_LIT_GT },
+	{ { OP_EQ, OP_JZ },         2, OP_EQ_JZ },
+	{ { OP_LT, OP_JZ },         2, OP_LT_JZ },
+	{ { OP_GT, OP_JZ },         2, OP_GT_JZ },
+	{ { OP_DUP, OP_MUL },       2, OP_DUP_MUL },
+	{ { OP_OVER, OP_OVER },     2, OP_OVER_OVER },
+	{ { OP_I, OP_ADD },         2, OP_I_ADD },
+	{ { OP_SWAP, OP_DROP },     2, OP_NIP },
+};
+
+#define FUSION_COUNT (sizeof(fusions) / sizeof(fusions[0]))
+
+// Finds a sequence that the code at `i` starts with, and which ends before
+// `end`.
+static const Fusion *find_fusion(const std::vector<Slot> &code, size_t i, size_t end)
+{
+	for (size_t f = 0; f < FUSION_COUNT; f++) {
+		size_t j = i;
+		size_t k;
+
+		for (k = 0; k < fusions[f].length && j < end && code[j].op == fusions[f].ops[k]; k++) {
+			j += 1 + op_operands[code[j].op];
+		}
+		if (k == fusions[f].length) {
+			return &fusions[f];
+		}
+	}
+	return NULL;
+}
+
+static void release_jit(Program &program)
+{
+	for (size_t i = 0; i < program.jit_words.size(); i++) {
+		jit_free(program.jit_words[i]);
+	}
+	program.jit_words.clear();
+}
+
+Program::~Program()
+{
+	release_jit(*this);
+}
+
+// Copies the code into `program.linked`, as explained in interpreter.hpp. It
+// puts a `CHECK` in front of every block that needs one, and if `fuse` is set,
+// replaces sequences of instructions with superinstructions.
+static void link_program(Program &program, const void *const *labels, bool fuse)
+{
+	const std::vector<Slot> &code = program.code;
+	std::vector<Slot> &linked = program.linked;
+	std::vector<bool> leaders(code.size() + 1, false);
+	std::vector<bool> loops(code.size(), false); // Jumps that can skip the check
+	std::vector<size_t> entries(code.size());    // Where a jump to a block goes
+	std::vector<size_t> bodies(code.size());     // Where its first instruction went
+	std::vector<std::pair<size_t, size_t>> jumps; // Operands to fill in, and their jump
+	size_t i;
+
+	leaders[0] = true;
+	for (i = 0; i < code.size(); i += 1 + op_operands[code[i].op]) {
+		Op op = (Op) code[i].op;
+		if (is_branch(op)) {
+			leaders[code[i + 1].i] = true;
+		}
+		if (is_branch(op) || is_output(op) || op == OP_EXIT || op == OP_HALT) {
+			leaders[i + 1 + op_operands[op]] = true;
+		}
+	}
+
+	// Any machine code refers to the old linked code.
+	release_jit(program);
+
+	linked.clear();
+	program.origins.clear();
+	program.linked_ops.clear();
+	for (size_t start = 0; start < code.size(); ) {
+		Block block = find_block(program, leaders, start);
+		Slot slot;
+
+		entries[start] = linked.size();
+		if (block.need > 0 || block.room > 0) {
+			slot.op = OP_CHECK;
+			if (labels) {
+				slot.p = labels[OP_CHECK];
+			}
+			linked.push_back(slot);
+			slot.i = (block.room << 32) | block.need;
+			linked.push_back(slot);
+			program.origins.push_back(start);
+			program.origins.push_back(start);
+			program.linked_ops.push_back(OP_CHECK);
+			program.linked_ops.push_back(OP_SIZE);
+		}
+		bodies[start] = linked.size();
+
+		for (i = start; i < block.end; ) {
+			const Fusion *fusion = fuse ? find_fusion(code, i, block.end) : NULL;
+			Op op = fusion ? fusion->fused : (Op) code[i].op;
+			size_t length = fusion ? fusion->length : 1;
+
+			slot.op = op;
+			if (labels) {
+				slot.p = labels[op];
+			}
+			linked.push_back(slot);
+			program.origins.push_back(i);
+			program.linked_ops.push_back(op);
+
+			// The operands of each of the instructions it replaces.
+			for (size_t k = 0; k < length; k++) {
+				Op part = (Op) code[i].op;
+				for (size_t n = 1; n <= op_operands[part]; n++) {
+					if (is_branch(part)) {
+						jumps.push_back(std::make_pair(linked.size(), i));
+					}
+					linked.push_back(code[i + n]);
+					program.origins.push_back(i + n);
+					program.linked_ops.push_back(OP_SIZE);
+				}
+				i += 1 + op_operands[part];
+			}
+		}
+
+		Op op = (Op) code[block.last].op;
+		if (op != OP_CALL && is_branch(op) && (size_t) code[block.last + 1].i == start &&
+		    block.delta == 0) {
+			loops[block.last] = true;
+		}
+
+		start = block.end;
+	}
+
+	// Now that every block has its place, the jumps can be filled in.
+	for (i = 0; i < jumps.size(); i++) {
+		size_t at = jumps[i].second;
+		size_t target = code[at + 1].i;
+		target = loops[at] ? bodies[target] : entries[target];
+		linked[jumps[i].first].p = linked.data() + target;
+	}
+
+	// The entry always follows a `HALT`, or is at the very start, so it's
+	// always the start of a block.
+	program.linked_entry = entries[program.entry];
+	program.calls.assign(linked.size(), 0);
+}
+
+// The offset of the token that the linked slot came from.
+static inline unsigned int slot_offset(const Program &program, const Slot *slot)
+{
+	return program.offsets[program.origins[slot - program.linked.data()]];
+}
+
+static void print_stack(const Cell *base, const Cell *sp, Cell tos)
+{
+	size_t depth = sp - base;
+
+	printf("<%zu>", depth);
+	for (size_t i = 1; i < depth; i++) {
+		printf(" %lld", (long long) base[i]);
+	}
+	if (depth > 0) {
+		printf(" %lld", (long long) tos);
+	}
+	printf("\n");
+}
+
+/**md
+ *
+ * ### Profiling
+ *
+ * When profiling, every instruction is counted just before it's run. The
+ * profile is only about the code as it was compiled, so `CHECK`s aren't
+ * counted, and each instruction is counted as the one in `code` it came from.
+ * A pair or a triple is only counted if its instructions follow each other in
+ * the code, since those are the only ones that could be fused.
+ *
+ * `interpreter_run` is a template on whether it profiles, like
+ * `tokenizer_feed_impl` is on its mode, so that the code that doesn't profile
+ * doesn't have to check if it should.
+ *
+ */
+
+static void profile_step(InterpreterProfile &profile, const Program &program, const Slot *ip)
+{
+	size_t at = program.origins[ip - program.linked.data()];
+	int op = program.code[at].op;
+
+	if (at != profile.next) {
+		profile.chain = 0;
+	}
+
+	profile.singles[op]++;
+	if (op == OP_CALL) {
+		size_t word = program.code[at + 1].i;
+		if (word >= profile.words.size()) {
+			profile.words.resize(program.code.size());
+		}
+		profile.words[word]++;
+	}
+	if (profile.chain >= 1) {
+		profile.pairs[profile.last[1] * OP_SIZE + op]++;
+	}
+	if (profile.chain >= 2) {
+		profile.triples[(profile.last[0] * OP_SIZE + profile.last[1]) * OP_SIZE + op]++;
+	}
+
+	profile.last[0] = profile.last[1];
+	profile.last[1] = op;
+	profile.chain++;
+	profile.next = at + 1 + op_operands[op];
+}
+
+#define INTERPRETER_OP_NAME(name, operands, pops, pushes) #name,
+
+static const char *const op_names[OP_SIZE] = {
+	INTERPRETER_OPS(INTERPRETER_OP_NAME)
+};
+
+#define INTERPRETER_PROFILE_TOP 20
+
+// Prints the `INTERPRETER_PROFILE_TOP` most frequent entries of `counts`, each
+// of which stands for `length` instructions.
+static void profile_dump_counts(const std::vector<uint64_t> &counts, int length, FILE *f)
+{
+	std::vector<std::pair<uint64_t, size_t>> sorted;
+
+	for (size_t i = 0; i < counts.size(); i++) {
+		if (counts[i]) {
+			sorted.push_back(std::make_pair(counts[i], i));
+		}
+	}
+	std::sort(sorted.begin(), sorted.end(),
+	          [](const std::pair<uint64_t, size_t> &a, const std::pair<uint64_t, size_t> &b) {
+		return a.first > b.first;
+	});
+
+	for (size_t i = 0; i < sorted.size() && i < INTERPRETER_PROFILE_TOP; i++) {
+		size_t index = sorted[i].second;
+		const char *names[3];
+
+		for (int k = length - 1; k >= 0; k--) {
+			names[k] = op_names[index % OP_SIZE];
+			index /= OP_SIZE;
+		}
+
+		fprintf(f, "%14llu ", (unsigned long long) sorted[i].first);
+		for (int k = 0; k < length; k++) {
+			fprintf(f, " %s", names[k]);
+		}
+		fprintf(f, "\n");
+	}
+}
+
+// The name of the word whose code starts at `at`. A word that was defined
+// again since has lost its name, and is called by where it starts.
+static std::string profile_word_name(const Program &program, size_t at)
+{
+	for (size_t id = 0; id < program.definitions.size(); id++) {
+		if (program.definitions[id] == (int64_t) at) {
+			return std::string(symbol_name(program.words, id), symbol_length(program.words, id));
+		}
+	}
+	return "@" + std::to_string(at);
+}
+
+void interpreter_profile_dump(const InterpreterProfile &profile, const Program &program, FILE *f)
+{
+	std::vector<std::pair<uint64_t, size_t>> words;
+
+	fprintf(f, "Instructions:\n");
+	profile_dump_counts(profile.singles, 1, f);
+	fprintf(f, "Pairs:\n");
+	profile_dump_counts(profile.pairs, 2, f);
+	fprintf(f, "Triples:\n");
+	profile_dump_counts(profile.triples, 3, f);
+
+	for (size_t i = 0; i < profile.words.size(); i++) {
+		if (profile.words[i]) {
+			words.push_back(std::make_pair(profile.words[i], i));
+		}
+	}
+	std::sort(words.begin(), words.end(),
+	          [](const std::pair<uint64_t, size_t> &a, const std::pair<uint64_t, size_t> &b) {
+		return a.first > b.first;
+	});
+
+	fprintf(f, "Words:\n");
+	for (size_t i = 0; i < words.size() && i < INTERPRETER_PROFILE_TOP; i++) {
+		fprintf(f, "%14llu  %s\n", (unsigned long long) words[i].first,
+		        profile_word_name(program, words[i].second).c_str());
+	}
+}
+
+void interpreter_profile_write(const InterpreterProfile &profile, const Program &program,
+                               CounterWriter &w)
+{
+	for (int i = 0; i < OP_SIZE; i++) {
+		if (profile.singles[i]) {
+			counter_write(w, "blindforth_instructions_total", profile.singles[i],
+			              "op", op_names[i]);
+		}
+	}
+	for (int i = 0; i < OP_SIZE * OP_SIZE; i++) {
+		if (profile.pairs[i]) {
+			counter_write(w, "blindforth_instruction_pairs_total", profile.pairs[i],
+			              "first", op_names[i / OP_SIZE], "second", op_names[i % OP_SIZE]);
+		}
+	}
+
+	// The names have to stay around until they are written.
+	std::vector<std::string> names;
+	std::vector<size_t> called;
+	for (size_t i = 0; i < profile.words.size(); i++) {
+		if (profile.words[i]) {
+			names.push_back(profile_word_name(program, i));
+			called.push_back(i);
+		}
+	}
+	for (size_t i = 0; i < called.size(); i++) {
+		counter_write(w, "blindforth_word_calls_total", profile.words[called[i]],
+		              "word", names[i].c_str());
+	}
+}
+
+// Compiles the word at `linked[target]` into machine code, and makes every call
+// to it a `CALL_NATIVE`.
+static void compile_native(Program &program, size_t target, const void *const *labels)
+{
+	JitWord *word = jit_compile(program, target);
+	if (!word) {
+		return;
+	}
+	program.jit_words.push_back(word);
+
+	for (size_t i = 0; i < program.linked.size(); i++) {
+		if (program.linked_ops[i] == OP_CALL &&
+		    program.linked[i + 1].p == program.linked.data() + target) {
+			program.linked[i].op = OP_CALL_NATIVE;
+			if (labels) {
+				program.linked[i].p = labels[OP_CALL_NATIVE];
+			}
+			program.linked[i + 1].p = word;
+			program.linked_ops[i] = OP_CALL_NATIVE;
+		}
+	}
+}
+
+#define PROFILE() do { if (profile) { profile_step(*interpreter.profile, program, ip); } } while (0)
+
+#ifdef INTERPRETER_THREADED
+#define CASE(name) op_##name:
+#define NEXT do { if (profile && ip->p != labels[OP_CHECK]) { PROFILE(); } goto *(ip++)->p; } while (0)
+#else
+#define CASE(name) case OP_##name:
+#define NEXT continue
+#endif
+
+// The return stack is only checked for room. The compiler makes sure that
+// nothing pops anything off it that wasn't pushed.
+#define RROOM(n) do { if (rlimit - rsp < (n)) goto roverflow; } while (0)
+
+#define INTERPRETER_LABEL(name, operands, pops, pushes) &&op_##name,
+
+// The ways `run` can run, which are also the values of `program.linked_mode`.
+#define RUN_NORMAL 0
+#define RUN_PROFILE 1
+#define RUN_JIT 2
+
+template <int mode>
+static int run(Interpreter &interpreter, Program &program)
+{
+	const bool profile = (mode == RUN_PROFILE);
+
+#ifdef INTERPRETER_THREADED
+	static const void *const labels[OP_SIZE] = {
+		INTERPRETER_OPS(INTERPRETER_LABEL)
+	};
+#else
+	static const void *const *const labels = NULL;
+#endif
+
+	// Each way of running has its own labels, so the code has to be linked
+	// again if it was linked for another.
+	if (program.linked.empty() || program.linked_mode != mode) {
+		link_program(program, labels, !profile);
+		program.linked_mode = mode;
+	}
+
+	Cell *base = interpreter.stack;
+	Cell *limit = base + INTERPRETER_STACK_SIZE;
+	Cell *sp = base + interpreter.depth;
+	Cell tos = *sp;
+
+	Cell *rlimit = interpreter.rstack + INTERPRETER_RSTACK_SIZE;
+	Cell *rsp = interpreter.rstack;
+
+	const Slot *ip = program.linked.data() + program.linked_entry;
+	const char *message = NULL;
+	int ret = 1;
+
+#ifdef INTERPRETER_THREADED
+	NEXT;
+	{
+#else
+	for (;;) {
+		if (profile && ip->op != OP_CHECK) {
+			PROFILE();
+		}
+		switch ((ip++)->op) {
+#endif
+
+	CASE(HALT)
+		goto done;
+
+	CASE(LIT)
+		*sp++ = tos;
+		tos = (ip++)->i;
+		NEXT;
+
+	CASE(CALL)
+		RROOM(1);
+		*rsp++ = (Cell) (intptr_t) (ip + 1);
+		if (mode == RUN_JIT) {
+			size_t target = (const Slot *) ip->p - program.linked.data();
+			if (++program.calls[target] == JIT_THRESHOLD) {
+				compile_native(program, target, labels);
+			}
+			ip = program.linked.data() + target;
+			NEXT;
+		}
+		ip = (const Slot *) ip->p;
+		NEXT;
+
+	CASE(CALL_NATIVE)
+	{
+		RROOM(1);
+		JitState state = { sp, tos, rsp, base, limit, rlimit };
+		*state.rsp++ = (Cell) (intptr_t) (ip + 1);
+		ip = ((const JitWord *) ip->p)->fn(&state);
+		sp = state.sp;
+		tos = state.tos;
+		rsp = state.rsp;
+		NEXT;
+	}
+
+	CASE(EXIT)
+		ip = (const Slot *) (intptr_t) *--rsp;
+		NEXT;
+
+	CASE(JUMP)
+		ip = (const Slot *) ip->p;
+		NEXT;
+
+	CASE(JZ)
+	{
+		Cell flag = tos;
+		tos = *--sp;
+		ip = flag ? ip + 1 : (const Slot *) ip->p;
+		NEXT;
+	}
+
+	CASE(DO)
+		// ( limit start -- ) The limit goes below the counter.
+		RROOM(2);
+		rsp[0] = sp[-1];
+		rsp[1] = tos;
+		rsp += 2;
+		sp -= 2;
+		tos = *sp;
+		NEXT;
+
+	CASE(LOOP)
+		if (++rsp[-1] < rsp[-2]) {
+			ip = (const Slot *) ip->p;
+		} else {
+			rsp -= 2;
+			ip++;
+		}
+		NEXT;
+
+	CASE(UNLOOP)
+		rsp -= 2;
+		NEXT;
+
+	CASE(I)
+		*sp++ = tos;
+		tos = rsp[-1];
+		NEXT;
+
+	CASE(J)
+		*sp++ = tos;
+		tos = rsp[-3];
+		NEXT;
+
+	CASE(ADD)
+		tos = wrap_add(*--sp, tos);
+		NEXT;
+
+	CASE(SUB)
+		tos = wrap_sub(*--sp, tos);
+		NEXT;
+
+	CASE(MUL)
+		tos = wrap_mul(*--sp, tos);
+		NEXT;
+
+	CASE(DIV)
+		if (tos == 0) {
+			message = "division by zero";
+			goto error;
+		} else if (tos == -1 && sp[-1] == INT64_MIN) {
+			message = "division overflow";
+			goto error;
+		}
+		tos = *--sp / tos;
+		NEXT;
+
+	CASE(MOD)
+		if (tos == 0) {
+			message = "division by zero";
+			goto error;
+		} else if (tos == -1 && sp[-1] == INT64_MIN) {
+			message = "division overflow";
+			goto error;
+		}
+		tos = *--sp % tos;
+		NEXT;
+
+	CASE(NEGATE)
+		tos = wrap_sub(0, tos);
+		NEXT;
+
+	CASE(ABS)
+		tos = (tos < 0) ? wrap_sub(0, tos) : tos;
+		NEXT;
+
+	CASE(MIN)
+	{
+		Cell a = *--sp;
+		tos = (a < tos) ? a : tos;
+		NEXT;
+	}
+
+	CASE(MAX)
+	{
+		Cell a = *--sp;
+		tos = (a > tos) ? a : tos;
+		NEXT;
+	}
+
+	CASE(EQ)
+		tos = (*--sp == tos) ? -1 : 0;
+		NEXT;
+
+	CASE(NE)
+		tos = (*--sp != tos) ? -1 : 0;
+		NEXT;
+
+	CASE(LT)
+		tos = (*--sp < tos) ? -1 : 0;
+		NEXT;
+
+	CASE(GT)
+		tos = (*--sp > tos) ? -1 : 0;
+		NEXT;
+
+	CASE(LE)
+		tos = (*--sp <= tos) ? -1 : 0;
+		NEXT;
+
+	CASE(GE)
+		tos = (*--sp >= tos) ? -1 : 0;
+		NEXT;
+
+	CASE(AND)
+		tos &= *--sp;
+		NEXT;
+
+	CASE(OR)
+		tos |= *--sp;
+		NEXT;
+
+	CASE(XOR)
+		tos ^= *--sp;
+		NEXT;
+
+	CASE(INVERT)
+		tos = ~tos;
+		NEXT;
+
+	CASE(DUP)
+		*sp++ = tos;
+		NEXT;
+
+	CASE(DROP)
+		tos = *--sp;
+		NEXT;
+
+	CASE(SWAP)
+	{
+		Cell a = sp[-1];
+		sp[-1] = tos;
+		tos = a;
+		NEXT;
+	}
+
+	CASE(OVER)
+	{
+		Cell a = sp[-1];
+		*sp++ = tos;
+		tos = a;
+		NEXT;
+	}
+
+	CASE(ROT)
+	{
+		// ( a b c -- b c a )
+		Cell a = sp[-2];
+		sp[-2] = sp[-1];
+		sp[-1] = tos;
+		tos = a;
+		NEXT;
+	}
+
+	CASE(NIP)
+		sp--;
+		NEXT;
+
+	CASE(TUCK)
+	{
+		// ( a b -- b a b )
+		Cell a = sp[-1];
+		sp[-1] = tos;
+		*sp++ = a;
+		NEXT;
+	}
+
+	CASE(FADD)
+		tos = real_cell(cell_real(*--sp) + cell_real(tos));
+		NEXT;
+
+	CASE(FSUB)
+		tos = real_cell(cell_real(*--sp) - cell_real(tos));
+		NEXT;
+
+	CASE(FMUL)
+		tos = real_cell(cell_real(*--sp) * cell_real(tos));
+		NEXT;
+
+	CASE(FDIV)
+		tos = real_cell(cell_real(*--sp) / cell_real(tos));
+		NEXT;
+
+	CASE(TO_REAL)
+		tos = real_cell((double) tos);
+		NEXT;
+
+	CASE(TO_INT)
+	{
+		double r = cell_real(tos);
+		if (!real_fits_int(r)) {
+			message = "real number out of range";
+			goto error;
+		}
+		tos = (Cell) r;
+		NEXT;
+	}
+
+	CASE(PRINT)
+		printf("%lld ", (long long) tos);
+		tos = *--sp;
+		NEXT;
+
+	CASE(FPRINT)
+		printf("%g ", cell_real(tos));
+		tos = *--sp;
+		NEXT;
+
+	CASE(EMIT)
+		putchar((int) (tos & 0xff));
+		tos = *--sp;
+		NEXT;
+
+	CASE(CR)
+		putchar('\n');
+		NEXT;
+
+	CASE(TYPE)
+		fputs((const char *) (intptr_t) tos, stdout);
+		tos = *--sp;
+		NEXT;
+
+	CASE(STACK_TRACE)
+		print_stack(base, sp, tos);
+		NEXT;
+
+	CASE(CHECK)
+		if (sp - base < (ip->i & 0xffffffff) || limit - sp < (ip->i >> 32)) {
+			goto check_failed;
+		}
+		ip++;
+		NEXT;
+
+	CASE(LIT_ADD)
+		tos = wrap_add(tos, (ip++)->i);
+		NEXT;
+
+	CASE(LIT_SUB)
+		tos = wrap_sub(tos, (ip++)->i);
+		NEXT;
+
+	CASE(LIT_MUL)
+		tos = wrap_mul(tos, (ip++)->i);
+		NEXT;
+
+	CASE(LIT_EQ)
+		tos = (tos == (ip++)->i) ? -1 : 0;
+		NEXT;
+
+	CASE(LIT_LT)
+		tos = (tos < (ip++)->i) ? -1 : 0;
+		NEXT;
+
+	CASE(LIT_GT)
+		tos = (tos > (ip++)->i) ? -1 : 0;
+		NEXT;
+
+	CASE(DUP_MUL)
+		tos = wrap_mul(tos, tos);
+		NEXT;
+
+	CASE(OVER_OVER)
+		// ( a b -- a b a b )
+		sp[0] = tos;
+		sp[1] = sp[-1];
+		sp += 2;
+		NEXT;
+
+	CASE(I_ADD)
+		tos = wrap_add(tos, rsp[-1]);
+		NEXT;
+
+	CASE(EQ_JZ)
+	{
+		Cell a = *--sp;
+		Cell b = tos;
+		tos = *--sp;
+		ip = (a == b) ? ip + 1 : (const Slot *) ip->p;
+		NEXT;
+	}
+
+	CASE(LT_JZ)
+	{
+		Cell a = *--sp;
+		Cell b = tos;
+		tos = *--sp;
+		ip = (a < b) ? ip + 1 : (const Slot *) ip->p;
+		NEXT;
+	}
+
+	CASE(GT_JZ)
+	{
+		Cell a = *--sp;
+		Cell b = tos;
+		tos = *--sp;
+		ip = (a > b) ? ip + 1 : (const Slot *) ip->p;
+		NEXT;
+	}
+
+	CASE(LIT_EQ_JZ)
+	{
+		Cell a = tos;
+		tos = *--sp;
+		ip = (a == ip[0].i) ? ip + 2 : (const Slot *) ip[1].p;
+		NEXT;
+	}
+
+	CASE(LIT_LT_JZ)
+	{
+		Cell a = tos;
+		tos = *--sp;
+		ip = (a < ip[0].i) ? ip + 2 : (const Slot *) ip[1].p;
+		NEXT;
+	}
+
+	CASE(LIT_GT_JZ)
+	{
+		Cell a = tos;
+		tos = *--sp;
+		ip = (a > ip[0].i) ? ip + 2 : (const Slot *) ip[1].p;
+		NEXT;
+	}
+
+	CASE(BREAK)
+		printf("break at offset %u: ", slot_offset(program, ip - 1));
+		print_stack(base, sp, tos);
+		NEXT;
+
+#ifndef INTERPRETER_THREADED
+		default:
+			message = "invalid instruction";
+			goto error;
+		}
+#endif
+	}
+
+check_failed:
+	{
+		// Go through the block one instruction at a time, to find the one
+		// that would have failed.
+		size_t i = program.origins[ip - program.linked.data()];
+		int64_t depth = sp - base;
+
+		for (;;) {
+			Op op = (Op) program.code[i].op;
+			if (depth < op_pops[op]) {
+				message = "stack underflow";
+				break;
+			}
+			depth += op_pushes[op] - op_pops[op];
+			if (depth > INTERPRETER_STACK_SIZE) {
+				message = "stack overflow";
+				break;
+			}
+			i += 1 + op_operands[op];
+		}
+
+		interpreter.error.message = message;
+		interpreter.error.offset = program.offsets[i];
+		ret = -1;
+		goto done;
+	}
+
+roverflow:
+	message = "return stack overflow";
+	goto error;
+
+error:
+	// `ip` is somewhere past the start of the instruction that failed, but
+	// never past its last operand, which has the same offset.
+	interpreter.error.message = message;
+	interpreter.error.offset = slot_offset(program, ip - 1);
+	ret = -1;
+
+done:
+	*sp = tos;
+	interpreter.depth = sp - base;
+	return ret;
+}
+
+int interpreter_run(Interpreter &interpreter, Program &program)
+{
+	if (interpreter.profile) {
+		return run<RUN_PROFILE>(interpreter, program);
+	} else if (interpreter.jit) {
+		return run<RUN_JIT>(interpreter, program);
+	}
+	return run<RUN_NORMAL>(interpreter, program);
+}
@@ -0,0 +1,305 @@
+/**
+ *
+ * interpreter.hpp - Compiling tokens into threaded code, and running it
+ *
+ * Copyright (c) 2022 Anamitra Ghorui
+ *
+ * LICENSE_HERE
+ *
+ */
+
+#ifndef BLINDFORTH_INTERPRETER_HPP
+#define BLINDFORTH_INTERPRETER_HPP
+
+#include <stdio.h>
+#include <stdint.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "symbol.hpp"
+#include "tokenizer.hpp"
+
+/**md
+ *
+ * ### The Instructions
+ *
+ * Every instruction of the interpreter is listed here once, along with the
+ * number of operands that follow it in the code, and the number of cells it
+ * pops off the data stack and then pushes back on. `INTERPRETER_OPS` is used to
+ * generate the `Op` enum, the tables of operand counts and stack effects, and
+ * the table of addresses the threaded interpreter jumps to, so that they can
+ * never get out of step with each other.
+ *
+ * `CHECK` is never compiled directly. It is put in front of blocks of code
+ * when the code is linked, see interpreter.cpp. Neither are the instructions
+ * after it, which are ''superinstructions'': each does the work of a common
+ * sequence of two or three instructions, which linking replaces them with.
+ * Their operands are those of the instructions they replace, in order.
+ * `CALL_NATIVE` calls a word that has been compiled into machine code, see
+ * jit.hpp.
+ *
+ */
+
+#define INTERPRETER_OPS(X)       \
+	X(HALT,        0, 0, 0)  \
+	X(LIT,         1, 0, 1)  \
+	X(CALL,        1, 0, 0)  \
+	X(EXIT,        0, 0, 0)  \
+	X(JUMP,        1, 0, 0)  \
+	X(JZ,          1, 1, 0)  \
+	X(DO,          0, 2, 0)  \
+	X(LOOP,        1, 0, 0)  \
+	X(UNLOOP,      0, 0, 0)  \
+	X(I,           0, 0, 1)  \
+	X(J,           0, 0, 1)  \
+	X(ADD,         0, 2, 1)  \
+	X(SUB,         0, 2, 1)  \
+	X(MUL,         0, 2, 1)  \
+	X(DIV,         0, 2, 1)  \
+	X(MOD,         0, 2, 1)  \
+	X(NEGATE,      0, 1, 1)  \
+	X(ABS,         0, 1, 1)  \
+	X(MIN,         0, 2, 1)  \
+	X(MAX,         0, 2, 1)  \
+	X(EQ,          0, 2, 1)  \
+	X(NE,          0, 2, 1)  \
+	X(LT,          0, 2, 1)  \
+	X(GT,          0, 2, 1)  \
+	X(LE,          0, 2, 1)  \
+	X(GE,          0, 2, 1)  \
+	X(AND,         0, 2, 1)  \
+	X(OR,          0, 2, 1)  \
+	X(XOR,         0, 2, 1)  \
+	X(INVERT,      0, 1, 1)  \
+	X(DUP,         0, 1, 2)  \
+	X(DROP,        0, 1, 0)  \
+	X(SWAP,        0, 2, 2)  \
+	X(OVER,        0, 2, 3)  \
+	X(ROT,         0, 3, 3)  \
+	X(NIP,         0, 2, 1)  \
+	X(TUCK,        0, 2, 3)  \
+	X(FADD,        0, 2, 1)  \
+	X(FSUB,        0, 2, 1)  \
+	X(FMUL,        0, 2, 1)  \
+	X(FDIV,        0, 2, 1)  \
+	X(TO_REAL,     0, 1, 1)  \
+	X(TO_INT,      0, 1, 1)  \
+	X(PRINT,       0, 1, 0)  \
+	X(FPRINT,      0, 1, 0)  \
+	X(EMIT,        0, 1, 0)  \
+	X(CR,          0, 0, 0)  \
+	X(TYPE,        0, 1, 0)  \
+	X(STACK_TRACE, 0, 0, 0)  \
+	X(BREAK,       0, 0, 0)  \
+	X(CHECK,       1, 0, 0)  \
+	X(LIT_ADD,     1, 1, 1)  \
+	X(LIT_SUB,     1, 1, 1)  \
+	X(LIT_MUL,     1, 1, 1)  \
+	X(LIT_EQ,      1, 1, 1)  \
+	X(LIT_LT,      1, 1, 1)  \
+	X(LIT_GT,      1, 1, 1)  \
+	X(DUP_MUL,     0, 1, 1)  \
+	X(OVER_OVER,   0, 2, 4)  \
+	X(I_ADD,       0, 1, 1)  \
+	X(EQ_JZ,       1, 2, 0)  \
+	X(LT_JZ,       1, 2, 0)  \
+	X(GT_JZ,       1, 2, 0)  \
+	X(LIT_EQ_JZ,   2, 1, 0)  \
+	X(LIT_LT_JZ,   2, 1, 0)  \
+	X(LIT_GT_JZ,   2, 1, 0)  \
+	X(CALL_NATIVE, 1, 0, 0)
+
+#define INTERPRETER_OP_ENUM(name, operands, pops, pushes) OP_##name,
+
+typedef enum Op {
+	INTERPRETER_OPS(INTERPRETER_OP_ENUM)
+	OP_SIZE // This simply marks the number of enum values
+} Op;
+
+#define INTERPRETER_OP_OPERANDS(name, operands, pops, pushes) operands,
+
+static const uint8_t op_operands[OP_SIZE] = {
+	INTERPRETER_OPS(INTERPRETER_OP_OPERANDS)
+};
+
+/**md
+ *
+ * ### `union Slot`
+ *
+ * The code is an array of `Slot`s. A slot either holds an instruction, or one
+ * of its operands. Jumps and calls hold the index of the slot they go to.
+ *
+ * Before the code is run, it is copied and ''linked'': each instruction is
+ * replaced with the address of the code that carries it out (or kept as an
+ * `Op` if the compiler doesn't support that, see interpreter.cpp), and the
+ * index in each jump and call with a pointer to the slot itself. `origins`
+ * holds the index in `code` that each linked slot came from.
+ *
+ */
+
+typedef int64_t Cell;
+
+// A cell holds the same as the data of a token, without the type.
+static_assert(sizeof(Cell) == sizeof(TokenData), "a cell must be the size of TokenData");
+
+typedef union Slot {
+	Cell i;
+	double r;
+	const void *p;
+	intptr_t op;
+} Slot;
+
+/**md
+ *
+ * ### `struct Program`
+ *
+ * A `Program` is everything that has been compiled so far. Compiling more
+ * tokens into it adds to it, so that a word defined by one input can be used by
+ * the next, like in a REPL. `entry` is where the code compiled last starts.
+ *
+ * Words are kept in a symbol table, and `definitions` holds the address of the
+ * code of each word, indexed by its symbol id, or -1 if it is not defined.
+ *
+ * The tokens of a `TokenResult` don't have to outlive the program: string
+ * literals are copied into `strings`.
+ *
+ */
+
+typedef struct Program {
+	std::vector<Slot> code;
+	std::vector<unsigned int> offsets; // Offset of the token each slot came from
+	size_t entry;
+
+	SymbolTable words;
+	std::vector<int64_t> definitions;
+	std::deque<std::string> strings;
+
+	std::vector<Slot> linked;          // Empty until the code is first run
+	std::vector<unsigned int> origins;
+	std::vector<uint8_t> linked_ops;   // The Op of each slot of `linked`, or OP_SIZE
+	size_t linked_entry;               // Where `entry` ended up in `linked`
+	int linked_mode;                   // How `linked` was linked, see interpreter.cpp
+
+	std::vector<uint32_t> calls;       // Calls to each slot of `linked`, see jit.hpp
+	std::vector<struct JitWord *> jit_words;
+
+	Program() {
+		entry = 0;
+		linked_entry = 0;
+		linked_mode = -1;
+	}
+	~Program();
+
+	Program(const Program &) = delete;
+	Program &operator=(const Program &) = delete;
+} Program;
+
+typedef struct InterpreterError {
+	const char *message;
+	unsigned int offset; // Offset of the token where it happened
+} InterpreterError;
+
+/**md
+ *
+ * ### `struct InterpreterProfile`
+ *
+ * Which superinstructions are worth having depends on which sequences of
+ * instructions programs actually run most. If an interpreter is given an
+ * `InterpreterProfile`, it counts how often each instruction is run, and how
+ * often each pair and triple of instructions that follow each other in the
+ * code is run in a row. Superinstructions are not used while profiling, so
+ * that the counts are of the instructions as they were compiled.
+ *
+ * It also counts how often each word is called, since the words a program
+ * spends its time in are usually the first thing to look at.
+ *
+ * `interpreter_profile_dump` prints the most frequent of each.
+ * `interpreter_profile_write` writes all of them, but the triples, in a
+ * format for other programs to read (see `CounterWriter` in util.hpp).
+ *
+ */
+
+typedef struct InterpreterProfile {
+	std::vector<uint64_t> singles; // Indexed by Op
+	std::vector<uint64_t> pairs;   // Indexed by (first * OP_SIZE + second)
+	std::vector<uint64_t> triples; // Likewise, for three
+	std::vector<uint64_t> words;   // Indexed by where in `code` the word starts
+
+	size_t next;                   // Index in `code` after the last one counted
+	int last[2];                   // The last two instructions counted
+	int chain;                     // How many of them led up to `next`
+
+	InterpreterProfile()
+		: singles(OP_SIZE), pairs(OP_SIZE * OP_SIZE), triples(OP_SIZE * OP_SIZE * OP_SIZE) {
+		next = SIZE_MAX;
+		last[0] = last[1] = 0;
+		chain = 0;
+	}
+} InterpreterProfile;
+
+void interpreter_profile_dump(const InterpreterProfile &profile, const Program &program, FILE *f);
+void interpreter_profile_write(const InterpreterProfile &profile, const Program &program,
+                               CounterWriter &writer);
+
+/**md
+ *
+ * ### `struct Interpreter`
+ *
+ * An `Interpreter` holds the two stacks the code runs on. What's left on the
+ * data stack after a run stays there for the next one. `stack[0]` is never
+ * used; the reason for that is explained along with `interpreter_run`.
+ *
+ * The stacks never grow, so they are allocated once, along with the
+ * interpreter, and a push never has to allocate anything. Both start at the
+ * start of a page, and where the system allows it, each is surrounded by pages
+ * that can't be read or written (guard pages). The interpreter makes sure that
+ * the stacks never over or underflow, but if it ever got that wrong, the
+ * program would crash right away, instead of scribbling over whatever happens
+ * to be next to the stacks.
+ *
+ */
+
+#define INTERPRETER_STACK_SIZE 1024
+#define INTERPRETER_RSTACK_SIZE 1024
+
+typedef struct Interpreter {
+	Cell *stack;               // INTERPRETER_STACK_SIZE + 1 cells
+	size_t depth;              // Number of cells on the data stack
+	Cell *rstack;              // Return addresses and loop counters
+	InterpreterError error;
+	InterpreterProfile *profile; // Counts what is run, if set
+	bool jit;                    // Whether hot words are compiled, see jit.hpp
+
+	void *memory;              // Where both stacks were allocated
+	size_t memory_size;
+
+	Interpreter();
+	~Interpreter();
+	Interpreter(const Interpreter &) = delete;
+	Interpreter &operator=(const Interpreter &) = delete;
+} Interpreter;
+
+/**md
+ *
+ * ### Functions
+ *
+ * `interpreter_compile` compiles the tokens in `tokens` into `program`. It
+ * returns a value less than 0 on an error, and leaves `program` as it was.
+ *
+ * `interpreter_run` runs the code compiled last. It returns 1 when the code is
+ * done, and a value less than 0 on an error. In both cases the error is
+ * described in `error`.
+ *
+ */
+
+int interpreter_compile(Program &program, const TokenResult &tokens, InterpreterError &error);
+int interpreter_run(Interpreter &interpreter, Program &program);
+
+// The cell `i` places from the top of the data stack.
+static inline Cell interpreter_peek(const Interpreter &interpreter, size_t i)
+{
+	return interpreter.stack[interpreter.depth - i];
+}
+
+#endif
@@ -0,0 +1,626 @@
+/**
+ *
+ * jit.cpp - Compiling hot words into machine code
+ *
+ * Copyright (c) 2022 Anamitra Ghorui
+ *
+ * LICENSE_HERE
+ *
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <initializer_list>
+#include <vector>
+
+#include "jit.hpp"
+
+#ifdef INTERPRETER_JIT
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+/**md
+ *
+ * The JIT
+ * =======
+ *
+ * However few instructions the interpreter runs, each of them still has to
+ * load the address of the next one and jump there, and the CPU can't do much of
+ * one instruction before it knows where the previous one is going. A word that
+ * is called over and over again, like the inner loop of a numeric job, is
+ * better off as real machine code, which can run straight through from one
+ * instruction to the next.
+ *
+ * So in this second tier, the interpreter counts the calls to each word (see
+ * `CALL` in interpreter.cpp), and once a word has been called `JIT_THRESHOLD`
+ * times, it is translated into x86-64 machine code. Every call to it is then
+ * turned into a `CALL_NATIVE`, which runs the machine code instead.
+ *
+ * The translation is as simple as it can be: each instruction of the linked
+ * code turns into a few machine instructions that do the same thing, in the
+ * same order. The stack pointer is kept in `rbx`, the top of the stack in
+ * `r12`, the return stack pointer in `r13`, and the base and limit of the stack
+ * in `r14` and `r15`, for the `CHECK`s. Since the state is the same as the
+ * interpreter's at every instruction (see jit.hpp), anything the machine code
+ * doesn't do itself is done by handing back to the interpreter at that
+ * instruction. This is called ''deoptimizing''. It happens at:
+ *
+ * * Calls to other words, and instructions that print. They are not worth
+ *   doing in machine code.
+ * * `:break` and `:stack_trace`. These always run in the interpreter, so that
+ *   debugging sees exactly what the interpreter would.
+ * * Anything that would fail: a `CHECK` that doesn't pass, a division that
+ *   would fault, and a `do` without room on the return stack. The interpreter
+ *   then runs the same instruction again, and reports the error just like it
+ *   would have without the JIT.
+ *
+ * After deoptimizing, the interpreter runs the rest of that call to the word.
+ * The next call starts in the machine code again.
+ *
+ * The code is written into memory that is writable but not executable, and
+ * only made executable, and no longer writable, once it's complete.
+ *
+ */
+
+#ifdef INTERPRETER_JIT
+
+static_assert(offsetof(JitState, sp) == 0, "JitState layout");
+static_assert(offsetof(JitState, tos) == 8, "JitState layout");
+static_assert(offsetof(JitState, rsp) == 16, "JitState layout");
+static_assert(offsetof(JitState, base) == 24, "JitState layout");
+static_assert(offsetof(JitState, limit) == 32, "JitState layout");
+static_assert(offsetof(JitState, rlimit) == 40, "JitState layout");
+
+#define JIT_NONE SIZE_MAX
+
+typedef struct Emitter {
+	std::vector<uint8_t> code;
+	std::vector<std::pair<size_t, size_t>> jumps;  // rel32 to fill in, and the slot it goes to
+	std::vector<std::pair<size_t, size_t>> exits;  // rel32 to fill in, and the slot to go on from
+	std::vector<size_t> epilogue;                  // rel32s that go to the epilogue
+} Emitter;
+
+static inline void put(Emitter &e, std::initializer_list<uint8_t> bytes)
+{
+	e.code.insert(e.code.end(), bytes.begin(), bytes.end());
+}
+
+static inline void put32(Emitter &e, uint32_t value)
+{
+	for (int i = 0; i < 4; i++) {
+		e.code.push_back((value >> (8 * i)) & 0xff);
+	}
+}
+
+static inline void put64(Emitter &e, uint64_t value)
+{
+	for (int i = 0; i < 8; i++) {
+		e.code.push_back((value >> (8 * i)) & 0xff);
+	}
+}
+
+static inline void patch32(Emitter &e, size_t at, size_t target)
+{
+	uint32_t rel = (uint32_t) (target - (at + 4));
+	memcpy(e.code.data() + at, &rel, 4);
+}
+
+// A jump (`jmp`, or `jcc` if `cc` isn't 0) to the slot `target`.
+static void jump(Emitter &e, uint8_t cc, size_t target)
+{
+	if (cc) {
+		put(e, { 0x0f, cc });
+	} else {
+		put(e, { 0xe9 });
+	}
+	e.jumps.push_back(std::make_pair(e.code.size(), target));
+	put32(e, 0);
+}
+
+// A jump that deoptimizes, going on from the slot `resume`.
+static void exit_if(Emitter &e, uint8_t cc, size_t resume)
+{
+	put(e, { 0x0f, cc });
+	e.exits.push_back(std::make_pair(e.code.size(), resume));
+	put32(e, 0);
+}
+
+// Returns to the interpreter, which goes on from `slot`.
+static void exit_to(Emitter &e, const Slot *slot)
+{
+	put(e, { 0x48, 0xb8 });               // mov rax, slot
+	put64(e, (uint64_t) (uintptr_t) slot);
+	put(e, { 0xe9 });                     // jmp epilogue
+	e.epilogue.push_back(e.code.size());
+	put32(e, 0);
+}
+
+#define JCC_JE  0x84
+#define JCC_JNE 0x85
+#define JCC_JA  0x87
+#define JCC_JL  0x8c
+#define JCC_JGE 0x8d
+#define JCC_JLE 0x8e
+
+static inline void push_tos(Emitter &e)
+{
+	put(e, { 0x4c, 0x89, 0x23 });         // mov [rbx], r12
+	put(e, { 0x48, 0x83, 0xc3, 0x08 });   // add rbx, 8
+}
+
+static inline void pop_tos(Emitter &e)
+{
+	put(e, { 0x48, 0x83, 0xeb, 0x08 });   // sub rbx, 8
+	put(e, { 0x4c, 0x8b, 0x23 });         // mov r12, [rbx]
+}
+
+// ( a b -- flag ) with the flag set from `setcc`, which is 0x9? for the
+// matching `jcc`'s 0x8?.
+static void compare(Emitter &e, uint8_t jcc)
+{
+	put(e, { 0x48, 0x83, 0xeb, 0x08 });   // sub rbx, 8
+	put(e, { 0x48, 0x8b, 0x03 });         // mov rax, [rbx]
+	put(e, { 0x4c, 0x39, 0xe0 });         // cmp rax, r12
+	put(e, { 0x0f, (uint8_t) (jcc + 0x10), 0xc0 }); // setcc al
+	put(e, { 0x0f, 0xb6, 0xc0 });         // movzx eax, al
+	put(e, { 0x48, 0xf7, 0xd8 });         // neg rax
+	put(e, { 0x49, 0x89, 0xc4 });         // mov r12, rax
+}
+
+// ( n -- flag ) compared against the operand.
+static void compare_lit(Emitter &e, uint8_t jcc, Cell value)
+{
+	put(e, { 0x48, 0xb8 });               // mov rax, value
+	put64(e, value);
+	put(e, { 0x49, 0x39, 0xc4 });         // cmp r12, rax
+	put(e, { 0x0f, (uint8_t) (jcc + 0x10), 0xc0 }); // setcc al
+	put(e, { 0x0f, 0xb6, 0xc0 });         // movzx eax, al
+	put(e, { 0x48, 0xf7, 0xd8 });         // neg rax
+	put(e, { 0x49, 0x89, 0xc4 });         // mov r12, rax
+}
+
+// ( a b -- ) and jump to `target` unless the comparison holds. `jcc` is the
+// jump for when it doesn't.
+static void compare_jump(Emitter &e, uint8_t jcc, size_t target)
+{
+	put(e, { 0x48, 0x8b, 0x43, 0xf8 });   // mov rax, [rbx - 8]
+	put(e, { 0x4c, 0x39, 0xe0 });         // cmp rax, r12
+	put(e, { 0x4c, 0x8b, 0x63, 0xf0 });   // mov r12, [rbx - 16]
+	put(e, { 0x48, 0x8d, 0x5b, 0xf0 });   // lea rbx, [rbx - 16]
+	jump(e, jcc, target);
+}
+
+// ( n -- ) compared against the operand, likewise.
+static void compare_lit_jump(Emitter &e, uint8_t jcc, Cell value, size_t target)
+{
+	put(e, { 0x48, 0xb8 });               // mov rax, value
+	put64(e, value);
+	put(e, { 0x49, 0x39, 0xc4 });         // cmp r12, rax
+	put(e, { 0x4c, 0x8b, 0x63, 0xf8 });   // mov r12, [rbx - 8]
+	put(e, { 0x48, 0x8d, 0x5b, 0xf8 });   // lea rbx, [rbx - 8]
+	jump(e, jcc, target);
+}
+
+// ( a b -- c ) for reals, with `op` being the second byte of the SSE2
+// instruction.
+static void real_op(Emitter &e, uint8_t op)
+{
+	put(e, { 0xf3, 0x0f, 0x7e, 0x43, 0xf8 });       // movq xmm0, [rbx - 8]
+	put(e, { 0x66, 0x49, 0x0f, 0x6e, 0xcc });       // movq xmm1, r12
+	put(e, { 0xf2, 0x0f, op, 0xc1 });               // op xmm0, xmm1
+	put(e, { 0x66, 0x49, 0x0f, 0x7e, 0xc4 });       // movq r12, xmm0
+	put(e, { 0x48, 0x8d, 0x5b, 0xf8 });             // lea rbx, [rbx - 8]
+}
+
+// Division, leaving the quotient in rax and the remainder in rdx. Deoptimizes
+// for anything that would fault: division by zero, and INT64_MIN / -1. The
+// interpreter runs the instruction again and reports which of the two it was.
+static void divide(Emitter &e, size_t at)
+{
+	put(e, { 0x48, 0x8b, 0x43, 0xf8 });   // mov rax, [rbx - 8]
+	put(e, { 0x4d, 0x85, 0xe4 });         // test r12, r12
+	exit_if(e, JCC_JE, at);               // Division by zero
+	put(e, { 0x49, 0x83, 0xfc, 0xff });   // cmp r12, -1
+	put(e, { 0x75, 0x13 });               // jne over the next three
+	put(e, { 0x48, 0xb9 });               // mov rcx, INT64_MIN
+	put64(e, (uint64_t) INT64_MIN);
+	put(e, { 0x48, 0x39, 0xc8 });         // cmp rax, rcx
+	exit_if(e, JCC_JE, at);               // Division overflow
+	put(e, { 0x48, 0x99 });               // cqo
+	put(e, { 0x49, 0xf7, 0xfc });         // idiv r12
+	put(e, { 0x48, 0x8d, 0x5b, 0xf8 });   // lea rbx, [rbx - 8]
+}
+
+static inline bool is_jump(Op op)
+{
+	return op == OP_JUMP || op == OP_JZ || op == OP_LOOP || op == OP_EQ_JZ ||
+	       op == OP_LT_JZ || op == OP_GT_JZ || op == OP_LIT_EQ_JZ ||
+	       op == OP_LIT_LT_JZ || op == OP_LIT_GT_JZ;
+}
+
+// Whether the machine code does `op` itself, rather than deoptimizing.
+static inline bool is_native(Op op)
+{
+	switch (op) {
+	case OP_HALT: case OP_CALL: case OP_CALL_NATIVE: case OP_TO_INT:
+	case OP_PRINT: case OP_FPRINT: case OP_EMIT: case OP_CR: case OP_TYPE:
+	case OP_STACK_TRACE: case OP_BREAK:
+		return false;
+	default:
+		return true;
+	}
+}
+
+// The slot that a jump at `at` goes to.
+static inline size_t jump_target(const Program &program, size_t at)
+{
+	Op op = (Op) program.linked_ops[at];
+	size_t operand = (op >= OP_LIT_EQ_JZ && op <= OP_LIT_GT_JZ) ? 2 : 1;
+	return (const Slot *) program.linked[at + operand].p - program.linked.data();
+}
+
+// Every instruction that can be reached from `entry` without leaving the
+// machine code, in the order they are in the code.
+static std::vector<size_t> reachable(const Program &program, size_t entry)
+{
+	std::vector<bool> seen(program.linked.size(), false);
+	std::vector<size_t> todo(1, entry);
+	std::vector<size_t> found;
+
+	while (!todo.empty()) {
+		size_t at = todo.back();
+		todo.pop_back();
+		if (seen[at]) {
+			continue;
+		}
+		seen[at] = true;
+		found.push_back(at);
+
+		Op op = (Op) program.linked_ops[at];
+		if (!is_native(op) || op == OP_EXIT) {
+			continue;
+		}
+		if (is_jump(op)) {
+			todo.push_back(jump_target(program, at));
+		}
+		if (op != OP_JUMP) {
+			todo.push_back(at + 1 + op_operands[op]);
+		}
+	}
+
+	std::sort(found.begin(), found.end());
+	return found;
+}
+
+static void emit_instruction(Emitter &e, const Program &program, size_t at)
+{
+	const Slot *slot = program.linked.data() + at;
+	Op op = (Op) program.linked_ops[at];
+	Cell operand = (op_operands[op] > 0) ? slot[1].i : 0;
+
+	switch (op) {
+	case OP_LIT:
+		push_tos(e);
+		put(e, { 0x49, 0xbc });                 // mov r12, operand
+		put64(e, operand);
+		break;
+
+	case OP_EXIT:
+		put(e, { 0x49, 0x8b, 0x45, 0xf8 });     // mov rax, [r13 - 8]
+		put(e, { 0x49, 0x83, 0xed, 0x08 });     // sub r13, 8
+		put(e, { 0xe9 });                       // jmp epilogue
+		e.epilogue.push_back(e.code.size());
+		put32(e, 0);
+		break;
+
+	case OP_JUMP:
+		jump(e, 0, jump_target(program, at));
+		break;
+
+	case OP_JZ:
+		put(e, { 0x4d, 0x85, 0xe4 });           // test r12, r12
+		put(e, { 0x4c, 0x8b, 0x63, 0xf8 });     // mov r12, [rbx - 8]
+		put(e, { 0x48, 0x8d, 0x5b, 0xf8 });     // lea rbx, [rbx - 8]
+		jump(e, JCC_JE, jump_target(program, at));
+		break;
+
+	case OP_DO:
+		put(e, { 0x48, 0x8b, 0x0c, 0x24 });     // mov rcx, [rsp] (the JitState)
+		put(e, { 0x49, 0x8d, 0x45, 0x10 });     // lea rax, [r13 + 16]
+		put(e, { 0x48, 0x3b, 0x41, 0x28 });     // cmp rax, [rcx + rlimit]
+		exit_if(e, JCC_JA, at);
+		put(e, { 0x48, 0x8b, 0x43, 0xf8 });     // mov rax, [rbx - 8]
+		put(e, { 0x49, 0x89, 0x45, 0x00 });     // mov [r13], rax
+		put(e, { 0x4d, 0x89, 0x65, 0x08 });     // mov [r13 + 8], r12
+		put(e, { 0x49, 0x83, 0xc5, 0x10 });     // add r13, 16
+		put(e, { 0x48, 0x83, 0xeb, 0x10 });     // sub rbx, 16
+		put(e, { 0x4c, 0x8b, 0x23 });           // mov r12, [rbx]
+		break;
+
+	case OP_LOOP:
+		put(e, { 0x49, 0xff, 0x45, 0xf8 });     // inc qword [r13 - 8]
+		put(e, { 0x49, 0x8b, 0x45, 0xf8 });     // mov rax, [r13 - 8]
+		put(e, { 0x49, 0x3b, 0x45, 0xf0 });     // cmp rax, [r13 - 16]
+		jump(e, JCC_JL, jump_target(program, at));
+		put(e, { 0x49, 0x83, 0xed, 0x10 });     // sub r13, 16
+		break;
+
+	case OP_UNLOOP:
+		put(e, { 0x49, 0x83, 0xed, 0x10 });     // sub r13, 16
+		break;
+
+	case OP_I:
+	case OP_J:
+		push_tos(e);
+		put(e, { 0x4d, 0x8b, 0x65, (uint8_t) ((op == OP_I) ? 0xf8 : 0xe8) }); // mov r12, [r13 - 8 or 24]
+		break;
+
+	case OP_ADD:
+		put(e, { 0x48, 0x83, 0xeb, 0x08 });     // sub rbx, 8
+		put(e, { 0x4c, 0x03, 0x23 });           // add r12, [rbx]
+		break;
+
+	case OP_SUB:
+		put(e, { 0x48, 0x83, 0xeb, 0x08 });     // sub rbx, 8
+		put(e, { 0x48, 0x8b, 0x03 });           // mov rax, [rbx]
+		put(e, { 0x4c, 0x29, 0xe0 });           // sub rax, r12
+		put(e, { 0x49, 0x89, 0xc4 });           // mov r12, rax
+		break;
+
+	case OP_MUL:
+		put(e, { 0x48, 0x83, 0xeb, 0x08 });     // sub rbx, 8
+		put(e, { 0x4c, 0x0f, 0xaf, 0x23 });     // imul r12, [rbx]
+		break;
+
+	case OP_DIV:
+		divide(e, at);
+		put(e, { 0x49, 0x89, 0xc4 });           // mov r12, rax
+		break;
+
+	case OP_MOD:
+		divide(e, at);
+		put(e, { 0x49, 0x89, 0xd4 });           // mov r12, rdx
+		break;
+
+	case OP_NEGATE:
+		put(e, { 0x49, 0xf7, 0xdc });           // neg r12
+		break;
+
+	case OP_ABS:
+		put(e, { 0x4c, 0x89, 0xe0 });           // mov rax, r12
+		put(e, { 0x48, 0xf7, 0xd8 });           // neg rax
+		put(e, { 0x4c, 0x0f, 0x49, 0xe0 });     // cmovns r12, rax
+		break;
+
+	case OP_MIN:
+	case OP_MAX:
+		put(e, { 0x48, 0x8b, 0x43, 0xf8 });     // mov rax, [rbx - 8]
+		put(e, { 0x48, 0x8d, 0x5b, 0xf8 });     // lea rbx, [rbx - 8]
+		put(e, { 0x4c, 0x39, 0xe0 });           // cmp rax, r12
+		put(e, { 0x4c, 0x0f, (uint8_t) ((op == OP_MIN) ? 0x4c : 0x4f), 0xe0 }); // cmovl/g r12, rax
+		break;
+
+	case OP_EQ: compare(e, JCC_JE); break;
+	case OP_NE: compare(e, JCC_JNE); break;
+	case OP_LT: compare(e, JCC_JL); break;
+	case OP_GT: compare(e, 0x8f); break;
+	case OP_LE: compare(e, JCC_JLE); break;
+	case OP_GE: compare(e, JCC_JGE); break;
+
+	case OP_AND:
+	case OP_OR:
+	case OP_XOR:
+		put(e, { 0x48, 0x83, 0xeb, 0x08 });     // sub rbx, 8
+		put(e, { 0x4c, (uint8_t) ((op == OP_AND) ? 0x23 : (op == OP_OR) ? 0x0b : 0x33), 0x23 });
+		break;
+
+	case OP_INVERT:
+		put(e, { 0x49, 0xf7, 0xd4 });           // not r12
+		break;
+
+	case OP_DUP:
+		push_tos(e);
+		break;
+
+	case OP_DROP:
+		pop_tos(e);
+		break;
+
+	case OP_SWAP:
+		put(e, { 0x48, 0x8b, 0x43, 0xf8 });     // mov rax, [rbx - 8]
+		put(e, { 0x4c, 0x89, 0x63, 0xf8 });     // mov [rbx - 8], r12
+		put(e, { 0x49, 0x89, 0xc4 });           // mov r12, rax
+		break;
+
+	case OP_OVER:
+		put(e, { 0x48, 0x8b, 0x43, 0xf8 });     // mov rax, [rbx - 8]
+		push_tos(e);
+		put(e, { 0x49, 0x89, 0xc4 });           // mov r12, rax
+		break;
+
+	case OP_ROT:
+		put(e, { 0x48, 0x8b, 0x43, 0xf0 });     // mov rax, [rbx - 16]
+		put(e, { 0x48, 0x8b, 0x4b, 0xf8 });     // mov rcx, [rbx - 8]
+		put(e, { 0x48, 0x89, 0x4b, 0xf0 });     // mov [rbx - 16], rcx
+		put(e, { 0x4c, 0x89, 0x63, 0xf8 });     // mov [rbx - 8], r12
+		put(e, { 0x49, 0x89, 0xc4 });           // mov r12, rax
+		break;
+
+	case OP_NIP:
+		put(e, { 0x48, 0x83, 0xeb, 0x08 });     // sub rbx, 8
+		break;
+
+	case OP_TUCK:
+		put(e, { 0x48, 0x8b, 0x43, 0xf8 });     // mov rax, [rbx - 8]
+		put(e, { 0x4c, 0x89, 0x63, 0xf8 });     // mov [rbx - 8], r12
+		put(e, { 0x48, 0x89, 0x03 });           // mov [rbx], rax
+		put(e, { 0x48, 0x83, 0xc3, 0x08 });     // add rbx, 8
+		break;
+
+	case OP_FADD: real_op(e, 0x58); break;
+	case OP_FSUB: real_op(e, 0x5c); break;
+	case OP_FMUL: real_op(e, 0x59); break;
+	case OP_FDIV: real_op(e, 0x5e); break;
+
+	case OP_TO_REAL:
+		put(e, { 0xf2, 0x49, 0x0f, 0x2a, 0xc4 });     // cvtsi2sd xmm0, r12
+		put(e, { 0x66, 0x49, 0x0f, 0x7e, 0xc4 });     // movq r12, xmm0
+		break;
+
+	case OP_CHECK:
+		put(e, { 0x48, 0x89, 0xd8 });           // mov rax, rbx
+		put(e, { 0x4c, 0x29, 0xf0 });           // sub rax, r14
+		put(e, { 0x48, 0x3d });                 // cmp rax, need
+		put32(e, (uint32_t) ((operand & 0xffffffff) * sizeof(Cell)));
+		exit_if(e, JCC_JL, at);
+		put(e, { 0x4c, 0x89, 0xf8 });           // mov rax, r15
+		put(e, { 0x48, 0x29, 0xd8 });           // sub rax, rbx
+		put(e, { 0x48, 0x3d });                 // cmp rax, room
+		put32(e, (uint32_t) ((operand >> 32) * sizeof(Cell)));
+		exit_if(e, JCC_JL, at);
+		break;
+
+	case OP_LIT_ADD:
+	case OP_LIT_SUB:
+	case OP_LIT_MUL:
+		put(e, { 0x48, 0xb8 });                 // mov rax, operand
+		put64(e, operand);
+		if (op == OP_LIT_ADD) {
+			put(e, { 0x49, 0x01, 0xc4 });       // add r12, rax
+		} else if (op == OP_LIT_SUB) {
+			put(e, { 0x49, 0x29, 0xc4 });       // sub r12, rax
+		} else {
+			put(e, { 0x4c, 0x0f, 0xaf, 0xe0 }); // imul r12, rax
+		}
+		break;
+
+	case OP_LIT_EQ: compare_lit(e, JCC_JE, operand); break;
+	case OP_LIT_LT: compare_lit(e, JCC_JL, operand); break;
+	case OP_LIT_GT: compare_lit(e, 0x8f, operand); break;
+
+	case OP_DUP_MUL:
+		put(e, { 0x4d, 0x0f, 0xaf, 0xe4 });     // imul r12, r12
+		break;
+
+	case OP_OVER_OVER:
+		put(e, { 0x48, 0x8b, 0x43, 0xf8 });     // mov rax, [rbx - 8]
+		put(e, { 0x4c, 0x89, 0x23 });           // mov [rbx], r12
+		put(e, { 0x48, 0x89, 0x43, 0x08 });     // mov [rbx + 8], rax
+		put(e, { 0x48, 0x83, 0xc3, 0x10 });     // add rbx, 16
+		break;
+
+	case OP_I_ADD:
+		put(e, { 0x4d, 0x03, 0x65, 0xf8 });     // add r12, [r13 - 8]
+		break;
+
+	case OP_EQ_JZ: compare_jump(e, JCC_JNE, jump_target(program, at)); break;
+	case OP_LT_JZ: compare_jump(e, JCC_JGE, jump_target(program, at)); break;
+	case OP_GT_JZ: compare_jump(e, JCC_JLE, jump_target(program, at)); break;
+
+	case OP_LIT_EQ_JZ: compare_lit_jump(e, JCC_JNE, operand, jump_target(program, at)); break;
+	case OP_LIT_LT_JZ: compare_lit_jump(e, JCC_JGE, operand, jump_target(program, at)); break;
+	case OP_LIT_GT_JZ: compare_lit_jump(e, JCC_JLE, operand, jump_target(program, at)); break;
+
+	default:
+		exit_to(e, slot);
+		break;
+	}
+}
+
+JitWord *jit_compile(const Program &program, size_t entry)
+{
+	// A word that would deoptimize right away isn't worth it.
+	if (!is_native((Op) program.linked_ops[entry])) {
+		return NULL;
+	}
+
+	std::vector<size_t> found = reachable(program, entry);
+	std::vector<size_t> native(program.linked.size(), JIT_NONE);
+	Emitter e;
+
+	put(e, { 0x53 });                       // push rbx
+	put(e, { 0x41, 0x54 });                 // push r12
+	put(e, { 0x41, 0x55 });                 // push r13
+	put(e, { 0x41, 0x56 });                 // push r14
+	put(e, { 0x41, 0x57 });                 // push r15
+	put(e, { 0x57 });                       // push rdi
+	put(e, { 0x48, 0x8b, 0x1f });           // mov rbx, [rdi + sp]
+	put(e, { 0x4c, 0x8b, 0x67, 0x08 });     // mov r12, [rdi + tos]
+	put(e, { 0x4c, 0x8b, 0x6f, 0x10 });     // mov r13, [rdi + rsp]
+	put(e, { 0x4c, 0x8b, 0x77, 0x18 });     // mov r14, [rdi + base]
+	put(e, { 0x4c, 0x8b, 0x7f, 0x20 });     // mov r15, [rdi + limit]
+	if (found[0] != entry) {
+		jump(e, 0, entry);
+	}
+
+	// Falling through from one instruction to the next works, since
+	// whatever follows an instruction that falls through is reachable too.
+	for (size_t i = 0; i < found.size(); i++) {
+		native[found[i]] = e.code.size();
+		emit_instruction(e, program, found[i]);
+	}
+
+	for (size_t i = 0; i < e.exits.size(); i++) {
+		patch32(e, e.exits[i].first, e.code.size());
+		exit_to(e, program.linked.data() + e.exits[i].second);
+	}
+
+	size_t epilogue = e.code.size();
+	put(e, { 0x5f });                       // pop rdi
+	put(e, { 0x48, 0x89, 0x1f });           // mov [rdi + sp], rbx
+	put(e, { 0x4c, 0x89, 0x67, 0x08 });     // mov [rdi + tos], r12
+	put(e, { 0x4c, 0x89, 0x6f, 0x10 });     // mov [rdi + rsp], r13
+	put(e, { 0x41, 0x5f });                 // pop r15
+	put(e, { 0x41, 0x5e });                 // pop r14
+	put(e, { 0x41, 0x5d });                 // pop r13
+	put(e, { 0x41, 0x5c });                 // pop r12
+	put(e, { 0x5b });                       // pop rbx
+	put(e, { 0xc3 });                       // ret
+
+	for (size_t i = 0; i < e.jumps.size(); i++) {
+		patch32(e, e.jumps[i].first, native[e.jumps[i].second]);
+	}
+	for (size_t i = 0; i < e.epilogue.size(); i++) {
+		patch32(e, e.epilogue[i], epilogue);
+	}
+
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t size = (e.code.size() + page - 1) / page * page;
+	void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+	if (memory == MAP_FAILED) {
+		return NULL;
+	}
+	memcpy(memory, e.code.data(), e.code.size());
+	if (mprotect(memory, size, PROT_READ | PROT_EXEC) < 0) {
+		munmap(memory, size);
+		return NULL;
+	}
+
+	JitWord *word = new JitWord;
+	word->fn = (JitFn) memory;
+	word->memory = memory;
+	word->size = size;
+	return word;
+}
+
+void jit_free(JitWord *word)
+{
+	munmap(word->memory, word->size);
+	delete word;
+}
+
+#else
+
+JitWord *jit_compile(const Program &, size_t)
+{
+	return NULL;
+}
+
+void jit_free(JitWord *word)
+{
+	delete word;
+}
+
+#endif
@@ -0,0 +1,69 @@
+/**
+ *
+ * jit.hpp - Compiling hot words into machine code
+ *
+ * Copyright (c) 2022 Anamitra Ghorui
+ *
+ * LICENSE_HERE
+ *
+ */
+
+#ifndef BLINDFORTH_JIT_HPP
+#define BLINDFORTH_JIT_HPP
+
+#include <stddef.h>
+
+#include "interpreter.hpp"
+
+/**md
+ *
+ * ### `struct JitState`
+ *
+ * The machine code of a word runs on the same stacks as the interpreter, laid
+ * out in the same way, and with the top of the stack kept apart from the rest
+ * just like `tos`. So at the start of every instruction, the state of the
+ * machine code is exactly what the state of the interpreter would have been
+ * there. This is what lets the machine code hand over to the interpreter at
+ * any instruction it doesn't know how to do, by simply telling it where to go
+ * on from.
+ *
+ * `JitState` is how the state goes back and forth between them. A `JitFn`
+ * returns the slot the interpreter should go on from, which is the return
+ * address of the word if it ran to its end.
+ *
+ * The JIT is only built for x86-64, on systems that have `mmap`, unless
+ * `BLINDFORTH_NO_JIT` is defined. Otherwise `jit_compile` always fails, and
+ * everything is left to the interpreter.
+ *
+ */
+
+#if (defined(__x86_64__) || defined(_M_X64)) && defined(__unix__) && !defined(BLINDFORTH_NO_JIT)
+#define INTERPRETER_JIT 1
+#endif
+
+// How many times a word is called before it is compiled.
+#define JIT_THRESHOLD 64
+
+typedef struct JitState {
+	Cell *sp;
+	Cell tos;
+	Cell *rsp;
+	Cell *base;   // Only read
+	Cell *limit;  // Only read
+	Cell *rlimit; // Only read
+} JitState;
+
+typedef const Slot *(*JitFn)(JitState *state);
+
+typedef struct JitWord {
+	JitFn fn;
+	void *memory;
+	size_t size;
+} JitWord;
+
+// Compiles the word whose code starts at `linked[entry]`. Returns NULL if it
+// can't be compiled.
+JitWord *jit_compile(const Program &program, size_t entry);
+void jit_free(JitWord *word);
+
+#endif
@@ -1,5 +1,272 @@
+/**
+ *
+ * main.cpp - Running a program from a file, or from standard input
+ *
+ * Copyright (c) 2022 Anamitra Ghorui
+ *
+ * LICENSE_HERE
+ *
+ * Usage:
+ *
+ *     blindforth [--profile[=FORMAT] | --jit] [--cache DIR] FILE    Runs FILE
+ *     blindforth [--profile[=FORMAT] | --jit]                      Reads and runs one line at a time
+ *     blindforth --graphviz [FILE]                                 Draws the tokenizer
+ *
+ * With --profile, the instructions and words run most often are printed to
+ * stderr at the end (see `InterpreterProfile`). FORMAT can be `json` or
+ * `prometheus`, to print all of the counts in that format instead. A build
+ * with BLINDFORTH_PROFILE also prints the counts of the tokenizer (see
+ * `TokenCounters`).
+ *
+ * With --jit, words that are called often are compiled into machine code (see
+ * jit.hpp). With --cache, the tokens of FILE are kept in an image in DIR, and
+ * used instead of tokenizing FILE again the next time it is run unchanged (see
+ * image.hpp).
+ *
+ * With --graphviz, the transition matrix of the tokenizer is printed as a
+ * Graphviz graph (see `tokenizer_graphviz`). A build with BLINDFORTH_PROFILE
+ * can tokenize FILE first, without running it, to show how often each edge
+ * was taken for it.
+ *
+ */
 
+#include <stdio.h>
+#include <string.h>
+
+#include "image.hpp"
+#include "interpreter.hpp"
+#include "source.hpp"
+#include "util.hpp"
+
+// The mode of `tokenize_views`.
+#define MAIN_MODE (TOKENIZE_DFA | TOKENIZE_SKIP | TOKENIZE_VIEWS)
+
+static void report(const char *input, size_t size, const char *what,
+                   const char *message, unsigned int offset)
+{
+	LineIndex index;
+	unsigned int line, col;
+
+	line_index_append(index, input, size);
+	line_index_finish(index);
+	line_index_resolve(index, offset, line, col);
+	printf("%s error at line %u, col %u: %s\n", what, line + 1, col, message);
+}
+
+// Offsets are stored as `unsigned int`, so larger inputs can't be tokenized.
+static bool too_large(size_t size)
+{
+	if (size > (size_t) UINT32_MAX) {
+		printf("Error: input of %zu bytes is too large.\n", size);
+		return true;
+	}
+	return false;
+}
+
+static void report_syntax(const TokenResult &result)
+{
+	printf("Syntax error at line %u, col %u: unexpected '%c'\n",
+	       result.error.line_pos + 1, result.error.col_pos, result.error.curr_input_val);
+}
+
+// Compiles and runs the tokens of `input`. Returns a value less than 0 on an
+// error.
+static int run_tokens(Interpreter &interpreter, Program &program,
+                      const TokenResult &result, const char *input, size_t size)
+{
+	InterpreterError error;
+
+	if (interpreter_compile(program, result, error) < 0) {
+		report(input, size, "Compile", error.message, error.offset);
+		return -1;
+	}
+
+	if (interpreter_run(interpreter, program) < 0) {
+		report(input, size, "Runtime", interpreter.error.message, interpreter.error.offset);
+		return -1;
+	}
 
-int main() {
 	return 0;
-}
\ No newline at end of file
+}
+
+// Tokenizes, compiles and runs `input`. Returns a value less than 0 on an error.
+static int run(Interpreter &interpreter, Program &program, char *input, size_t size)
+{
+	TokenResult result;
+
+	if (too_large(size)) {
+		return -1;
+	}
+
+	// Identifiers and strings are views into the input, which stays around
+	// until the program has been compiled. A file can be larger than the `int`
+	// that `tokenizer_feed` takes, which `tokenize_parallel` feeds in pieces.
+	if (tokenize_parallel(input, size, MAIN_MODE, 1, result) < 0) {
+		report_syntax(result);
+		return -1;
+	}
+
+	return run_tokens(interpreter, program, result, input, size);
+}
+
+// Like `run`, but takes the tokens from the image of `input` in `dir` if there
+// is one, and leaves one there if there isn't. An image that can't be written
+// only means that the next run has to tokenize `input` again.
+static int run_cached(Interpreter &interpreter, Program &program, char *input, size_t size,
+                      const char *dir)
+{
+	TokenResult result;
+	SymbolTable symbols;
+	Image image;
+
+	if (too_large(size)) {
+		return -1;
+	}
+
+	uint64_t hash = image_hash(input, size);
+	std::string path = image_path(dir, hash);
+
+	if (image_open(image, path.c_str(), hash, size) == 0) {
+		image_result(image, result, symbols);
+	} else {
+		result.symbols = &symbols;
+		if (tokenize_parallel(input, size, IMAGE_MODE, 1, result) < 0) {
+			report_syntax(result);
+			return -1;
+		}
+		image_write(path.c_str(), result, hash, size);
+	}
+
+	int ret = run_tokens(interpreter, program, result, input, size);
+	image_close(image);
+	return ret;
+}
+
+static void dump_profile(const InterpreterProfile &profile, const Program &program,
+                         const char *format, FILE *f)
+{
+	CounterWriter writer;
+
+	if (strcmp(format, "text") == 0) {
+		interpreter_profile_dump(profile, program, f);
+#ifdef BLINDFORTH_PROFILE
+		fprintf(f, "Tokenizer:\n");
+		counter_begin(writer, f, COUNTER_FORMAT_PROMETHEUS);
+		token_counters_write(writer);
+		counter_end(writer);
+#endif
+		return;
+	}
+
+	counter_begin(writer, f, (strcmp(format, "json") == 0) ?
+	                         COUNTER_FORMAT_JSON : COUNTER_FORMAT_PROMETHEUS);
+	interpreter_profile_write(profile, program, writer);
+#ifdef BLINDFORTH_PROFILE
+	token_counters_write(writer);
+#endif
+	counter_end(writer);
+}
+
+// Prints the graph of the tokenizer, with its edges counted over the tokens of
+// `path` if it isn't NULL.
+static int graph(const char *path)
+{
+	if (!path) {
+		tokenizer_graphviz(stdout, NULL);
+		return 0;
+	}
+
+#ifdef BLINDFORTH_PROFILE
+	SourceFile file;
+	TokenResult result;
+	uint64_t hits[TOKEN_STATE_SIZE][TOKEN_STATE_SIZE];
+
+	if (source_open(file, path) < 0) {
+		printf("Error: cannot read '%s'.\n", path);
+		return 1;
+	}
+
+	token_counters_reset();
+	int ret = tokenize_parallel(file.data, file.size, MAIN_MODE, 1, result);
+	source_close(file);
+	if (ret < 0) {
+		report_syntax(result);
+		return 1;
+	}
+
+	token_counters_edges(token_counters_get(), hits);
+	tokenizer_graphviz(stdout, hits);
+	return 0;
+#else
+	printf("Error: counting edges needs a build with BLINDFORTH_PROFILE.\n");
+	return 1;
+#endif
+}
+
+int main(int argc, char **argv)
+{
+	Interpreter interpreter;
+	Program program;
+	InterpreterProfile profile;
+	const char *cache = NULL;
+	const char *format = NULL;
+	int ret = 0;
+
+	if (argc > 1 && strcmp(argv[1], "--graphviz") == 0) {
+		return graph((argc > 2) ? argv[2] : NULL);
+	}
+
+	if (argc > 1 && strncmp(argv[1], "--profile", 9) == 0 &&
+	    (argv[1][9] == '\0' || argv[1][9] == '=')) {
+		interpreter.profile = &profile;
+		format = (argv[1][9] == '=') ? argv[1] + 10 : "text";
+		if (strcmp(format, "text") != 0 && strcmp(format, "json") != 0 &&
+		    strcmp(format, "prometheus") != 0) {
+			printf("Error: unknown profile format '%s'.\n", format);
+			return 1;
+		}
+		argc--;
+		argv++;
+	} else if (argc > 1 && strcmp(argv[1], "--jit") == 0) {
+		interpreter.jit = true;
+		argc--;
+		argv++;
+	}
+
+	if (argc > 2 && strcmp(argv[1], "--cache") == 0) {
+		cache = argv[2];
+		argc -= 2;
+		argv += 2;
+	}
+
+	if (argc > 1) {
+		SourceFile file;
+		if (source_open(file, argv[1]) < 0) {
+			printf("Error: cannot read '%s'.\n", argv[1]);
+			return 1;
+		}
+
+		if (cache) {
+			ret = run_cached(interpreter, program, file.data, file.size, cache);
+		} else {
+			ret = run(interpreter, program, file.data, file.size);
+		}
+		ret = (ret < 0) ? 1 : 0;
+		source_close(file);
+	} else {
+		char line[4096];
+		while (fgets(line, sizeof(line), stdin)) {
+			if (run(interpreter, program, line, strlen(line)) == 0) {
+				printf(" ok\n");
+			}
+			fflush(stdout);
+		}
+	}
+
+	if (interpreter.profile) {
+		fflush(stdout);
+		dump_profile(profile, program, format, stderr);
+	}
+
+	return ret;
+}
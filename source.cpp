@@ -0,0 +1,1112 @@
+/**
+ *
+ * source.cpp - Loading source files, and tokenizing them on several threads
+ *
+ * Copyright (c) 2022 Anamitra Ghorui
+ *
+ * LICENSE_HERE
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <errno.h>
+#include <thread>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define SOURCE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "source.hpp"
+#include "util.hpp"
+
+/**md
+ *
+ * Loading Source Files
+ * ====================
+ *
+ * The tokenizer wants its whole input in memory, as one block. The easiest way
+ * to get a file there is to ask the system to map it into memory. Nothing is
+ * actually read until the tokenizer touches each page of it, so we don't wait
+ * for the whole file before starting, and we don't need a second copy of
+ * it either.
+ *
+ * Not everything can be mapped (pipes, for instance), and not every system can
+ * map files. In those cases, we fall back to reading the file into an
+ * allocated block.
+ *
+ */
+
+static int source_read(SourceFile &file, FILE *f)
+{
+	size_t capacity = 0;
+	size_t size = 0;
+	char *data = NULL;
+
+	for (;;) {
+		if (size == capacity) {
+			capacity = capacity ? capacity * 2 : 65536;
+			char *grown = (char *) realloc(data, capacity);
+			if (!grown) {
+				free(data);
+				return -1;
+			}
+			data = grown;
+		}
+
+		size_t n = fread(data + size, 1, capacity - size, f);
+		if (n == 0) {
+			break;
+		}
+		size += n;
+	}
+
+	if (ferror(f)) {
+		free(data);
+		return -1;
+	}
+
+	file.data = data;
+	file.size = size;
+	file.mapped = false;
+	return 0;
+}
+
+int source_open(SourceFile &file, const char *path)
+{
+	file = SourceFile();
+
+#ifdef SOURCE_MMAP
+	int fd = open(path, O_RDONLY);
+	struct stat st;
+
+	if (fd < 0) {
+		return -1;
+	}
+
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+		if (st.st_size == 0) {
+			close(fd);
+			return 0;
+		}
+
+		void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data != MAP_FAILED) {
+			// All of it is going to be read, possibly by several threads at
+			// once, so the system may as well start reading it in.
+			madvise(data, st.st_size, MADV_WILLNEED);
+			close(fd);
+			file.data = (char *) data;
+			file.size = st.st_size;
+			file.mapped = true;
+			return 0;
+		}
+	}
+
+	FILE *f = fdopen(fd, "rb");
+	if (!f) {
+		int error = errno;
+		close(fd);
+		errno = error;
+		return -1;
+	}
+#else
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		return -1;
+	}
+#endif
+
+	int ret = source_read(file, f);
+	int error = errno;
+	fclose(f);
+	errno = error;
+	return ret;
+}
+
+void source_close(SourceFile &file)
+{
+#ifdef SOURCE_MMAP
+	if (file.mapped) {
+		munmap(file.data, file.size);
+		file = SourceFile();
+		return;
+	}
+#endif
+	free(file.data);
+	file = SourceFile();
+}
+
+/**md
+ *
+ * Reading While Tokenizing
+ * ========================
+ *
+ * Mapping a file lets the system read ahead of the tokenizer, but only as far
+ * as it guesses it should, and not at all for a pipe or a file that can't be
+ * mapped. A `SourceReader` does the reading ahead itself, on a thread of its
+ * own, into two blocks that take turns: while the tokenizer works on one, the
+ * thread fills the other. Each block belongs to one side at a time, handed
+ * over through its `full` flag, so the block itself is used without holding
+ * the lock.
+ *
+ */
+
+static void reader_run(SourceReader *reader)
+{
+	for (int i = 0;; i ^= 1) {
+		SourceBlock &block = reader->blocks[i];
+
+		{
+			std::unique_lock<std::mutex> lock(reader->mutex);
+			reader->cond.wait(lock, [&] { return !block.full || reader->stop; });
+			if (reader->stop) {
+				return;
+			}
+		}
+
+		size_t n = fread(block.data.data(), 1, block.data.size(), reader->f);
+		bool last = n < block.data.size();
+		int read_errno = errno;
+
+		std::lock_guard<std::mutex> lock(reader->mutex);
+		block.size = n;
+		block.last = last;
+		block.full = true;
+		block.error = (last && ferror(reader->f)) ? (read_errno ? read_errno : EIO) : 0;
+		reader->cond.notify_all();
+		if (last) {
+			return;
+		}
+	}
+}
+
+int source_reader_open(SourceReader &reader, const char *path, int mode, size_t block_size)
+{
+	assert(!(mode & TOKENIZE_VIEWS) && block_size > 0);
+
+	reader.f = fopen(path, "rb");
+	if (!reader.f) {
+		return -1;
+	}
+
+	reader.path = path;
+	reader.tokenizer = Tokenizer(mode);
+	reader.next = 0;
+	reader.failed = false;
+	reader.read_errno = 0;
+	reader.stop = false;
+	for (int i = 0; i < 2; i++) {
+		reader.blocks[i].data.resize(block_size);
+		reader.blocks[i].size = 0;
+		reader.blocks[i].full = false;
+		reader.blocks[i].last = false;
+		reader.blocks[i].error = 0;
+	}
+	reader.thread = std::thread(reader_run, &reader);
+	return 0;
+}
+
+int source_reader_next(SourceReader &reader, TokenResult &result)
+{
+	SourceBlock &block = reader.blocks[reader.next];
+
+	// A tokenizer that is done stays done, and nothing more is read for it.
+	if (reader.tokenizer.state == TOKEN_STATE_END) {
+		return 1;
+	} else if (reader.tokenizer.state == TOKEN_STATE_ERROR) {
+		return -1;
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(reader.mutex);
+		reader.cond.wait(lock, [&] { return block.full; });
+		// The block that failed stays full, so every later call ends up here too.
+		// `errno` belongs to the reading thread, so it is passed on. `failed` is
+		// only ever written here, so the caller can read it without the lock.
+		if (block.error) {
+			reader.failed = true;
+			reader.read_errno = block.error;
+			errno = block.error;
+			return -1;
+		}
+	}
+
+	int ret = tokenizer_feed(reader.tokenizer, block.data.data(), block.size, block.last, result);
+
+	std::lock_guard<std::mutex> lock(reader.mutex);
+	block.full = false;
+	reader.next ^= 1;
+	reader.cond.notify_all();
+	return ret;
+}
+
+void source_reader_close(SourceReader &reader)
+{
+	if (reader.thread.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(reader.mutex);
+			reader.stop = true;
+			reader.cond.notify_all();
+		}
+		reader.thread.join();
+	}
+	if (reader.f) {
+		fclose(reader.f);
+		reader.f = NULL;
+	}
+}
+
+/**md
+ *
+ * Handing Tokens to Another Thread
+ * ================================
+ *
+ * `head` and `tail` only ever count up, and are taken modulo the size of the
+ * ring to find a slot, so the queue holds `tail - head` tokens. The pushing
+ * side writes the tokens first and `tail` after them, with release ordering,
+ * so that a popper that reads `tail` with acquire ordering also sees the
+ * tokens. Popping does the same with `head`, which tells the pusher that the
+ * slots can be written again.
+ *
+ * Each side keeps the last value of the other side's end that it read, and
+ * only reads it again once that isn't enough. Most pushes and pops then touch
+ * only their own cache line.
+ *
+ * A side that has to wait spins for a little while, which is enough when the
+ * other thread is running on another core, and otherwise gives up the CPU.
+ *
+ */
+
+static inline void queue_wait(int &spins)
+{
+	if (++spins < 64) {
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_ia32_pause();
+#endif
+	} else {
+		std::this_thread::yield();
+	}
+}
+
+void token_queue_init(TokenQueue &queue, size_t capacity)
+{
+	size_t size = 1;
+	while (size < capacity) {
+		size *= 2;
+	}
+
+	queue.ring.assign(size, Token());
+	queue.status = 0;
+	queue.error = TokenError();
+	queue.head.store(0, std::memory_order_relaxed);
+	queue.tail.store(0, std::memory_order_relaxed);
+	queue.tail_seen = 0;
+	queue.head_seen = 0;
+	queue.finished.store(false, std::memory_order_relaxed);
+}
+
+void token_queue_push(TokenQueue &queue, const Token *tokens, size_t count)
+{
+	size_t size = queue.ring.size();
+	size_t mask = size - 1;
+	size_t tail = queue.tail.load(std::memory_order_relaxed);
+
+	while (count > 0) {
+		int spins = 0;
+		while (tail - queue.head_seen == size) {
+			queue_wait(spins);
+			queue.head_seen = queue.head.load(std::memory_order_acquire);
+		}
+
+		size_t n = size - (tail - queue.head_seen);
+		n = (n < count) ? n : count;
+		for (size_t i = 0; i < n; i++) {
+			queue.ring[(tail + i) & mask] = tokens[i];
+		}
+
+		tail += n;
+		tokens += n;
+		count -= n;
+		queue.tail.store(tail, std::memory_order_release);
+	}
+}
+
+void token_queue_finish(TokenQueue &queue, int status, const TokenError &error)
+{
+	queue.status = status;
+	queue.error = error;
+	queue.finished.store(true, std::memory_order_release);
+}
+
+size_t token_queue_pop(TokenQueue &queue, Token *tokens, size_t max)
+{
+	size_t mask = queue.ring.size() - 1;
+	size_t head = queue.head.load(std::memory_order_relaxed);
+	int spins = 0;
+
+	while (queue.tail_seen == head) {
+		// The queue is only empty for good if it was finished before the
+		// tail was read, since the last tokens are pushed before finishing.
+		bool finished = queue.finished.load(std::memory_order_acquire);
+		queue.tail_seen = queue.tail.load(std::memory_order_acquire);
+		if (queue.tail_seen != head) {
+			break;
+		} else if (finished) {
+			return 0;
+		}
+		queue_wait(spins);
+	}
+
+	size_t n = queue.tail_seen - head;
+	n = (n < max) ? n : max;
+	for (size_t i = 0; i < n; i++) {
+		tokens[i] = queue.ring[(head + i) & mask];
+	}
+
+	queue.head.store(head + n, std::memory_order_release);
+	return n;
+}
+
+int tokenize_queued(char *input, size_t size, int mode, TokenResult &result, TokenQueue &queue,
+                    size_t piece)
+{
+	assert(!(mode & (TOKENIZE_STREAM | TOKENIZE_INTERN)) && piece > 0);
+
+	Tokenizer tokenizer(mode);
+	size_t i = 0;
+	int ret;
+
+	do {
+		size_t n = (size - i < piece) ? size - i : piece;
+
+		ret = tokenizer_feed(tokenizer, input + i, n, i + n == size, result);
+		token_queue_push(queue, result.tokens.data(), result.tokens.size());
+		result.tokens.clear();
+		i += n;
+	} while (ret == 0 && i < size);
+
+	token_queue_finish(queue, ret, result.error);
+	return ret;
+}
+
+/**md
+ *
+ * Tokenizing in Parallel
+ * ======================
+ *
+ * The tokenizer reads its input one byte after another, and each byte depends
+ * on the state the previous one left it in, so there isn't much we can do to
+ * split up the work within a single run. What we can do is split the input
+ * itself into chunks, and give each chunk to a separate thread.
+ *
+ * For this to give the same result, each chunk has to start at a point where
+ * tokenizing the whole input in one go would have been in the `NONE` state.
+ * Looking at the transition matrix, every state except the string states
+ * (and `DOT`, which is an error anyway) goes to `NONE` on whitespace. So just
+ * after any whitespace byte that is not inside a string is a safe place to
+ * split the input.
+ *
+ * ### Finding the Strings
+ *
+ * Outside a string, a quote can only ever start a new string: in any state but
+ * `NONE`, it's an error. Inside a string, only the same kind of quote ends it.
+ * So we don't need the whole state machine to know which bytes are in strings,
+ * only a quick pass over the quotes:
+ *
+ * 1. Outside a string, find the next `"` and the next `'`. Whichever comes
+ *    first starts a string. Everything before it is outside.
+ * 2. Inside a string, find the next quote of the same kind. That ends it.
+ *
+ * Both of these use `util_string_span`, so most of the input is skipped 16 or
+ * 32 bytes at a time. The next quote of each kind is remembered until we get
+ * past it, so no part of the input is looked at more than three times.
+ *
+ * `util_string_span` also stops at the bytes the tokenizer treats as the end
+ * of the input. If there are any, the input is simply tokenized in one go, as
+ * a chunk after one of those would never have been read.
+ *
+ */
+
+static inline size_t find_quote(const char *s, size_t n, size_t pos, char quote)
+{
+	return pos + util_string_span(s + pos, n - pos, quote);
+}
+
+static inline bool is_space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+// Fills `splits` with the offsets at which each chunk starts, aiming for
+// `chunks` chunks of equal size. There may be fewer. Returns a value less than
+// 0 if the input should not be split at all.
+static int find_splits(const char *s, size_t n, size_t chunks, std::vector<size_t> &splits)
+{
+	size_t pos = 0;
+	size_t dq = find_quote(s, n, 0, '\"');
+	size_t sq = find_quote(s, n, 0, '\'');
+	size_t k = 1;
+
+	splits.push_back(0);
+
+	while (pos < n) {
+		if (dq < pos) {
+			dq = find_quote(s, n, pos, '\"');
+		}
+		if (sq < pos) {
+			sq = find_quote(s, n, pos, '\'');
+		}
+
+		// Everything from `pos` up to `quote` is outside of any string.
+		size_t quote = (dq < sq) ? dq : sq;
+
+		while (k < chunks) {
+			size_t at = n / chunks * k;
+			if (at >= quote) {
+				break;
+			}
+
+			if (at < pos) {
+				at = pos;
+			}
+			if (at < splits.back()) {
+				at = splits.back();
+			}
+			while (at < quote && !is_space(s[at])) {
+				at++;
+			}
+			if (at == quote) {
+				break; // Try again after the string.
+			}
+
+			splits.push_back(at + 1);
+			k++;
+		}
+
+		if (quote >= n) {
+			break;
+		}
+
+		char c = s[quote];
+		if (c != '\"' && c != '\'') {
+			return -1;
+		}
+
+		size_t close = find_quote(s, n, quote + 1, c);
+		if (close >= n) {
+			break; // An unterminated string, which the tokenizer will report.
+		}
+		if (s[close] != c) {
+			return -1;
+		}
+		pos = close + 1;
+	}
+
+	return 0;
+}
+
+/**md
+ *
+ * ### Putting the Results Back Together
+ *
+ * Each chunk is tokenized into a `TokenResult` of its own, as if it was a whole
+ * input. All of the offsets in it count from the start of the chunk, so when
+ * the results are joined, the start of the chunk is added to each token's
+ * offset, and to the offset of its text if it is a view. Strings that were
+ * copied don't have to move: `token_buffer_adopt` hands the blocks they live in
+ * over to the joined result.
+ *
+ * Line numbers are never stored in the tokens, so there is nothing to correct
+ * there. The number of lines is counted once for the whole input.
+ *
+ * If a chunk fails, the whole input is tokenized again in one go. Errors
+ * should be rare, and this way the error that's reported is exactly the one
+ * that `tokenize` would have found first.
+ *
+ */
+
+// `tokenizer_feed` takes the size of a piece as an `int`, so large inputs are
+// given to it in several pieces.
+#define SOURCE_MAX_PIECE (1 << 30)
+
+static int tokenize_whole(char *input, size_t size, int mode, TokenResult &result)
+{
+	Tokenizer tokenizer(mode);
+	size_t pos = 0;
+	int ret = 0;
+
+	while (ret == 0) {
+		size_t n = size - pos;
+		if (n > SOURCE_MAX_PIECE) {
+			n = SOURCE_MAX_PIECE;
+		}
+		ret = tokenizer_feed(tokenizer, input + pos, n, pos + n == size, result);
+		pos += n;
+	}
+
+	return ret;
+}
+
+typedef struct SourceChunk {
+	char *input;
+	size_t size;
+	int ret;
+	TokenResult result;
+	SymbolTable symbols; // Used with TOKENIZE_INTERN
+} SourceChunk;
+
+static void tokenize_chunk(SourceChunk &chunk, int mode)
+{
+	// A chunk can be larger than planned if `find_splits` couldn't split
+	// where it wanted to, so it is fed in pieces too.
+	chunk.ret = tokenize_whole(chunk.input, chunk.size, mode, chunk.result);
+}
+
+// With TOKENIZE_INTERN, each chunk interns its identifiers into a table of its
+// own, since the threads can't share one. When joining, every symbol of the
+// chunk's table is interned into the real one, in the order of their ids,
+// which gives them the same ids as tokenizing the whole input in one go would
+// have. `ids` maps the chunk's ids to these.
+static void fix_data(uint8_t type, TokenData &data, unsigned int base, int mode,
+                     const std::vector<uint32_t> &ids)
+{
+	bool text = (type == TOKEN_TYPE_STRING || type == TOKEN_TYPE_ID ||
+	             type == TOKEN_TYPE_DEBUG_COMMAND);
+
+	if (!text) {
+		return;
+	}
+
+	if ((mode & TOKENIZE_INTERN) && type != TOKEN_TYPE_STRING) {
+		data.sym = ids[data.sym];
+	} else if (mode & TOKENIZE_VIEWS) {
+		data.v.offset += base;
+	}
+}
+
+static void join_chunk(TokenResult &result, SourceChunk &chunk, unsigned int base, int mode)
+{
+	std::vector<uint32_t> ids;
+
+	if (mode & TOKENIZE_INTERN) {
+		const SymbolTable &symbols = chunk.symbols;
+		for (size_t i = 0; i < symbol_count(symbols); i++) {
+			ids.push_back(symbol_intern(*result.symbols, symbol_name(symbols, i),
+			                            symbol_length(symbols, i), symbols.symbols[i].hash));
+		}
+	}
+
+	if (mode & TOKENIZE_STREAM) {
+		TokenStream &stream = chunk.result.stream;
+
+		for (size_t i = 0; i < token_stream_size(stream); i++) {
+			fix_data(stream.types[i], stream.data[i], base, mode, ids);
+			if (stream.keep_offsets) {
+				stream.offsets[i] += base;
+			}
+		}
+
+		result.stream.types.insert(result.stream.types.end(),
+		                           stream.types.begin(), stream.types.end());
+		result.stream.data.insert(result.stream.data.end(),
+		                          stream.data.begin(), stream.data.end());
+		result.stream.offsets.insert(result.stream.offsets.end(),
+		                             stream.offsets.begin(), stream.offsets.end());
+	} else {
+		std::vector<Token> &tokens = chunk.result.tokens;
+
+		for (size_t i = 0; i < tokens.size(); i++) {
+			fix_data(tokens[i].type, tokens[i].data, base, mode, ids);
+			tokens[i].offset += base;
+		}
+
+		result.tokens.insert(result.tokens.end(), tokens.begin(), tokens.end());
+	}
+
+	token_buffer_adopt(result.buffer, chunk.result.buffer);
+}
+
+// Chunks smaller than this aren't worth starting a thread for, unless the
+// caller asks for a specific number of threads.
+#define SOURCE_MIN_CHUNK (1 << 20)
+
+// Offsets are stored as `unsigned int`, so an input can't be larger than
+// UINT32_MAX bytes. A larger one fails like a syntax error at the first byte
+// that has no offset. Its line isn't counted, so the line and column are 0.
+static int too_large(const char *input, TokenError &error)
+{
+	error = TokenError();
+	error.curr_offset = UINT32_MAX;
+	error.curr_guess = TOKEN_STATE_NONE;
+	error.curr_input = TOKEN_INPUT_OTHER;
+	error.curr_input_val = input[UINT32_MAX];
+	return -1;
+}
+
+int tokenize_parallel(char *input, size_t size, int mode, int threads, TokenResult &result)
+{
+	std::vector<size_t> splits;
+	size_t chunks = threads;
+
+	if (size > (size_t) UINT32_MAX) {
+		return too_large(input, result.error);
+	}
+
+	if (threads <= 0) {
+		chunks = std::thread::hardware_concurrency();
+		if (chunks > size / SOURCE_MIN_CHUNK) {
+			chunks = size / SOURCE_MIN_CHUNK;
+		}
+	}
+	if (chunks < size / SOURCE_MAX_PIECE + 1) {
+		chunks = size / SOURCE_MAX_PIECE + 1;
+	}
+
+	if (chunks <= 1 || find_splits(input, size, chunks, splits) < 0 || splits.size() == 1) {
+		return tokenize_whole(input, size, mode, result);
+	}
+
+	std::vector<SourceChunk> parts(splits.size());
+	std::vector<std::thread> workers;
+
+	for (size_t i = 0; i < parts.size(); i++) {
+		size_t end = (i + 1 < splits.size()) ? splits[i + 1] : size;
+		parts[i].input = input + splits[i];
+		parts[i].size = end - splits[i];
+		parts[i].ret = -1;
+		parts[i].result.stream.keep_offsets = result.stream.keep_offsets;
+		parts[i].result.symbols = &parts[i].symbols;
+	}
+
+	// The first chunk is tokenized on this thread.
+	for (size_t i = 1; i < parts.size(); i++) {
+		workers.emplace_back(tokenize_chunk, std::ref(parts[i]), mode);
+	}
+	tokenize_chunk(parts[0], mode);
+	for (size_t i = 0; i < workers.size(); i++) {
+		workers[i].join();
+	}
+
+	for (size_t i = 0; i < parts.size(); i++) {
+		if (parts[i].ret != 1) {
+			return tokenize_whole(input, size, mode, result);
+		}
+	}
+
+	if (mode & TOKENIZE_VIEWS) {
+		result.source = input;
+	}
+
+	for (size_t i = 0; i < parts.size(); i++) {
+		join_chunk(result, parts[i], splits[i], mode);
+	}
+
+	result.characters_processed = size;
+	result.lines_processed = util_count_lines(input, size, true);
+	return 1;
+}
+
+/**md
+ *
+ * Tokenizing Again After an Edit
+ * ==============================
+ *
+ * An editor, or a REPL that keeps a whole buffer, changes a few bytes of its
+ * input at a time, and wants the tokens again after every change. Most of them
+ * are the same as before: only the tokens around the edit can be any
+ * different, and the ones after it have simply moved.
+ *
+ * `tokenize_edit` starts the tokenizer again a little before the edit, at the
+ * start of a token that follows whitespace. The old tokenizer was in the
+ * `NONE` state there (see Tokenizing in Parallel), and the input before it
+ * hasn't changed, so the new one would be in the same state.
+ *
+ * It stops again as soon as it is back in step with the old tokens: once it
+ * starts a token just after a whitespace byte that lies after the edit, at
+ * the same place (moved by the edit) where an old token started. From there
+ * on, both were in the `NONE` state, with the same input ahead of them, so
+ * all of the old tokens that follow are still right.
+ *
+ * The new tokens are put in place of the old ones in between, and the ones
+ * after them have their offsets moved by the size of the edit. That still
+ * goes over every one of them, but only to add a number, which is much less
+ * work than reading all of that input again.
+ *
+ * If the tokenizer finds an error, the result is left just as `tokenize` would
+ * have left it, with the tokens up to the error. The next edit can still be
+ * given to `tokenize_edit`, but since the old tokens after the error are
+ * missing, it has to tokenize everything after that edit.
+ *
+ */
+
+// How far past the edit the tokenizer first reads. Each later piece is twice
+// the size of the one before it, in case the edit changed a lot more than its
+// own size (by opening a string, say).
+#define SOURCE_EDIT_PIECE 4096
+
+static inline size_t result_size(const TokenResult &result, int mode)
+{
+	return (mode & TOKENIZE_STREAM) ? token_stream_size(result.stream) : result.tokens.size();
+}
+
+static inline unsigned int result_offset(const TokenResult &result, int mode, size_t i)
+{
+	return (mode & TOKENIZE_STREAM) ? result.stream.offsets[i] : result.tokens[i].offset;
+}
+
+static inline uint8_t result_type(const TokenResult &result, int mode, size_t i)
+{
+	return (mode & TOKENIZE_STREAM) ? result.stream.types[i] : (uint8_t) result.tokens[i].type;
+}
+
+// Views count from the start of the input, so they move with the edit too,
+// unless the token is a symbol.
+static inline void move_data(uint8_t type, TokenData &data, unsigned int delta, int mode)
+{
+	bool view = (type == TOKEN_TYPE_STRING) ||
+	            (!(mode & TOKENIZE_INTERN) &&
+	             (type == TOKEN_TYPE_ID || type == TOKEN_TYPE_DEBUG_COMMAND));
+
+	if ((mode & TOKENIZE_VIEWS) && view) {
+		data.v.offset += delta;
+	}
+}
+
+// Puts the first `count` tokens of `part` in place of the tokens from `first`
+// up to `last` of `result`, and moves the ones after them by `delta`.
+static void splice_tokens(TokenResult &result, TokenResult &part, size_t count,
+                          size_t first, size_t last, unsigned int delta, int mode)
+{
+	if (mode & TOKENIZE_STREAM) {
+		TokenStream &stream = result.stream;
+		TokenStream &from = part.stream;
+
+		stream.types.erase(stream.types.begin() + first, stream.types.begin() + last);
+		stream.data.erase(stream.data.begin() + first, stream.data.begin() + last);
+		stream.offsets.erase(stream.offsets.begin() + first, stream.offsets.begin() + last);
+		stream.types.insert(stream.types.begin() + first,
+		                    from.types.begin(), from.types.begin() + count);
+		stream.data.insert(stream.data.begin() + first,
+		                   from.data.begin(), from.data.begin() + count);
+		stream.offsets.insert(stream.offsets.begin() + first,
+		                      from.offsets.begin(), from.offsets.begin() + count);
+
+		for (size_t i = first + count; i < token_stream_size(stream); i++) {
+			move_data(stream.types[i], stream.data[i], delta, mode);
+			stream.offsets[i] += delta;
+		}
+	} else {
+		std::vector<Token> &tokens = result.tokens;
+
+		tokens.erase(tokens.begin() + first, tokens.begin() + last);
+		tokens.insert(tokens.begin() + first, part.tokens.begin(), part.tokens.begin() + count);
+
+		for (size_t i = first + count; i < tokens.size(); i++) {
+			move_data(tokens[i].type, tokens[i].data, delta, mode);
+			tokens[i].offset += delta;
+		}
+	}
+
+	// The text of the old tokens that were replaced is only freed with the
+	// rest of the buffer. Either buffer may still be building the string of a
+	// token that is not wanted: the one the tokenizer was in the middle of when
+	// it got back in step, and the one an earlier error cut short.
+	token_buffer_discard(result.buffer);
+	token_buffer_discard(part.buffer);
+	token_buffer_adopt(result.buffer, part.buffer);
+}
+
+static int tokenize_again(char *input, size_t size, int mode, TokenResult &result)
+{
+	token_result_reset(result);
+	return tokenize_whole(input, size, mode, result);
+}
+
+int tokenize_edit(char *input, size_t size, int mode, const TokenEdit &edit, TokenResult &result)
+{
+	size_t count = result_size(result, mode);
+	size_t edit_end = edit.offset + edit.inserted;
+	unsigned int delta = (unsigned int) (edit.inserted - edit.removed);
+
+	if (size > (size_t) UINT32_MAX || edit_end > size ||
+	    ((mode & TOKENIZE_STREAM) && !result.stream.keep_offsets)) {
+		return tokenize_again(input, size, mode, result);
+	}
+
+	// Find the last token that starts at or before the edit, and just after
+	// whitespace. If there is none, start from the very beginning.
+	size_t lo = 0;
+	size_t hi = count;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (result_offset(result, mode, mid) <= edit.offset) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	size_t first = lo;
+	size_t restart = 0;
+	while (first > 0) {
+		first--;
+		unsigned int offset = result_offset(result, mode, first);
+		if (offset == 0 || is_space(input[offset - 1])) {
+			restart = offset;
+			break;
+		}
+	}
+
+	TokenResult part;
+	Tokenizer tokenizer(mode);
+	part.symbols = result.symbols;
+	part.source = input;
+	tokenizer.offset = restart;
+
+	// The old tokens after an error are missing, so there's nothing to get
+	// back in step with.
+	bool resync = !token_result_failed(result);
+
+	size_t pos = restart;
+	size_t piece = edit_end - restart + SOURCE_EDIT_PIECE;
+	size_t checked = 0;   // Tokens of `part` checked so far
+	size_t last = first;  // The old token that is being looked for
+	int ret = 0;
+
+	if (piece > SOURCE_MAX_PIECE) {
+		piece = SOURCE_MAX_PIECE;
+	}
+
+	while (ret == 0) {
+		size_t n = size - pos;
+		if (n > piece) {
+			n = piece;
+		}
+		ret = tokenizer_feed(tokenizer, input + pos, n, pos + n == size, part);
+		pos += n;
+		if (piece < SOURCE_MAX_PIECE / 2) {
+			piece *= 2;
+		}
+
+		for (; resync && checked < result_size(part, mode); checked++) {
+			unsigned int offset = result_offset(part, mode, checked);
+			if (offset <= edit_end || !is_space(input[offset - 1])) {
+				continue;
+			}
+
+			unsigned int old = offset - delta;
+			while (last < count && result_offset(result, mode, last) < old) {
+				last++;
+			}
+			if (last < count && result_offset(result, mode, last) == old &&
+			    result_type(result, mode, last) == result_type(part, mode, checked)) {
+				unsigned int characters = result.characters_processed + delta;
+				splice_tokens(result, part, checked, first, last, delta, mode);
+				result.characters_processed = characters;
+				goto done;
+			}
+		}
+	}
+
+	// The tokenizer got to the end of the input, or to an error, without
+	// getting back in step, so everything from `first` on is new.
+	splice_tokens(result, part, result_size(part, mode), first, count, 0, mode);
+	result.characters_processed = part.characters_processed;
+
+	if (ret < 0) {
+		// The tokenizer only counted lines from where it started, so the
+		// line of the error is found again from the start of the input.
+		unsigned int at = part.error.curr_offset;
+		LineCounter lines;
+
+		result.error = part.error;
+		line_counter_append(lines, input, (at < size) ? at + 1 : size);
+		line_counter_resolve(lines, at, result.error.line_pos, result.error.col_pos);
+		result.lines_processed = line_counter_lines(lines, false);
+		if (mode & TOKENIZE_VIEWS) {
+			result.source = input;
+		}
+		return -1;
+	}
+
+done:
+	if (mode & TOKENIZE_VIEWS) {
+		result.source = input;
+	}
+	result.error = TokenError();
+	result.lines_processed = util_count_lines(input, result.characters_processed, true);
+	return 1;
+}
+
+/**md
+ *
+ * Tokenizing Many Inputs at Once
+ * ==============================
+ *
+ * A server that is handed lots of small snippets would otherwise make a new
+ * `TokenResult` for each of them, and with it a new stream and buffer that
+ * are only ever filled a little. `tokenize_batch` puts every document into
+ * the same result instead, one after another. The tokenizer appends to
+ * whatever is already in a result, so this is just a matter of giving it a
+ * fresh `Tokenizer` for each document, and noting where each one's tokens
+ * start.
+ *
+ * With more than one thread, the documents are split into runs of about the
+ * same number of bytes, and each run goes into a result of its own, which are
+ * then joined in order just like the chunks of a single input above (only
+ * without any offsets to move). The threads are started for each batch, as
+ * they are for `tokenize_parallel`, so it's only worth it for batches of at
+ * least a few megabytes in all.
+ *
+ */
+
+// Tokenizes the documents from `first` up to `last` into `result`, and appends
+// where each one ends to `ends`.
+static void tokenize_documents(const TokenSpan *spans, size_t first, size_t last, int mode,
+                               TokenResult &result, std::vector<size_t> &ends,
+                               int *status, TokenError *errors)
+{
+	unsigned int characters = result.characters_processed;
+	unsigned int lines = result.lines_processed;
+
+	for (size_t i = first; i < last; i++) {
+		result.error = TokenError();
+		result.characters_processed = 0;
+		result.lines_processed = 0;
+		if (spans[i].size > (size_t) UINT32_MAX) {
+			status[i] = too_large(spans[i].input, result.error);
+		} else {
+			status[i] = tokenize_whole(spans[i].input, spans[i].size, mode, result);
+		}
+		errors[i] = result.error;
+		if (status[i] < 0) {
+			token_buffer_discard(result.buffer);
+		}
+
+		characters += result.characters_processed;
+		lines += result.lines_processed;
+		ends.push_back(token_stream_size(result.stream));
+	}
+
+	result.characters_processed = characters;
+	result.lines_processed = lines;
+	result.error = TokenError();
+	result.source = NULL;
+}
+
+typedef struct SourceRun {
+	size_t first;
+	size_t last;
+	std::vector<size_t> ends;
+	SourceChunk chunk;
+} SourceRun;
+
+static void tokenize_run(SourceRun &run, const TokenSpan *spans, int mode,
+                         int *status, TokenError *errors)
+{
+	tokenize_documents(spans, run.first, run.last, mode, run.chunk.result, run.ends,
+	                   status, errors);
+}
+
+int tokenize_batch(const TokenSpan *spans, size_t count, int mode, int threads, TokenBatch &batch)
+{
+	TokenResult &result = batch.result;
+	size_t total = 0;
+	size_t runs = threads;
+
+	mode |= TOKENIZE_STREAM;
+
+	// A document that is too large fails by itself in `tokenize_documents`,
+	// and isn't worth reserving for.
+	for (size_t i = 0; i < count; i++) {
+		if (spans[i].size <= (size_t) UINT32_MAX) {
+			total += spans[i].size;
+		}
+	}
+
+	if (threads <= 0) {
+		runs = std::thread::hardware_concurrency();
+		if (runs > total / SOURCE_MIN_CHUNK) {
+			runs = total / SOURCE_MIN_CHUNK;
+		}
+	}
+	if (runs > count) {
+		runs = count;
+	}
+
+	size_t base = batch.status.size();
+	batch.status.resize(base + count);
+	batch.errors.resize(base + count);
+	if (batch.starts.empty()) {
+		batch.starts.push_back(token_stream_size(result.stream));
+	}
+
+	int *status = batch.status.data() + base;
+	TokenError *errors = batch.errors.data() + base;
+
+	token_stream_reserve(result.stream, total);
+
+	if (runs <= 1) {
+		tokenize_documents(spans, 0, count, mode, result, batch.starts, status, errors);
+	} else {
+		std::vector<SourceRun> parts(runs);
+		std::vector<std::thread> workers;
+		size_t doc = 0;
+		size_t done = 0;
+
+		for (size_t i = 0; i < runs; i++) {
+			size_t target = total / runs * (i + 1);
+
+			parts[i].first = doc;
+			while (doc < count && (done < target || i + 1 == runs)) {
+				done += spans[doc].size;
+				doc++;
+			}
+			parts[i].last = doc;
+			parts[i].chunk.result.stream.keep_offsets = result.stream.keep_offsets;
+			parts[i].chunk.result.symbols = &parts[i].chunk.symbols;
+		}
+
+		for (size_t i = 1; i < runs; i++) {
+			workers.emplace_back(tokenize_run, std::ref(parts[i]), spans, mode, status, errors);
+		}
+		tokenize_run(parts[0], spans, mode, status, errors);
+		for (size_t i = 0; i < workers.size(); i++) {
+			workers[i].join();
+		}
+
+		for (size_t i = 0; i < runs; i++) {
+			size_t start = token_stream_size(result.stream);
+
+			join_chunk(result, parts[i].chunk, 0, mode);
+			result.characters_processed += parts[i].chunk.result.characters_processed;
+			result.lines_processed += parts[i].chunk.result.lines_processed;
+			for (size_t j = 0; j < parts[i].ends.size(); j++) {
+				batch.starts.push_back(start + parts[i].ends[j]);
+			}
+		}
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		if (status[i] < 0) {
+			return -1;
+		}
+	}
+	return 1;
+}
+
+void token_batch_reset(TokenBatch &batch)
+{
+	token_result_reset(batch.result);
+	batch.starts.clear();
+	batch.status.clear();
+	batch.errors.clear();
+}
@@ -0,0 +1,259 @@
+/**
+ *
+ * source.hpp - Loading source files, and tokenizing them on several threads
+ *
+ * Copyright (c) 2022 Anamitra Ghorui
+ *
+ * LICENSE_HERE
+ *
+ */
+
+#ifndef BLINDFORTH_SOURCE_HPP
+#define BLINDFORTH_SOURCE_HPP
+
+#include <stddef.h>
+#include <stdio.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "tokenizer.hpp"
+
+/**md
+ *
+ * ### `struct SourceFile`
+ *
+ * A source file loaded into memory. Where the system allows it, the file is
+ * mapped into memory rather than read, so that it is only actually read as the
+ * tokenizer gets to each part of it. The data must not be written to.
+ *
+ */
+
+typedef struct SourceFile {
+	char *data;
+	size_t size;
+	bool mapped; // Whether `data` is mapped, or was allocated and read into
+
+	SourceFile() {
+		data = NULL;
+		size = 0;
+		mapped = false;
+	}
+} SourceFile;
+
+// Loads the file at `path`. Returns a value less than 0 if it can't be read,
+// with `errno` set to why. Nothing is printed, that is up to the caller.
+int source_open(SourceFile &file, const char *path);
+void source_close(SourceFile &file);
+
+/**md
+ *
+ * ### `struct SourceReader`
+ *
+ * A reader tokenizes a file while the rest of it is still being read. A
+ * thread of its own reads the file into one of two blocks while the tokenizer
+ * works on the other, so that a file on slow storage takes about as long as
+ * the slower of the two, rather than both one after the other.
+ *
+ * Each call to `source_reader_next` tokenizes the next block, adding its
+ * tokens to `result`, and returns what `tokenizer_feed` did. The tokens from
+ * the count before the call on are the new ones, so a later stage can take
+ * them in batches as they arrive, instead of waiting for the whole file.
+ *
+ * The blocks are used again for the rest of the file, so the text of tokens
+ * can't be views into them: TOKENIZE_VIEWS must not be part of `mode`.
+ *
+ */
+
+#define SOURCE_READER_BLOCK (1 << 16)
+
+typedef struct SourceBlock {
+	std::vector<char> data;
+	size_t size;
+	bool full;  // Read, and not tokenized yet
+	bool last;  // The file ends with this block
+	int error;  // `errno` if reading it failed, or 0
+} SourceBlock;
+
+typedef struct SourceReader {
+	FILE *f;
+	std::string path;
+	Tokenizer tokenizer;
+	SourceBlock blocks[2];
+	int next;            // The block to tokenize next
+	bool failed;         // Whether reading the file failed, once a call found it
+	int read_errno;      // `errno` from the read that failed
+	bool stop;           // Tells the reading thread to stop
+	std::mutex mutex;
+	std::condition_variable cond;
+	std::thread thread;
+
+	SourceReader() {
+		f = NULL;
+		next = 0;
+		failed = false;
+		read_errno = 0;
+		stop = false;
+	}
+} SourceReader;
+
+// Opens the file at `path` and starts reading it, `block_size` bytes at a time.
+// Returns a value less than 0 if it can't be opened, with `errno` set to why.
+// Nothing is printed, that is up to the caller.
+int source_reader_open(SourceReader &reader, const char *path, int mode,
+                       size_t block_size = SOURCE_READER_BLOCK);
+
+// Tokenizes the next block into `result`. Returns what `tokenizer_feed` did,
+// or -1 if the file couldn't be read. A failed read sets `reader.failed` and
+// `errno`, and leaves `result.error` as it was, so a caller tells the two
+// apart by checking `reader.failed`.
+int source_reader_next(SourceReader &reader, TokenResult &result);
+void source_reader_close(SourceReader &reader);
+
+/**md
+ *
+ * ### `struct TokenQueue`
+ *
+ * A queue hands tokens from the tokenizer on one thread to whatever reads them
+ * on another, such as a parser, while the rest of the input is still being
+ * tokenized. It is a ring of a fixed number of tokens, with exactly one thread
+ * pushing and one popping. Neither of them ever takes a lock: each side only
+ * writes its own end of the ring, and the two ends are kept on separate cache
+ * lines so that the threads don't slow each other down by writing to the same
+ * one.
+ *
+ * A full queue makes the pushing side wait, so however long the input is, no
+ * more than `capacity` tokens are ever waiting to be read. Once the tokenizer
+ * is done, `token_queue_finish` records how it ended, and popping from the
+ * queue returns 0 after the last token. `status` and `error` then say whether
+ * the input was tokenized, as `tokenizer_feed` would have.
+ *
+ * The text of tokens stays where the tokenizer put it, in the buffer or input
+ * of the `TokenResult` it tokenized into, which must outlive the tokens.
+ *
+ */
+
+#define TOKEN_QUEUE_CAPACITY 4096
+#define TOKEN_QUEUE_PIECE (1 << 16)
+
+static_assert((TOKEN_QUEUE_CAPACITY & (TOKEN_QUEUE_CAPACITY - 1)) == 0,
+              "a new queue's ring must be a power of two in size");
+
+typedef struct TokenQueue {
+	std::vector<Token> ring;         // Always a power of two in size
+	int status;                      // What tokenizing returned, once finished
+	TokenError error;                // The error, if status is -1
+
+	alignas(64) std::atomic<size_t> head;     // Next token to pop
+	size_t tail_seen;                         // The last tail the popper read
+	alignas(64) std::atomic<size_t> tail;     // Next token to push
+	size_t head_seen;                         // The last head the pusher read
+	alignas(64) std::atomic<bool> finished;
+
+	// The same as `token_queue_init` with the default capacity, so that a
+	// queue is usable as soon as it is made.
+	TokenQueue() : ring(TOKEN_QUEUE_CAPACITY), head(0), tail(0), finished(false) {
+		status = 0;
+		tail_seen = 0;
+		head_seen = 0;
+	}
+} TokenQueue;
+
+// Makes the queue empty, with room for `capacity` tokens, rounded up to a
+// power of two. Neither side may be using it. A new queue already has room for
+// TOKEN_QUEUE_CAPACITY tokens, so this is only needed for another capacity or
+// to use the queue again.
+void token_queue_init(TokenQueue &queue, size_t capacity = TOKEN_QUEUE_CAPACITY);
+
+// Pushes `count` tokens, waiting for room as long as needed.
+void token_queue_push(TokenQueue &queue, const Token *tokens, size_t count);
+
+// Marks the end of the tokens, with what tokenizing returned and its error.
+void token_queue_finish(TokenQueue &queue, int status, const TokenError &error);
+
+// Pops up to `max` tokens into `tokens`, waiting for at least one. Returns the
+// number popped, which is 0 only once the queue is finished and empty.
+size_t token_queue_pop(TokenQueue &queue, Token *tokens, size_t max);
+
+// Tokenizes `input` in `mode` into `queue`, a piece of `piece` bytes at a
+// time, and finishes it. `result` holds the text of the tokens, and is left
+// holding none of the tokens themselves. TOKENIZE_STREAM and TOKENIZE_INTERN
+// must not be part of `mode`, since the popping side couldn't safely read
+// their arrays while they grow. Returns what `tokenizer_feed` did.
+int tokenize_queued(char *input, size_t size, int mode, TokenResult &result, TokenQueue &queue,
+                    size_t piece = TOKEN_QUEUE_PIECE);
+
+// Tokenizes `input` in `mode` (see `TokenizeMode`) with `threads` threads, or
+// one for each CPU if `threads` is 0. The result is the same as that of
+// `tokenizer_feed` with the whole input in one piece, and so is the return
+// value. An input larger than UINT32_MAX bytes fails at offset UINT32_MAX.
+int tokenize_parallel(char *input, size_t size, int mode, int threads, TokenResult &result);
+
+/**md
+ *
+ * ### `struct TokenEdit`
+ *
+ * An edit replaces the `removed` bytes at `offset` of an input with the
+ * `inserted` bytes that are now at the same offset.
+ *
+ */
+
+typedef struct TokenEdit {
+	size_t offset;
+	size_t removed;
+	size_t inserted;
+} TokenEdit;
+
+// Brings `result`, which holds the tokens of an input as it was before `edit`,
+// up to date with `input`, the `size` bytes of the input after it. `result`
+// must be what tokenizing the whole input in `mode` gave (or an earlier call to
+// this), even if that was an error, and with TOKENIZE_STREAM, offsets must be
+// kept. Only the tokens around the edit are tokenized again. The result, and
+// the return value, are the same as those of `tokenizer_feed` with the whole
+// input in one piece.
+int tokenize_edit(char *input, size_t size, int mode, const TokenEdit &edit, TokenResult &result);
+
+/**md
+ *
+ * ### `struct TokenBatch`
+ *
+ * A batch holds the tokens of many separate inputs (documents), tokenized all
+ * at once into the same `result`: one stream, one buffer for the copied
+ * strings, and one symbol table. The tokens of document `i` are the ones from
+ * `starts[i]` up to `starts[i + 1]`.
+ *
+ * Offsets, and views with `TOKENIZE_VIEWS`, count from the start of each
+ * document, so `result.source` is not set. `status` holds what tokenizing
+ * each document returned, and `errors` its error, if it had one. A document
+ * that fails keeps its tokens up to the error, and doesn't stop the others.
+ * One that is larger than UINT32_MAX bytes fails with no tokens, at offset
+ * UINT32_MAX, as it does with `tokenize_parallel`.
+ *
+ */
+
+typedef struct TokenSpan {
+	char *input;
+	size_t size;
+} TokenSpan;
+
+typedef struct TokenBatch {
+	TokenResult result;              // Always in TOKENIZE_STREAM
+	std::vector<size_t> starts;      // First token of each document, and the end
+	std::vector<int> status;         // 1 for each document that was tokenized
+	std::vector<TokenError> errors;  // Cleared, unless the document failed
+} TokenBatch;
+
+// Tokenizes `count` documents in `mode`, with `threads` threads, or as many as
+// are worth it if `threads` is 0. The documents are added to `batch`, so a
+// batch that is reused should be reset first. With TOKENIZE_INTERN,
+// `batch.result.symbols` must be set. Returns 1 if every document was
+// tokenized, and -1 if any of them failed.
+int tokenize_batch(const TokenSpan *spans, size_t count, int mode, int threads, TokenBatch &batch);
+
+// Empties a batch, keeping all of its memory.
+void token_batch_reset(TokenBatch &batch);
+
+#endif
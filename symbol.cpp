@@ -0,0 +1,156 @@
+/**
+ *
+ * symbol.cpp - Interning identifiers into a table of symbols
+ *
+ * Copyright (c) 2022 Anamitra Ghorui
+ *
+ * LICENSE_HERE
+ *
+ */
+
+#include <string.h>
+
+#include "symbol.hpp"
+
+/**md
+ *
+ * Symbols
+ * =======
+ *
+ * Every identifier in a program will have to be looked up in the dictionary
+ * when it's run. Words like `dup`, `swap` and `+` turn up over and over again,
+ * and comparing their names every single time is a waste. So instead, the
+ * tokenizer can give each distinct name a number as it reads it. Later stages
+ * then only deal with these numbers, and a dictionary can be an array indexed
+ * by them.
+ *
+ * The table is an open addressing hash table: all the entries are kept in one
+ * array of slots, and a name that hashes to a slot that's already taken simply
+ * goes in the next free one after it. To look a name up, we start at the slot
+ * its hash points to, and go forward until we find it, or an empty slot. Each
+ * slot keeps the full hash along with the id, so we only have to compare the
+ * actual names when the hashes are equal.
+ *
+ * The table is kept at most half full, which keeps the runs of taken slots
+ * short. When it gets fuller than that, it is doubled in size, and every entry
+ * is put back in using the hash stored in it.
+ *
+ */
+
+#define SYMBOL_MIN_SLOTS 64
+
+static inline bool symbol_equals(const SymbolTable &table, const SymbolSlot &slot,
+                                 const char *s, size_t n, uint32_t hash)
+{
+	if (slot.hash != hash) {
+		return false;
+	}
+
+	const Symbol &symbol = symbol_entries(table)[slot.id - 1];
+	return symbol.length == n && memcmp(symbol_text(table) + symbol.offset, s, n) == 0;
+}
+
+// Copies a shared table into arrays of its own, so that it can be added to.
+static void symbol_unshare(SymbolTable &table)
+{
+	table.slots.assign(table.shared_slots, table.shared_slots + table.shared_slot_count);
+	table.symbols.assign(table.shared_symbols, table.shared_symbols + table.shared_count);
+	table.text.assign(table.shared_text, table.shared_text + table.shared_text_size);
+	table.shared = false;
+}
+
+static void symbol_grow(SymbolTable &table)
+{
+	size_t size = table.slots.empty() ? SYMBOL_MIN_SLOTS : table.slots.size() * 2;
+	std::vector<SymbolSlot> slots(size, SymbolSlot{0, 0});
+	size_t mask = size - 1;
+
+	for (size_t i = 0; i < table.slots.size(); i++) {
+		const SymbolSlot &slot = table.slots[i];
+		if (slot.id == 0) {
+			continue;
+		}
+
+		size_t j = slot.hash & mask;
+		while (slots[j].id != 0) {
+			j = (j + 1) & mask;
+		}
+		slots[j] = slot;
+	}
+
+	table.slots.swap(slots);
+}
+
+uint32_t symbol_intern(SymbolTable &table, const char *s, size_t n, uint32_t hash)
+{
+	if (table.shared) {
+		uint32_t id = symbol_find(table, s, n);
+		if (id != SYMBOL_NONE) {
+			return id;
+		}
+		symbol_unshare(table);
+	}
+
+	if ((table.symbols.size() + 1) * 2 > table.slots.size()) {
+		symbol_grow(table);
+	}
+
+	size_t mask = table.slots.size() - 1;
+	size_t i = hash & mask;
+
+	while (table.slots[i].id != 0) {
+		if (symbol_equals(table, table.slots[i], s, n, hash)) {
+			return table.slots[i].id - 1;
+		}
+		i = (i + 1) & mask;
+	}
+
+	Symbol symbol;
+	symbol.offset = table.text.size();
+	symbol.length = n;
+	symbol.hash = hash;
+
+	table.text.insert(table.text.end(), s, s + n);
+	table.text.push_back('\0');
+	table.symbols.push_back(symbol);
+
+	table.slots[i].hash = hash;
+	table.slots[i].id = table.symbols.size();
+	return table.symbols.size() - 1;
+}
+
+uint32_t symbol_find(const SymbolTable &table, const char *s, size_t n)
+{
+	const SymbolSlot *slots = symbol_slots(table);
+	size_t size = symbol_slot_count(table);
+
+	if (size == 0) {
+		return SYMBOL_NONE;
+	}
+
+	uint32_t hash = symbol_hash(s, n);
+	size_t mask = size - 1;
+	size_t i = hash & mask;
+
+	while (slots[i].id != 0) {
+		if (symbol_equals(table, slots[i], s, n, hash)) {
+			return slots[i].id - 1;
+		}
+		i = (i + 1) & mask;
+	}
+
+	return SYMBOL_NONE;
+}
+
+void symbol_share(SymbolTable &table, const SymbolSlot *slots, size_t slot_count,
+                  const Symbol *symbols, size_t count, const char *text, size_t text_size)
+{
+	table = SymbolTable();
+	table.shared = true;
+	table.shared_slots = slots;
+	table.shared_slot_count = slot_count;
+	table.shared_symbols = symbols;
+	table.shared_count = count;
+	table.shared_text = text;
+	table.shared_text_size = text_size;
+}
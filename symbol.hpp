@@ -0,0 +1,150 @@
+/**
+ *
+ * symbol.hpp - Interning identifiers into a table of symbols
+ *
+ * Copyright (c) 2022 Anamitra Ghorui
+ *
+ * LICENSE_HERE
+ *
+ */
+
+#ifndef BLINDFORTH_SYMBOL_HPP
+#define BLINDFORTH_SYMBOL_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/**md
+ *
+ * ### `struct SymbolTable`
+ *
+ * A `SymbolTable` gives every distinct name it is asked about a number, its
+ * symbol id. Ids count up from 0 in the order the names are first seen, so
+ * they can be used to index an array directly.
+ *
+ * `slots` is the hash table itself. Each slot holds the hash of a name and its
+ * id plus one, so that 0 marks an empty slot. The names, with their null
+ * terminators, are kept one after another in `text`.
+ *
+ * Like a `TokenStream`, a table can refer to arrays that are kept somewhere
+ * else instead, like in an image that many processes have mapped at once
+ * (see `symbol_share`). Names can be looked up in it as usual, and it is only
+ * copied into a table of its own once a new name is added to it.
+ *
+ */
+
+#define SYMBOL_NONE UINT32_MAX
+
+typedef struct SymbolSlot {
+	uint32_t hash;
+	uint32_t id; // Symbol id + 1, or 0 if the slot is empty
+} SymbolSlot;
+
+typedef struct Symbol {
+	uint32_t offset; // Offset of the name in `text`
+	uint32_t length;
+	uint32_t hash;
+} Symbol;
+
+typedef struct SymbolTable {
+	std::vector<SymbolSlot> slots; // Always a power of two in size
+	std::vector<Symbol> symbols;   // Indexed by symbol id
+	std::vector<char> text;        // The names of all symbols
+
+	// Used instead of the arrays above, with `symbol_share`
+	bool shared;
+	const SymbolSlot *shared_slots;
+	const Symbol *shared_symbols;
+	const char *shared_text;
+	size_t shared_slot_count;
+	size_t shared_count;
+	size_t shared_text_size;
+
+	SymbolTable() {
+		shared = false;
+		shared_slots = NULL;
+		shared_symbols = NULL;
+		shared_text = NULL;
+		shared_slot_count = 0;
+		shared_count = 0;
+		shared_text_size = 0;
+	}
+} SymbolTable;
+
+static inline const SymbolSlot *symbol_slots(const SymbolTable &table)
+{
+	return table.shared ? table.shared_slots : table.slots.data();
+}
+
+static inline size_t symbol_slot_count(const SymbolTable &table)
+{
+	return table.shared ? table.shared_slot_count : table.slots.size();
+}
+
+static inline const Symbol *symbol_entries(const SymbolTable &table)
+{
+	return table.shared ? table.shared_symbols : table.symbols.data();
+}
+
+static inline const char *symbol_text(const SymbolTable &table)
+{
+	return table.shared ? table.shared_text : table.text.data();
+}
+
+/**md
+ *
+ * ### Hashing
+ *
+ * Names are hashed with 32 bit FNV-1a, which takes one byte at a time. This
+ * lets the tokenizer hash an identifier as it reads it, without going back
+ * over it at the end.
+ *
+ */
+
+#define SYMBOL_HASH_INIT 2166136261u
+
+static inline uint32_t symbol_hash_step(uint32_t hash, char c)
+{
+	return (hash ^ (uint8_t) c) * 16777619u;
+}
+
+static inline uint32_t symbol_hash(const char *s, size_t n)
+{
+	uint32_t hash = SYMBOL_HASH_INIT;
+	for (size_t i = 0; i < n; i++) {
+		hash = symbol_hash_step(hash, s[i]);
+	}
+	return hash;
+}
+
+// Returns the id of the name `s` of length `n`, whose hash is `hash`, adding it
+// to the table if it is not there yet.
+uint32_t symbol_intern(SymbolTable &table, const char *s, size_t n, uint32_t hash);
+
+// Returns the id of the name, or SYMBOL_NONE if it is not in the table.
+uint32_t symbol_find(const SymbolTable &table, const char *s, size_t n);
+
+// Makes `table` refer to the arrays given, which must stay around for as long
+// as it is used, or until a new name is added. `slot_count` must be a power of
+// two. Anything that was in the table before is thrown away.
+void symbol_share(SymbolTable &table, const SymbolSlot *slots, size_t slot_count,
+                  const Symbol *symbols, size_t count, const char *text, size_t text_size);
+
+// The name of a symbol. The pointer is valid until the next symbol is added.
+static inline const char *symbol_name(const SymbolTable &table, uint32_t id)
+{
+	return symbol_text(table) + symbol_entries(table)[id].offset;
+}
+
+static inline size_t symbol_length(const SymbolTable &table, uint32_t id)
+{
+	return symbol_entries(table)[id].length;
+}
+
+static inline size_t symbol_count(const SymbolTable &table)
+{
+	return table.shared ? table.shared_count : table.symbols.size();
+}
+
+#endif
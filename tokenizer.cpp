@@ -8,12 +8,22 @@
  *
  */
 
-#include <cstdint>
-#include <vector>
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
+#include <math.h>
 #include <assert.h>
+#include <array>
+#include <string>
+#include <utility>
+
+#ifdef BLINDFORTH_PROFILE
+#include <mutex>
+#endif
+
+#include "graphviz.hpp"
+#include "tokenizer.hpp"
+#include "util.hpp"
 
 /**md
  * -----------------------------------------------------------------------------
@@ -366,7 +376,7 @@
  * * ''Any Symbol'': By "Any Symbol", I mean any valid UTF-8 Character.
  * * ''Any Visible Symbol'': By "Any Visible Symbol", I mean any non control,
  *   non-whitespace UTF-8 Character. More rigidly, if the symbol's unicode value
- *   is `c`, then: `(c >= U+0021 && c <= U+007E) || (c >= 00A1)`
+ *   is `c`, then: `(c >= U+0021 && c <= U+007E) || (c >= U+0080)`
  *
  * Now, let's give a proper definition of the grammar of each one of the
  * tokens:
@@ -584,221 +594,289 @@
 
 /**md
  *
- * ### `enum TokenType`
+ * ### The Types
  *
- * `TokenType` lists all of the types of tokens that the tokenizer output will
- * contain. This includes all the types I discussed earlier, and a default
- * "none" value that might come in handy.
+ * The types that describe what goes into and comes out of the tokenizer are
+ * needed by the later stages as well, so they live in `tokenizer.hpp`. Now is
+ * a good time to go and read it: it defines the token types, the states and
+ * inputs of the transition table, and what the tokenizer returns.
  *
  */
 
-typedef enum TokenType {
-	TOKEN_TYPE_NONE          = 0,
-	TOKEN_TYPE_INT           = 1,
-	TOKEN_TYPE_REAL          = 2,
-	TOKEN_TYPE_STRING        = 3,
-	TOKEN_TYPE_ID            = 4,
-	TOKEN_TYPE_DEBUG_COMMAND = 5
-} TokenType;
-
 /**md
  *
- * ### `enum TokenState`
+ * ### Counting What the Tokenizer Does
  *
- * `TokenState` lists all the states that the tokenizer will be in. One slight
- * deviation I have made here is that there are separate states for maintaining
- * single-quoted strings and double-quoted strings. This simplifies our code
- * slightly by not having to maintain a variable to remember whether this is
- * a single or double quoted string.
+ * With `BLINDFORTH_PROFILE` (see `TokenCounters` in tokenizer.hpp), every
+ * thread counts into a `TokenCounters` of its own, so that counting never
+ * has to wait on another thread. `TOKEN_COUNT` wraps every place that counts
+ * something, so that without `BLINDFORTH_PROFILE`, not even its argument is
+ * left in the code.
  *
  */
 
-typedef enum TokenState {
-	TOKEN_STATE_ERROR         = 0,
-	TOKEN_STATE_NONE          = 1,
-	TOKEN_STATE_SIGN          = 2,
-	TOKEN_STATE_INT           = 3,
-	TOKEN_STATE_DOT           = 4,
-	TOKEN_STATE_REAL          = 5,
-	TOKEN_STATE_SQUOTE_STRING = 6,
-	TOKEN_STATE_DQUOTE_STRING = 7,
-	TOKEN_STATE_ID            = 8,
-	TOKEN_STATE_DEBUG         = 9,
-	TOKEN_STATE_END           = 10,
-	TOKEN_STATE_SIZE // This simply marks the number of enum values
-} TokenState;
+#ifdef BLINDFORTH_PROFILE
+
+static thread_local TokenCounters token_counters_local;
+static TokenCounters token_counters_total;
+static std::mutex token_counters_mutex;
+
+#define TOKEN_COUNT(expr) (expr)
+
+// Adds the counts of this thread to the total.
+static void token_counters_flush()
+{
+	const uint64_t *src = (const uint64_t *) &token_counters_local;
+	uint64_t *dst = (uint64_t *) &token_counters_total;
+
+	std::lock_guard<std::mutex> lock(token_counters_mutex);
+	for (size_t i = 0; i < sizeof(TokenCounters) / sizeof(uint64_t); i++) {
+		dst[i] += src[i];
+	}
+	memset(&token_counters_local, 0, sizeof(token_counters_local));
+}
+
+#else
+#define TOKEN_COUNT(expr) ((void) 0)
+#endif
 
 /**md
+ * The following functions perform the symbol/string buffer manipulation. This
+ * simplifies later code for us and performs error checking for us as well.
+ *
  *
- * ### `struct TokenInput`
+ * ## Function `token_buffer_grow` (unexported)
  *
- * `TokenInput` contains the possible types of input that the tokenizer will
- * receive.
+ * This is called when the string being built doesn't fit in what's left of the
+ * current block. It moves on to the next block (allocating it, if we haven't
+ * before), making sure that there is room for the string so far plus `n` more
+ * characters. The string so far is moved to the new block.
  *
+ * Only the string that is still being built ever moves. Since nobody has been
+ * given a pointer to it yet, that's fine.
  */
 
+static void token_buffer_grow(CharBuffer &buffer, size_t n)
+{
+	size_t length = buffer.string ? buffer.pos - buffer.string : 0;
+	size_t needed = length + n + 1; // + 1 for the null terminator
+	size_t next = (buffer.pos == NULL) ? 0 : buffer.current + 1;
+	size_t k = next;
+
+	// Every block from `next` onwards is unused. Look for one that is large
+	// enough, and allocate a new one if there is none. Very long strings get
+	// a block of their own.
+	while (k < buffer.blocks.size() && buffer.blocks[k].size < needed) {
+		k++;
+	}
+
+	if (k == buffer.blocks.size()) {
+		CharBlock block;
+		block.size = (needed > CHAR_BLOCK_SIZE) ? needed : CHAR_BLOCK_SIZE;
+		block.data = (char *) malloc(block.size);
+		assert(block.data);
+		buffer.blocks.push_back(block);
+		TOKEN_COUNT(token_counters_local.buffer_blocks++);
+		TOKEN_COUNT(token_counters_local.buffer_bytes += block.size);
+	}
+
+	std::swap(buffer.blocks[k], buffer.blocks[next]);
 
-typedef enum TokenInput {
-	TOKEN_INPUT_EOF         = 0,
-	TOKEN_INPUT_WHITESPACE  = 1,
-	TOKEN_INPUT_ALPHABET    = 2,
-	TOKEN_INPUT_NUMERIC     = 3,
-	TOKEN_INPUT_DOT         = 4,
-	TOKEN_INPUT_DOUBLEQUOTE = 5,
-	TOKEN_INPUT_SINGLEQUOTE = 6,
-	TOKEN_INPUT_SIGN        = 7,
-	TOKEN_INPUT_COLON       = 8,
-	TOKEN_INPUT_BACKSLASH   = 9, // unused for now.
-	TOKEN_INPUT_IDCHAR      = 10,
-	TOKEN_INPUT_OTHER       = 11,
-	TOKEN_INPUT_SIZE // This simply marks the number of enum values
-} TokenInput;
+	CharBlock &block = buffer.blocks[next];
+	if (length) {
+		memcpy(block.data, buffer.string, length);
+		TOKEN_COUNT(token_counters_local.buffer_moves++);
+	}
 
+	buffer.current = next;
+	buffer.string = block.data;
+	buffer.pos = block.data + length;
+	buffer.limit = block.data + block.size;
+}
 
 /**md
  *
- * ## `union TokenData`
+ * ## Function `token_buffer_new`
  *
- * This is what we will store our token data. It's a union, which allows us to
- * reuse the same storage for different things.
+ * This function starts a new string and returns a pointer to where it begins.
  *
- * Identifiers and strings are stored here using allocated pointers. The reason
- * this works is because both identifiers and strings are a string of
- * characters.
+ * Symbols/strings are allocated in a sequential manner and one after the
+ * another. Note that the string might still move to another block while it is
+ * being built, so the pointer that counts is the one `token_buffer_end`
+ * returns.
  */
 
-typedef union TokenData {
-	int64_t i;
-	double r;
-	void *s;
-} TokenData;
+static inline void *token_buffer_new(CharBuffer& buffer)
+{
+	TOKEN_COUNT(token_counters_local.buffer_strings++);
+	buffer.string = buffer.pos;
+	return buffer.string;
+}
 
 /**md
  *
- * ## `struct Token`
+ * ## Function `token_buffer_insert`
  *
- * This is what we will store our token data. It's a union, which allows us to
- * reuse the same storage for different things.
+ * This function inserts a char value to the current buffer pointed to. If
+ * insertion fails it returns a value less than 0.
  *
- * Identifiers and strings are stored here using allocated pointers. The reason
- * this works is because both identifiers and strings are a string of
- * characters.
+ * One less than the end of the block always remains free here, so that there
+ * is always room for the null terminator.
  */
 
-
-typedef struct Token {
-	TokenType type;
-	TokenData data;
-} Token;
+static inline int token_buffer_insert(CharBuffer& buffer, char c)
+{
+	if (buffer.limit - buffer.pos < 2) {
+		token_buffer_grow(buffer, 1);
+	}
+	*buffer.pos++ = c;
+	return 0;
+}
 
 /**md
  *
- * ### `struct TokenError`
- *
- * `TokenError` is returned when the tokenizer encounters any erroneous input.
- * It returns the current position in the input (`current_offset`), the line
- * number (`line_pos`) and the column position (`col_pos`), and the current
- * type of the token that the
+ * ## Function `token_buffer_insert_span`
  *
+ * This inserts `n` characters at once. It is used by the fast paths of the
+ * tokenizer that copy entire runs of a string at a time.
  */
 
-typedef struct TokenError {
-	unsigned int curr_offset;
-	unsigned int line_pos;
-	unsigned int col_pos;
-	TokenState curr_guess;
-	TokenInput curr_input;
-	char curr_input_val;
-} Tokenerror;
-
+static inline int token_buffer_insert_span(CharBuffer& buffer, const char *s, size_t n)
+{
+	if ((size_t) (buffer.limit - buffer.pos) < n + 1) {
+		token_buffer_grow(buffer, n);
+	}
+	memcpy(buffer.pos, s, n);
+	buffer.pos += n;
+	return 0;
+}
 
 /**md
  *
- * ### `struct TokenResult`
- *
- * `TokenResult` is what will be returned by the tokenizer.
- *
- * **TODO** contents of struct might change.
- *
- * I have used
- *
- * String/Symbol storage is handled by allocating a single array, and then copying
- * the strings to the array along with the null terminator. This prevents us
- * from doing a large number of calls to malloc, not make data fragment
- * in memory, forget about freeing data, and so on.
+ * ## Function `token_buffer_end`
  *
- * To explicitly describe the intent, I've aliased the type of the buffer with a
- * name.
+ * This ends the current buffer. It inserts a trailing null ('\0') character
+ * into the buffer and returns a pointer to the start of the finished string.
  */
 
-typedef std::vector<char> CharBuffer;
-
-typedef struct TokenResult {
-	unsigned int characters_processed;
-	unsigned int lines_processed;
-	TokenError error;
-	CharBuffer buffer;
-	std::vector<Token> tokens;
-
-	TokenResult() {
-		characters_processed = 0;
-		lines_processed = 0;
+static inline void *token_buffer_end(CharBuffer& buffer)
+{
+	if (buffer.pos == buffer.limit) {
+		token_buffer_grow(buffer, 0);
 	}
-} TokenResult;
+	*buffer.pos++ = '\0';
+
+	void *string = buffer.string;
+	buffer.string = NULL;
+	return string;
+}
 
 /**md
- * The following functions perform the symbol/string buffer manipulation. This
- * simplifies later code for us and performs error checking for us as well.
  *
+ * ## Function `token_buffer_reset`
  *
- * ## Function `token_buffer_new`
- *
- * This function returns a valid pointer (but not allocated) block of
- * memory which will be used to store the string/symbol.
- *
- * Symbols/strings are allocated in a sequential manner and one after the
- * another.
+ * This empties the buffer. The blocks stay allocated, and get filled again from
+ * the first one onwards.
  */
 
-static inline void *token_buffer_new(std::vector<char>& buffer)
+void token_buffer_reset(CharBuffer &buffer)
 {
-	if (buffer.empty()) {
-		// Reserve a buffer size to reduce allocation frequency.
-		// This is an arbitrary value.
-		buffer.reserve(512);
+	buffer.current = 0;
+	buffer.string = NULL;
+
+	if (buffer.blocks.empty()) {
+		buffer.pos = NULL;
+		buffer.limit = NULL;
+	} else {
+		buffer.pos = buffer.blocks[0].data;
+		buffer.limit = buffer.blocks[0].data + buffer.blocks[0].size;
 	}
-
-	// Insert a null character so we get a pointer to buffer[0]
-	buffer.push_back('\0');
-	return &buffer.back();
 }
 
 /**md
  *
- * ## Function `token_buffer_insert`
+ * ## Function `token_buffer_adopt`
  *
- * This function inserts a char value to the current buffer pointed to. If
- * insertion fails it returns a value less than 0.
+ * This moves all of the strings in `src` into `dst`, by handing over the
+ * blocks that hold them. The strings themselves stay where they are, so any
+ * tokens pointing at them stay valid. The blocks go just before the one `dst`
+ * is currently filling, among the others that are in use. `src` is left empty,
+ * with only its unused blocks. Neither buffer may be in the middle of building
+ * a string.
  */
 
-static inline int token_buffer_insert(std::vector<char>& buffer, char c)
+void token_buffer_adopt(CharBuffer &dst, CharBuffer &src)
 {
-	buffer.push_back(c);
-	return 0;
+	size_t used = src.pos ? src.current + 1 : 0;
+
+	assert(dst.string == NULL && src.string == NULL);
+	if (used == 0) {
+		return;
+	}
+
+	if (dst.pos == NULL) {
+		// `dst` has no blocks at all, so it simply carries on filling the
+		// last block of `src`.
+		dst.blocks.insert(dst.blocks.begin(), src.blocks.begin(), src.blocks.begin() + used);
+		dst.current = used - 1;
+		dst.pos = src.pos;
+		dst.limit = src.limit;
+	} else {
+		dst.blocks.insert(dst.blocks.begin() + dst.current,
+		                  src.blocks.begin(), src.blocks.begin() + used);
+		dst.current += used;
+	}
+
+	src.blocks.erase(src.blocks.begin(), src.blocks.begin() + used);
+	token_buffer_reset(src);
+}
+
+void token_result_reset(TokenResult &result)
+{
+	result.characters_processed = 0;
+	result.lines_processed = 0;
+	result.error = TokenError();
+	result.tokens.clear();
+	if (result.stream.shared) {
+		result.stream = TokenStream();
+	}
+	result.stream.types.clear();
+	result.stream.data.clear();
+	result.stream.offsets.clear();
+	result.source = NULL;
+	token_buffer_reset(result.buffer);
 }
 
 /**md
  *
- * ## Function `token_buffer_end`
+ * ### Function `token_stream_reserve`
+ *
+ * A typical line of Forth has a token for every 5 or 6 bytes of input, counting
+ * the whitespace in between. We reserve room for one every 6 bytes: if the
+ * guess is too small, the arrays simply grow as usual. A stream that already
+ * has some tokens at least doubles, just like it would when growing by
+ * itself.
  *
- * This ends the current buffer. It inserts a trailing null ('\0') character
- * into the buffer and returns a pointer to the end.
  */
 
-static inline void *token_buffer_end(std::vector<char>& buffer)
+void token_stream_reserve(TokenStream &stream, size_t size)
 {
-	buffer.push_back('\0');
-	return &buffer.back();
+	size_t count = stream.types.size() + size / 6 + 16;
+
+	// Many small inputs going into the same stream would otherwise make it
+	// grow by a little every time, moving all of it each time.
+	if (count <= stream.types.capacity()) {
+		return;
+	}
+	if (count < stream.types.capacity() * 2) {
+		count = stream.types.capacity() * 2;
+	}
+
+	stream.types.reserve(count);
+	stream.data.reserve(count);
+	if (stream.keep_offsets) {
+		stream.offsets.reserve(count);
+	}
 }
 
 /**md
@@ -822,7 +900,7 @@ static inline void *token_buffer_end(std::vector<char>& buffer)
  *
  */
 
-uint8_t states[TOKEN_STATE_SIZE][TOKEN_INPUT_SIZE] = {
+constexpr uint8_t states[TOKEN_STATE_SIZE][TOKEN_INPUT_SIZE] = {
 	/* TOKEN_STATE_ERROR */
 	// TODO Remove this from the list by setting it to -1.
 	{
@@ -920,22 +998,6 @@ uint8_t states[TOKEN_STATE_SIZE][TOKEN_INPUT_SIZE] = {
 		TOKEN_STATE_ERROR   // OTHER
 	},
 
-	/* TOKEN_STATE_DQUOTE_STRING */
-	{
-		TOKEN_STATE_ERROR,         // EOF
-		TOKEN_STATE_DQUOTE_STRING, // WHITESPACE
-		TOKEN_STATE_DQUOTE_STRING, // ALPHABET
-		TOKEN_STATE_DQUOTE_STRING, // NUMERIC
-		TOKEN_STATE_DQUOTE_STRING, // DOT
-		TOKEN_STATE_NONE,          // DOUBLEQUOTE
-		TOKEN_STATE_DQUOTE_STRING, // SINGLEQUOTE
-		TOKEN_STATE_DQUOTE_STRING, // SIGN
-		TOKEN_STATE_DQUOTE_STRING, // COLON
-		TOKEN_STATE_DQUOTE_STRING, // BACKSLASH
-		TOKEN_STATE_DQUOTE_STRING, // IDCHAR
-		TOKEN_STATE_DQUOTE_STRING, // OTHER
-	},
-
 	/* TOKEN_STATE_SQUOTE_STRING */
 	{
 		TOKEN_STATE_ERROR,         // EOF
@@ -952,9 +1014,25 @@ uint8_t states[TOKEN_STATE_SIZE][TOKEN_INPUT_SIZE] = {
 		TOKEN_STATE_SQUOTE_STRING, // OTHER
 	},
 
+	/* TOKEN_STATE_DQUOTE_STRING */
+	{
+		TOKEN_STATE_ERROR,         // EOF
+		TOKEN_STATE_DQUOTE_STRING, // WHITESPACE
+		TOKEN_STATE_DQUOTE_STRING, // ALPHABET
+		TOKEN_STATE_DQUOTE_STRING, // NUMERIC
+		TOKEN_STATE_DQUOTE_STRING, // DOT
+		TOKEN_STATE_NONE,          // DOUBLEQUOTE
+		TOKEN_STATE_DQUOTE_STRING, // SINGLEQUOTE
+		TOKEN_STATE_DQUOTE_STRING, // SIGN
+		TOKEN_STATE_DQUOTE_STRING, // COLON
+		TOKEN_STATE_DQUOTE_STRING, // BACKSLASH
+		TOKEN_STATE_DQUOTE_STRING, // IDCHAR
+		TOKEN_STATE_DQUOTE_STRING, // OTHER
+	},
+
 	/* TOKEN_STATE_ID */
 	{
-		TOKEN_STATE_ERROR,  // EOF
+		TOKEN_STATE_END,    // EOF
 		TOKEN_STATE_NONE,   // WHITESPACE
 		TOKEN_STATE_ID,     // ALPHABET
 		TOKEN_STATE_ID,     // NUMERIC
@@ -970,7 +1048,7 @@ uint8_t states[TOKEN_STATE_SIZE][TOKEN_INPUT_SIZE] = {
 
 	/* TOKEN_STATE_DEBUG */
 	{
-		TOKEN_STATE_ERROR,  // EOF
+		TOKEN_STATE_END,    // EOF
 		TOKEN_STATE_NONE,   // WHITESPACE
 		TOKEN_STATE_DEBUG,  // ALPHABET
 		TOKEN_STATE_DEBUG,  // NUMERIC
@@ -985,6 +1063,45 @@ uint8_t states[TOKEN_STATE_SIZE][TOKEN_INPUT_SIZE] = {
 	},
 };
 
+/**md
+ *
+ * ### Leaving Parts of the Language Out
+ *
+ * `states` is the whole machine, but a build may have been asked for a
+ * dialect with less of the language in it (see `TokenDialect` in
+ * tokenizer.hpp). The tokenizer itself runs on `token_states`, which is
+ * `states` with every transition the dialect doesn't have sent to `ERROR`
+ * instead. Without real numbers, for example, a `.` is an error wherever it
+ * appears, since `DOT` only ever leads to `REAL`. Without debug commands,
+ * `DEBUG` is still entered by a `:`, but any letter after it is an error, so
+ * only the bare `:` that starts a definition is left.
+ *
+ * The dialect is known at compile time, so this table is made at compile time
+ * as well. The states that are left out can then never be reached, and every
+ * case for them in `tokenize` starts by checking that with
+ * `token_dialect_has`. The compiler works that check out too, and drops the
+ * rest of the case. A build without debug commands likewise has no code left
+ * for building their names. The table itself still has a row for every state.
+ *
+ */
+
+typedef struct TokenStateTable {
+	uint8_t next[TOKEN_STATE_SIZE][TOKEN_INPUT_SIZE];
+
+	constexpr TokenStateTable(int dialect) : next()
+	{
+		for (int i = 0; i < TOKEN_STATE_SIZE; i++) {
+			for (int k = 0; k < TOKEN_INPUT_SIZE; k++) {
+				TokenState state = (TokenState) states[i][k];
+				next[i][k] = token_dialect_allows(dialect, (TokenState) i, state) ?
+				             state : TOKEN_STATE_ERROR;
+			}
+		}
+	}
+} TokenStateTable;
+
+static constexpr TokenStateTable token_states(BLINDFORTH_DIALECT);
+
 /**md
  *
  * ### Function `get_input` (unexported)
@@ -995,10 +1112,8 @@ uint8_t states[TOKEN_STATE_SIZE][TOKEN_INPUT_SIZE] = {
  *
  */
 
-TokenInput get_input(int input)
+constexpr TokenInput get_input(int input)
 {
-	TokenInput ret;
-
 	// We first try matching any of the single-character input types, then
 	// move on to the range-based ones.
 
@@ -1061,18 +1176,62 @@ TokenInput get_input(int input)
 		return TOKEN_INPUT_ALPHABET;
 	}
 
-	// Match a visible character
-
-	// TODO add UTF-8 Support here. A lookahead of at most 2 bytes is needed
-	// here.
+	// Match a visible character. Every byte of a multi-byte UTF-8 sequence is
+	// one, since the input has already been checked to be valid UTF-8 (see
+	// "Checking the Input is UTF-8" below), so the bytes can only come in whole
+	// characters. The characters U+0080 to U+00A0 are control characters
+	// and a space, but telling them apart would need the next byte, so we let
+	// them be visible too.
 
-	if ((input >= 0x21 && input <= 0x7E) || (input >= 0xA1)) {
+	if ((input >= 0x21 && input <= 0x7E) || (input >= 0x80 && input <= 0xFF)) {
 		return TOKEN_INPUT_IDCHAR;
 	}
 
 	return TOKEN_INPUT_OTHER;
 }
 
+/**md
+ *
+ * ### The Input Table
+ *
+ * `get_input` is called once for every single byte of the input, which makes
+ * it the most executed piece of code in the tokenizer. Running an EOF check, a
+ * `switch` and three range checks for every byte is a lot of work for
+ * something whose answer only depends on one of 256 possible byte values.
+ *
+ * So instead we ask `get_input` about every possible byte in advance, and
+ * store the answers in a 256 entry table, `token_input_table`. Classifying a
+ * byte then becomes a single array lookup:
+ *
+ *     token_input_table[(unsigned char) c]
+ *
+ * Since `get_input` is `constexpr`, the compiler fills the table in for us at
+ * compile time, so the table and the function can never disagree. `get_input`
+ * remains the place where the rules are written down.
+ *
+ * The table is built by passing each byte as an `unsigned char`, so that the
+ * bytes above `0x7F` are told apart from `EOF`.
+ *
+ */
+
+typedef struct TokenInputTable {
+	uint8_t input[256];
+
+	constexpr TokenInputTable() : input()
+	{
+		for (int i = 0; i < 256; i++) {
+			input[i] = get_input(i);
+		}
+	}
+} TokenInputTable;
+
+static constexpr TokenInputTable token_input_table;
+
+static inline TokenInput get_input_fast(char c)
+{
+	return (TokenInput) token_input_table.input[(unsigned char) c];
+}
+
 
 /**md
  *
@@ -1091,243 +1250,769 @@ TokenInput get_input(int input)
  *
  * ### Function `init_token` (unexported)
  *
- * This function set the token type to the supplied parameter and the token
- * data to zero. Note that setting token data to zero is unnecessary for a
+ * This function set the token type and offset to the supplied parameters and
+ * the token data to zero. Note that setting token data to zero is unnecessary for a
  * few of the token types (strings, other token types that need a pointer), so
  * this function may be broken down into a few other specialised functions for
  * other token types for the sake of efficiency.
  *
  */
 
-void init_token(Token &token, TokenType type)
+void init_token(Token &token, TokenType type, unsigned int offset)
 {
 	token.type = type;
+	token.offset = offset;
 	memset(&token.data, 0, sizeof(token.data));
 }
 
 /**md
  *
- * ### Function `build_int` (unexported)
+ * ### Converting Numbers
+ *
+ * Numbers used to be built one digit at a time, as the tokenizer read them. For
+ * integers, that meant a multiplication and an overflow check for every digit,
+ * and for reals, it didn't even give the right answer: dividing by a power of
+ * ten at the end rounds twice, and the integral part could not be any larger
+ * than an `int64`.
  *
- * This builds a standard base 10 integer from a string of characters in the way
- * you would expect. `c` is the current character to append to the token. The
- * return value returns a value less than 0 if the current token integer is
- * overflowing.
+ * Instead, the tokenizer now only follows the digits through the state machine,
+ * and converts the whole number at once when it reaches its end. The number's
+ * text is simply the span of input from the first symbol of the token (which
+ * may be its sign) up to where it ended. If a number is split between two
+ * pieces of input, the part in the earlier piece is kept aside in the
+ * `Tokenizer` (see `number_save` below).
+ *
+ * Both conversions rely on a trick to deal with 8 digits at once, from
+ * Daniel Lemire's `fast_float` library. We load 8 digits into a 64 bit word,
+ * and first check that all of them are digits: a byte is a digit if its top
+ * half is `3` and it stays below `0x40` when 6 is added to it. Then the digit
+ * values are combined in pairs, the pairs into fours and the fours into the
+ * final number, with one multiplication each.
+ *
+ * The bytes of a word loaded from memory are in reverse order on big endian
+ * machines, so we swap them around there first.
  *
  */
 
-int build_int(Token &token, int c)
+static inline uint64_t load_eight(const char *s)
 {
-	// A custom assert may be used later to allow for prettier printing and
-	// omission in release builds.
-	assert(c >= '0');
-	if (token.data.i >= (INT64_MAX - 9)) {
-		return -1;
-	}
-	token.data.i *= 10;
-	token.data.i += c - '0';
-	return 0;
+	uint64_t v;
+	memcpy(&v, s, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap64(v);
+#endif
+	return v;
+}
+
+static inline bool is_eight_digits(uint64_t v)
+{
+	return (((v & 0xF0F0F0F0F0F0F0F0) |
+	         (((v + 0x0606060606060606) & 0xF0F0F0F0F0F0F0F0) >> 4)) ==
+	        0x3333333333333333);
+}
+
+static inline uint32_t parse_eight_digits(uint64_t v)
+{
+	const uint64_t mask = 0x000000FF000000FF;
+	const uint64_t mul1 = 0x000F424000000064; // 100 + (1000000 << 32)
+	const uint64_t mul2 = 0x0000271000000001; // 1 + (10000 << 32)
+
+	v -= 0x3030303030303030;
+	v = (v * 10) + (v >> 8);
+	v = (((v & mask) * mul1) + (((v >> 16) & mask) * mul2)) >> 32;
+	return (uint32_t) v;
 }
 
 /**md
  *
- * ### Function `build_real` (unexported)
+ * ### Function `digit_span` (unexported)
+ *
+ * This returns the number of digits at the start of `s`, looking at no more
+ * than `n` bytes. `tokenize_fast` uses it to skip over the digits of a number
+ * in one go, in the same way as it skips over the bodies of strings.
  *
- * This *attempts* to build a standard IEEE 64 bit floating point. This function
- * is only used for adding the base 10 mantissa to the number. The integral part
- * is built by `build_int` until the tokenizer finds the dot.
+ */
+
+static inline size_t digit_span(const char *s, size_t n)
+{
+	size_t i = 0;
+
+	while (i + 8 <= n && is_eight_digits(load_eight(s + i))) {
+		i += 8;
+	}
+	while (i < n && s[i] >= '0' && s[i] <= '9') {
+		i++;
+	}
+	return i;
+}
+
+/**md
  *
- * Building a function that encompasses all the conformant representations of an
- * IEEE floating point number is pretty hard actually. They can have a
- * ridiculous amount of digits. Looking at the implementation of `atof` is a
- * good place to start.
+ * ### Function `parse_digits` (unexported)
  *
- * What this does is the following:
+ * This adds the `n` digits at `s` to `value`, eight at a time where it can.
+ * The caller makes sure the result fits in 64 bits.
  *
- * 1. At the start, the current `int64` is cast to a `double`.
- * 2. We then keep appending digits to the number as we did with `int`, while
- *    keeping track of the number of mantissa places.
- * 3. At the end of build, we divide the number by 10 to the power of the
- *    number of mantissa places
+ */
+
+static inline uint64_t parse_digits(uint64_t value, const char *s, size_t n)
+{
+	size_t i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+		value = value * 100000000 + parse_eight_digits(load_eight(s + i));
+	}
+	for (; i < n; i++) {
+		value = value * 10 + (s[i] - '0');
+	}
+	return value;
+}
+
+/**md
  *
- * There are a few obvious problems with this impelementation, for example
- * this does not allow the integram part of the number to be greater than
- * `INT64_MAX`.
+ * ### Function `convert_int` (unexported)
  *
- * ** *Correction Due:* **
+ * This converts the text of an integer token, with its sign if it has one, and
+ * returns a value less than 0 if it does not fit in an `int64`.
  *
- * Instead of doing the entire "build" phase thing, it may be just a better
- * idea to keep a string buffer instead, and once the token is complete,
- * perform the actual conversion.
+ * Any 19 digit number fits in an unsigned 64 bit integer, so after skipping
+ * the leading zeros, we only need to count the digits to know whether the
+ * conversion can overflow at all. A number with 19 digits is converted anyway,
+ * and then checked against the limit. Negative numbers may go one further than
+ * positive ones, down to `INT64_MIN`.
  *
  */
 
-int build_real(Token &token, int c)
+int convert_int(Token &token, const char *s, size_t n)
 {
-	// A custom assert may be used later to allow for prettier printing and
-	// omission in release builds.
-	assert(c >= '0');
-	if (token.data.r >= ( - 9)) {
+	bool negative = false;
+
+	if (n > 0 && (s[0] == '+' || s[0] == '-')) {
+		negative = (s[0] == '-');
+		s++;
+		n--;
+	}
+
+	while (n > 1 && s[0] == '0') {
+		s++;
+		n--;
+	}
+
+	if (n > 19) {
+		return -1;
+	}
+
+	uint64_t value = parse_digits(0, s, n);
+	uint64_t max = (uint64_t) INT64_MAX + (negative ? 1 : 0);
+
+	if (value > max) {
 		return -1;
 	}
-	token.data.i *= 10;
-	token.data.i += c - '0';
+
+	// Negating in unsigned arithmetic gives us INT64_MIN without overflowing.
+	token.data.i = (int64_t) (negative ? 0 - value : value);
 	return 0;
 }
 
-
 /**md
  *
- * ### Function `tokenize`
- *
- * This is the actual tokenizer function.
- *
- *
- * Note how we try to check for all of the actions. From the state diagram
- * you will notice that there are various actions that are self loops, and
- * almost all states go to NONE on completion. (etc. etc.)
- *
- * The flag `end` specifies whether or not this is the final segment that needs
- * to be processed.
- *
+ * ### Function `convert_real` (unexported)
  *
- * Another interesting thing you might notice is the file line counter I have
- * implemented here. You might be aware of the differences of the [types of
- * line ending markers that are used in different operating systems][line-endings],
- * which text editors (and programs like this one) need to account for.
+ * Converting a decimal number to the nearest `double` is hard to do correctly
+ * in general. Most numbers in a script are short though, and for those there
+ * is a simple way to do it exactly, known as Clinger's fast path.
  *
- * I attempt to implement that here as well, and if you look closely, that is
- * a finite state machine as well. Try drawing the state diagram of the line
- * counter to expose this fact more clearly.
- *
- * [line-endings]: https://en.wikipedia.org/wiki/Newline#Representation
+ * We first collect all the digits, on both sides of the dot, into one integer
+ * `w`, and count the number of digits `e` after the dot, so that the number is
+ * `w / 10^e`. If `w` is no larger than 2^53, it can be represented exactly as
+ * a `double`, and so can all the powers of ten up to 10^22. A single division
+ * of two exact values is correctly rounded by the hardware, so the result is
+ * the closest `double` to the number.
  *
+ * If the number has more digits than that, we leave it to `strtod`, which is
+ * slower but always correct. Since we only ever give it digits and a dot, it
+ * is not affected by the locale (apart from the symbol used for the dot, which
+ * is why we check that it has read the whole number).
  *
- * TODO add tokenizer state instead?
+ * The return value is less than 0 if the number is too large for a `double`.
  *
  */
 
-int tokenize(char *input, int size, bool end, TokenResult &result)
-{
-	TokenState curr_state = TOKEN_STATE_NONE;
-	Token token;
+static const double powers_of_ten[] = {
+	1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
 
-	bool line_ending_check = false;
-	unsigned int col_pos = 0;
+int convert_real(Token &token, const char *s, size_t n)
+{
+	const char *start = s;
+	size_t length = n;
+	bool negative = false;
+
+	if (n > 0 && (s[0] == '+' || s[0] == '-')) {
+		negative = (s[0] == '-');
+		s++;
+		n--;
+	}
 
-	CharBuffer &buffer = result.buffer;
+	const char *dot = (const char *) memchr(s, '.', n);
+	assert(dot);
 
-	result.characters_processed = 0;
-	result.lines_processed = 0;
+	const char *integral = s;
+	size_t integral_n = dot - s;
+	const char *fraction = dot + 1;
+	size_t fraction_n = n - integral_n - 1;
 
+	while (integral_n > 0 && integral[0] == '0') {
+		integral++;
+		integral_n--;
+	}
 
-	// state-specific variables
-	bool sign = false;
-
-	for (int i = 0; i < size; i++) {
-		TokenInput curr_input = get_input(input[i]);
-		TokenState next_state = (TokenState) states[curr_state][curr_input];
-		result.characters_processed++;
-
-		/**
-		 *
-		 * We have to count a line ending if:
-		 * - There's a sequence that looks like '\r' (Old MacOS)
-		 * - There's a sequence that looks like '\n' (New MacOS, Linux)
-		 * - There's a sequence that looks like '\r\n' (Windows)
-		 * This will cover virtually all of the platforms it will run on.
-		 *
-		 * Currently this doesn't run further analysis to determine the line
-		 * ending convention the file is using, so it will interpret all
-		 * such sequences as valid line endings.
-		 */
-		if (input[i] == '\n') {
-			line_ending_check = false;
-			result.lines_processed += 1;
-			col_pos = 0;
-		} else if (input[i] == '\r') {
-			// line_ending_check only gets activated on input being '\r'
-
-			// if previous was '\r' and current is '\r', then we incremeent the
-			// line counter and continue checking if there is next in the list.
-			if (line_ending_check) {
-				result.lines_processed += 1;
-				col_pos = 0;
-
-			// else if this is the first one, we turn on the line checker.
-			} else {
-				line_ending_check = true;
-			}
-		} else if (line_ending_check) {
-			// if its any other character, we stop the line checker if active
-			result.lines_processed += 1;
-			line_ending_check = false;
-			col_pos = 0;
-		} else {
-			// otherwise we increment the col pos
-			col_pos++;
+	// Leading zeros of the fraction only matter if there is no integral part.
+	size_t skipped = 0;
+	if (integral_n == 0) {
+		while (skipped < fraction_n && fraction[skipped] == '0') {
+			skipped++;
 		}
+	}
 
-		switch (next_state) {
-		case TOKEN_STATE_ERROR:
-			// If we encounter an error, the program collects what we know about
-			// the problem, where the problem is happening and sends it to the
-			// user.
-			result.error.col_pos = col_pos;
-			result.error.line_pos = result.lines_processed;
-			result.error.curr_guess = curr_state;
-			result.error.curr_input = curr_input;
-			result.error.curr_input_val = input[i];
-			return 1;
-			break;
-
-		case TOKEN_STATE_NONE:
-			// If there's nothing in the input, continue.
-			if (curr_state == next_state) {
-				continue;
-			}
+	if (integral_n + fraction_n - skipped <= 19 && fraction_n <= 22) {
+		uint64_t w = parse_digits(0, integral, integral_n);
+		w = parse_digits(w, fraction + skipped, fraction_n - skipped);
 
-			// Encountering a STATE_NONE means that the current token's content
-			// is over. We now need to end the token building.
-			switch (curr_state) {
-			case TOKEN_STATE_INT:
-				break;
-			case TOKEN_STATE_REAL:
-				break;
-			case TOKEN_STATE_SQUOTE_STRING:
-				break;
-			case TOKEN_STATE_DQUOTE_STRING:
-				break;
-			case TOKEN_STATE_ID:
-				break;
-			case TOKEN_STATE_DEBUG:
-				break;
+		if (w <= ((uint64_t) 1 << 53)) {
+			double r = (double) w / powers_of_ten[fraction_n];
+			token.data.r = negative ? -r : r;
+			return 0;
+		}
+	}
 
-			default:
-			//error here.
-				break;
-			}
-			break;
+	char small[64];
+	std::vector<char> large;
+	char *text = small;
 
-		case TOKEN_STATE_SIGN:
-			// Ideally this should be two states, not one. Instead of adding
-			// states called SIGN_PLUS and SIGN_MINUS, in this state we store
-			// the sign value in a separate boolean variable. if there is a
-			// minus sign, we turn on the sign value.
-			sign = true;
-			break;
+	if (length >= sizeof(small)) {
+		large.resize(length + 1);
+		text = large.data();
+	}
+	memcpy(text, start, length);
+	text[length] = '\0';
 
-		case TOKEN_STATE_INT:
-			// Check if currstate == nextstate. If so, build. If not, start.
+	char *stop = NULL;
+	double r = strtod(text, &stop);
+	assert(stop == text + length);
+
+	if (isinf(r)) {
+		return -1;
+	}
+
+	token.data.r = r;
+	return 0;
+}
+
+/**md
+ *
+ * ### Functions `number_save` and `number_end` (unexported)
+ *
+ * `number_save` is called at the end of every piece of input. If the tokenizer
+ * is in the middle of a number, it keeps the part of the number in this piece
+ * in `tokenizer.number`.
+ *
+ * `number_end` is called when a number has ended at position `i` of the
+ * current piece, and converts it. The number's text is normally all in the
+ * current piece, unless some of it has been saved before. A lone sign or dot is
+ * not a number, so there's nothing to do for those.
+ *
+ */
+
+static inline bool is_number_state(TokenState state)
+{
+	return token_dialect_has(BLINDFORTH_DIALECT, state) &&
+	       (state == TOKEN_STATE_SIGN || state == TOKEN_STATE_INT ||
+	        state == TOKEN_STATE_DOT || state == TOKEN_STATE_REAL);
+}
+
+static inline void number_save(Tokenizer &tokenizer, const Token &token,
+                               const char *input, int i, unsigned int base)
+{
+	unsigned int start = (token.offset > base) ? token.offset - base : 0;
+	tokenizer.number.insert(tokenizer.number.end(), input + start, input + i);
+}
+
+static inline int number_end(Tokenizer &tokenizer, TokenState state, Token &token,
+                             const char *input, int i, unsigned int base)
+{
+	const char *text = input + (token.offset - base);
+	size_t length = base + i - token.offset;
+	int ret = 0;
+
+	if (state != TOKEN_STATE_INT && state != TOKEN_STATE_REAL) {
+		tokenizer.number.clear();
+		return 0;
+	}
+
+	if (token.offset < base) {
+		number_save(tokenizer, token, input, i, base);
+		text = tokenizer.number.data();
+		length = tokenizer.number.size();
+	}
+
+	if (state == TOKEN_STATE_INT || !(BLINDFORTH_DIALECT & TOKEN_DIALECT_REAL)) {
+		ret = convert_int(token, text, length);
+	} else {
+		ret = convert_real(token, text, length);
+	}
+
+	tokenizer.number.clear();
+	return ret;
+}
+
+/**md
+ *
+ * ### Functions `start_text` and `build_text` (unexported)
+ *
+ * These start and extend the text of a string, identifier or debug command.
+ * Normally the text is copied into the buffer, one symbol at a time. With
+ * views, all we have to remember is where the text starts: everything up to
+ * the end of the token is part of it.
+ *
+ */
+
+static inline void start_text(Token &token, CharBuffer &buffer, unsigned int offset, bool views)
+{
+	if (views) {
+		token.data.v.offset = offset;
+		token.data.v.length = 0;
+	} else {
+		token.data.s = token_buffer_new(buffer);
+	}
+}
+
+static inline void build_text(CharBuffer &buffer, char c, bool views)
+{
+	if (!views) {
+		token_buffer_insert(buffer, c);
+	}
+}
+
+/**md
+ *
+ * ### Function `store_token` (unexported)
+ *
+ * This performs the ''Store'' action. It finishes off the token that was being
+ * built in the state `state` and appends it to the token list, or to the token
+ * stream with `TOKENIZE_STREAM`. `offset` is where the token ended. It returns
+ * a value less than 0 if there is nothing sensible to store.
+ *
+ * A sign that is directly followed by whitespace or the end of the input is not
+ * a number at all, but the identifier `+` or `-`, as in `1 2 +`.
+ *
+ * With `TOKENIZE_INTERN`, identifiers and debug commands are interned into
+ * `result.symbols` (see symbol.hpp), using the `hash` of their text that was
+ * worked out while reading them, and the token keeps only the symbol id. The
+ * text that was copied into the buffer for them isn't needed any more after
+ * that, so it is thrown away again.
+ *
+ */
+
+static inline void intern_text(Token &token, uint32_t hash, unsigned int offset,
+                               bool views, TokenResult &result)
+{
+	CharBuffer &buffer = result.buffer;
+	const char *text;
+	size_t length;
+
+	if (views) {
+		text = result.source + token.data.v.offset;
+		length = offset - token.data.v.offset;
+	} else {
+		text = buffer.string ? buffer.string : "";
+		length = buffer.pos - buffer.string;
+	}
+
+	token.data.sym = symbol_intern(*result.symbols, text, length, hash);
+
+	if (!views) {
+		token_buffer_discard(buffer);
+	}
+}
+
+int store_token(TokenState state, Token &token, char sign_char, uint32_t hash,
+                unsigned int offset, int mode, TokenResult &result)
+{
+	CharBuffer &buffer = result.buffer;
+	const bool views = mode & TOKENIZE_VIEWS;
+
+	switch (state) {
+	case TOKEN_STATE_SIGN:
+		init_token(token, TOKEN_TYPE_ID, token.offset);
+		if (mode & TOKENIZE_INTERN) {
+			token.data.sym = symbol_intern(*result.symbols, &sign_char, 1,
+			                               symbol_hash_step(SYMBOL_HASH_INIT, sign_char));
+			break;
+		}
+		start_text(token, buffer, token.offset, views);
+		build_text(buffer, sign_char, views);
+		if (views) {
+			token.data.v.length = 1;
+		} else {
+			token.data.s = token_buffer_end(buffer);
+		}
+		break;
+
+	case TOKEN_STATE_INT:
+	case TOKEN_STATE_REAL:
+		// These have already been converted by `number_end`.
+		break;
+
+	case TOKEN_STATE_ID:
+	case TOKEN_STATE_DEBUG:
+		if (mode & TOKENIZE_INTERN) {
+			intern_text(token, hash, offset, views, result);
+			break;
+		}
+		// fall through
+
+	case TOKEN_STATE_SQUOTE_STRING:
+	case TOKEN_STATE_DQUOTE_STRING:
+		if (views) {
+			token.data.v.length = offset - token.data.v.offset;
+		} else {
+			token.data.s = token_buffer_end(buffer);
+		}
+		break;
+
+	default:
+		return -1;
+		break;
+	}
+
+	if (mode & TOKENIZE_STREAM) {
+		token_stream_push(result.stream, token);
+	} else {
+		result.tokens.push_back(token);
+	}
+	TOKEN_COUNT(token_counters_local.tokens[token.type]++);
+	return 0;
+}
+
+/**md
+ *
+ * ### Function `tokenize`
+ *
+ * This is the actual tokenizer function.
+ *
+ *
+ * Note how we try to check for all of the actions. From the state diagram
+ * you will notice that there are various actions that are self loops, and
+ * almost all states go to NONE on completion. (etc. etc.)
+ *
+ * The flag `end` specifies whether or not this is the final segment that needs
+ * to be processed. If it is, the end of the segment is treated as an EOF.
+ *
+ * The return value is 1 when the tokenization is complete, 0 when more data
+ * is needed, and -1 if an error was encountered, in which case `result.error`
+ * describes it.
+ *
+ *
+ * Another interesting thing you might notice is that the tokenizer does not
+ * keep track of lines at all. You might be aware of the differences of the
+ * [types of line ending markers that are used in different operating
+ * systems][line-endings], which text editors (and programs like this one) need
+ * to account for.
+ *
+ * Counting them is a finite state machine of its own (try drawing its state
+ * diagram), and running it alongside ours would cost a few branches for every
+ * single byte. But we only ever need to know the line and column of something
+ * when we have to tell the user about it. So tokens and errors only record a
+ * byte offset, and the line counting is done separately, 64 bytes at a time, by
+ * the `LineIndex` functions in util.hpp. `tokenize` uses them to fill in
+ * `lines_processed`, and to find the line and column of an error.
+ *
+ * [line-endings]: https://en.wikipedia.org/wiki/Newline#Representation
+ *
+ *
+ * ## Feeding Input in Pieces
+ *
+ * Input doesn't always arrive all at once. It might be coming from a pipe or a
+ * socket, or be too large to keep around in one piece. So all of the state of
+ * the tokenizer lives in a `Tokenizer` (see tokenizer.hpp) rather than in local
+ * variables, and `tokenizer_feed` picks up exactly where the previous piece
+ * left off, even in the middle of a token. Offsets, `characters_processed` and
+ * `lines_processed` all count from the start of the first piece.
+ *
+ * `tokenize` is simply `tokenizer_feed` with a fresh `Tokenizer`.
+ *
+ * ## Not Copying Anything
+ *
+ * Strings and identifiers make up most of a typical script, and copying them
+ * one symbol at a time into the buffer means we end up with a second copy of
+ * most of the input. When the input is going to stay around anyway,
+ * `TOKENIZE_VIEWS` (and `tokenize_views`) avoid that: a token only remembers
+ * where its text starts, and its length once it ends. See `TokenView` in
+ * tokenizer.hpp.
+ *
+ * Since the offsets count from the start of the first piece of input, a token
+ * that is split up between two pieces needs no special treatment either, as
+ * long as the pieces follow on from each other in memory. Input that arrives in
+ * separate buffers (from a socket, say) is better off with the normal mode,
+ * which copies everything.
+ *
+ * ## Interning Identifiers
+ *
+ * With `TOKENIZE_INTERN`, every identifier and debug command is looked up in a
+ * `SymbolTable` (see symbol.cpp) when it ends, and the token stores its symbol
+ * id in `data.sym` instead of its text. The hash the table needs is worked out
+ * one symbol at a time in the `ID` and `DEBUG` states, as the text is read, so
+ * the lookup itself only has to compare the name once, if at all.
+ *
+ * The table is not part of the result. It is set by the caller as
+ * `result.symbols`, so that the same one can be used for every input of a
+ * program, and a word gets the same id wherever it appears. `tokenize_interned`
+ * is `tokenize_views` with this mode added.
+ *
+ * ## Splitting Up the Tokens
+ *
+ * With `TOKENIZE_STREAM`, tokens go into `result.stream` (see `TokenStream` in
+ * tokenizer.hpp), which keeps their types, data and offsets in separate
+ * arrays. It is reserved from the size of the first piece of input, so for a
+ * whole file the arrays are usually allocated only once. `tokenize_stream` is
+ * `tokenize_views` with this mode added.
+ *
+ *
+ * ## The Compiled DFA
+ *
+ * Every byte costs us two lookups that depend on each other: first the input
+ * class from `token_input_table`, then the next state from `states`. Since
+ * both of them are fixed at compile time, we can also join them into a single
+ * table that is indexed by the state and the raw byte directly:
+ *
+ *     token_dfa.next[state][byte] == token_states.next[state][token_input_table[byte]]
+ *
+ * The `ERROR` and `END` states are never the current state (the tokenizer
+ * stops as soon as it reaches them), so they don't need a row here. The table
+ * is 9 rows of 256 states each.
+ *
+ * `tokenize_dfa` uses this table. Apart from the lookup, it runs exactly the
+ * same code as `tokenize`, so both produce identical results. The input class
+ * is only needed when reporting an error, so it is looked up only then.
+ *
+ * ## Skipping Ahead
+ *
+ * Most of the time in a real script is spent in three states that loop on
+ * themselves: `NONE` while reading indentation, and the two string states
+ * while reading the body of a string. In all three, every byte goes through
+ * the whole machinery just to end up in the same state again.
+ *
+ * `tokenize_fast` handles those runs differently. When it is in one of these
+ * states, it asks `util_whitespace_span` or `util_string_span` how many of the
+ * following bytes keep it there. Those functions look at 16 or 32 bytes at a
+ * time using whatever vector instructions the CPU has. The whole run is then
+ * skipped at once, and a string body gets copied into the buffer in one go.
+ *
+ * Since numbers are only converted once they are over, the digits of a number
+ * are skipped in the same way, using `digit_span`.
+ *
+ */
+
+#define TOKEN_DFA_ROWS (TOKEN_STATE_END - TOKEN_STATE_NONE)
+
+typedef struct TokenDfaTable {
+	uint8_t next[TOKEN_DFA_ROWS][256];
+
+	constexpr TokenDfaTable() : next()
+	{
+		for (int i = 0; i < TOKEN_DFA_ROWS; i++) {
+			for (int c = 0; c < 256; c++) {
+				next[i][c] = token_states.next[i + TOKEN_STATE_NONE][token_input_table.input[c]];
+			}
+		}
+	}
+} TokenDfaTable;
+
+static constexpr TokenDfaTable token_dfa;
+
+// Fills in `result.error` for an error at `offset`. `lines` must have seen
+// the input up to and including the erroneous byte.
+static void set_error(Tokenizer &tokenizer, const LineCounter &lines, unsigned int offset,
+                      TokenState state, TokenInput input, char c, TokenResult &result)
+{
+	result.error.curr_offset = offset;
+	result.error.curr_guess = state;
+	result.error.curr_input = input;
+	result.error.curr_input_val = c;
+	line_counter_resolve(lines, offset, result.error.line_pos, result.error.col_pos);
+	result.lines_processed = line_counter_lines(lines, false);
+	result.characters_processed = offset;
+	tokenizer.state = TOKEN_STATE_ERROR;
+}
+
+template <int mode>
+static int tokenizer_feed_impl(Tokenizer &tokenizer, char *input, int size,
+                               bool end, TokenResult &result)
+{
+	// We work on local copies of the tokenizer's state, which the compiler
+	// can keep in registers, and put them back when we leave.
+	TokenState curr_state = tokenizer.state;
+	Token token = tokenizer.token;
+	unsigned int base = tokenizer.offset;
+	int ret = 0;
+
+	CharBuffer &buffer = result.buffer;
+
+	// state-specific variables
+	char sign_char = tokenizer.sign_char;
+	uint32_t hash = tokenizer.hash;
+
+	// If this is the last segment, we go one step past the end of the input to
+	// feed the tokenizer an EOF.
+	int limit = end ? size + 1 : size;
+	int i;
+
+	const bool views = mode & TOKENIZE_VIEWS;
+	const int dialect = BLINDFORTH_DIALECT;
+
+	// A tokenizer that is already done stays done.
+	if (curr_state == TOKEN_STATE_END) {
+		return 1;
+	} else if (curr_state == TOKEN_STATE_ERROR) {
+		return -1;
+	}
+
+	// Views are offsets from the start of the first piece, so every piece
+	// has to follow on directly from the previous one.
+	if (views) {
+		if (base == 0) {
+			result.source = input;
+		}
+		assert(input == result.source + base);
+	}
+
+	if (mode & TOKENIZE_INTERN) {
+		assert(result.symbols);
+	}
+
+	if ((mode & TOKENIZE_STREAM) && base == 0) {
+		token_stream_reserve(result.stream, size);
+	}
+
+	for (i = 0; i < limit; i++) {
+		if ((mode & TOKENIZE_SKIP) && i < size) {
+			size_t n = 0;
+
+			switch (curr_state) {
+			case TOKEN_STATE_NONE:
+				// Most tokens are followed by a single space, which has
+				// already been read. Only start a scan if there's more.
+				if (get_input_fast(input[i]) == TOKEN_INPUT_WHITESPACE) {
+					n = util_whitespace_span(input + i, size - i);
+				}
+				break;
+			case TOKEN_STATE_SQUOTE_STRING:
+				n = util_string_span(input + i, size - i, '\'');
+				if (!views) {
+					token_buffer_insert_span(buffer, input + i, n);
+				}
+				break;
+			case TOKEN_STATE_DQUOTE_STRING:
+				n = util_string_span(input + i, size - i, '\"');
+				if (!views) {
+					token_buffer_insert_span(buffer, input + i, n);
+				}
+				break;
+			case TOKEN_STATE_INT:
+			case TOKEN_STATE_REAL:
+				n = digit_span(input + i, size - i);
+				break;
+			default:
+				break;
+			}
+
+			i += n;
+			TOKEN_COUNT(token_counters_local.skipped[curr_state] += n);
+
+			if (i >= limit) {
+				break;
+			}
+		}
+
+		char c = (i < size) ? input[i] : '\0';
+		TokenInput curr_input = TOKEN_INPUT_EOF;
+		TokenState next_state;
+
+		if (mode & TOKENIZE_DFA) {
+			next_state = (TokenState)
+				token_dfa.next[curr_state - TOKEN_STATE_NONE][(unsigned char) c];
+		} else {
+			curr_input = get_input_fast(c);
+			next_state = (TokenState) token_states.next[curr_state][curr_input];
+		}
+
+		TOKEN_COUNT(token_counters_local.bytes[curr_state]++);
+		TOKEN_COUNT(token_counters_local.inputs[get_input_fast(c)]++);
+		TOKEN_COUNT(token_counters_local.transitions[curr_state][next_state] +=
+		            (curr_state != next_state));
+
+		switch (next_state) {
+		case TOKEN_STATE_ERROR:
+			// If we encounter an error, the program collects what we know about
+			// the problem, where the problem is happening and sends it to the
+			// user.
+			goto error;
+			break;
+
+		case TOKEN_STATE_NONE:
+			// If there's nothing in the input, continue.
+			if (curr_state == next_state) {
+				continue;
+			}
+
+			// Encountering a STATE_NONE means that the current token's content
+			// is over. We now need to end the token building.
+			if (is_number_state(curr_state) &&
+			    number_end(tokenizer, curr_state, token, input, i, base) < 0) {
+				goto error;
+			}
+			store_token(curr_state, token, sign_char, hash, base + i, mode, result);
+			break;
+
+		case TOKEN_STATE_SIGN:
+			// The sign is part of the number's text, and is read again when
+			// the number is converted. We only remember which one it was, in
+			// case it turns out to be an identifier.
+			init_token(token, TOKEN_TYPE_INT, base + i);
+			sign_char = c;
+			break;
+
+		case TOKEN_STATE_INT:
+			// The digits themselves are only read once the number is over.
+			if (curr_state == TOKEN_STATE_NONE) {
+				init_token(token, TOKEN_TYPE_INT, base + i);
+			}
+			break;
 
 		case TOKEN_STATE_DOT:
 			// We don't have to do anything here. Just wait for the state
-			// machine to pick the correct thing wrt input
+			// machine to pick the correct thing wrt input.
+			if (!token_dialect_has(dialect, next_state)) {
+				goto error;
+			}
+			if (curr_state == TOKEN_STATE_NONE) {
+				init_token(token, TOKEN_TYPE_INT, base + i);
+			}
+
+			token.type = TOKEN_TYPE_REAL;
+			break;
 
 		case TOKEN_STATE_REAL:
 			// Check if currstate == nextstate. If so, build. If not, start.
 			// In all cases, currstate should be STATE_DOT here. Add a debug
 			// check for that.
+			if (!token_dialect_has(dialect, next_state)) {
+				goto error;
+			}
+			assert(curr_state == TOKEN_STATE_DOT || curr_state == TOKEN_STATE_REAL);
+			break;
 
 		case TOKEN_STATE_SQUOTE_STRING:
 			// Check if currstate == nextstate. If so, build. If not, start.
@@ -1338,9 +2023,29 @@ int tokenize(char *input, int size, bool end, TokenResult &result)
 			// Check if currstate == nextstate. If so, build. If not, start.
 			// Unlike the other cases here, the start phase only results in the
 			// creation of an empty string with no addition of data.
+			if (!token_dialect_has(dialect, next_state)) {
+				goto error;
+			}
+			if (curr_state == next_state) { // build
+				build_text(buffer, c, views);
+			} else { // start
+				init_token(token, TOKEN_TYPE_STRING, base + i);
+				start_text(token, buffer, base + i + 1, views);
+			}
+			break;
 
 		case TOKEN_STATE_ID:
 			// Check if currstate == nextstate. If so, build. If not, start.
+			if (curr_state != next_state) { // start
+				init_token(token, TOKEN_TYPE_ID, base + i);
+				start_text(token, buffer, base + i, views);
+				hash = SYMBOL_HASH_INIT;
+			}
+			build_text(buffer, c, views);
+			if (mode & TOKENIZE_INTERN) {
+				hash = symbol_hash_step(hash, c);
+			}
+			break;
 
 		case TOKEN_STATE_DEBUG:
 			// Check if currstate == nextstate. If so, build. If not, start.
@@ -1348,15 +2053,35 @@ int tokenize(char *input, int size, bool end, TokenResult &result)
 			// creation of the token entry but the identifier remains empty at
 			// the start
 			if (curr_state == next_state) { // build
-
+				// Never the case without debug commands.
+				if (!(dialect & TOKEN_DIALECT_DEBUG)) {
+					goto error;
+				}
+				build_text(buffer, c, views);
+				if (mode & TOKENIZE_INTERN) {
+					hash = symbol_hash_step(hash, c);
+				}
+			} else { // start building
+				init_token(token, TOKEN_TYPE_DEBUG_COMMAND, base + i);
+				start_text(token, buffer, base + i + 1, views);
+				hash = SYMBOL_HASH_INIT;
 			}
-			// start building
 			break;
 
 
 		case TOKEN_STATE_END:
-			// By returning 1, we signify that we are done with the tokenization
-			return 1;
+			// Store whatever was left over, and by returning 1, we signify that
+			// we are done with the tokenization
+			if (is_number_state(curr_state) &&
+			    number_end(tokenizer, curr_state, token, input, i, base) < 0) {
+				goto error;
+			}
+			if (curr_state != TOKEN_STATE_NONE) {
+				store_token(curr_state, token, sign_char, hash, base + i, mode, result);
+			}
+			curr_state = TOKEN_STATE_END;
+			ret = 1;
+			goto out;
 			break;
 
 		default:
@@ -1365,11 +2090,382 @@ int tokenize(char *input, int size, bool end, TokenResult &result)
 			break;
 		}
 
+		curr_state = next_state;
+		continue;
+
+	error:
+		// This is also where we end up if a number does not fit in the token.
+		if (mode & TOKENIZE_DFA) {
+			curr_input = get_input_fast(c);
+		}
+
+		// The line counter only knows about the previous pieces of input.
+		// We give a copy of it everything up to and including the erroneous
+		// byte to find out where it is.
+		{
+			LineCounter lines = tokenizer.lines;
+			line_counter_append(lines, input, (i < size) ? i + 1 : size);
+			set_error(tokenizer, lines, base + i, curr_state, curr_input, c, result);
+		}
+		return -1;
 	}
 
 	// By returning 0, we signify that we need more data to complete the
 	// tokenization of the current input.
+	ret = 0;
 
-	// Will control ever jump here?
-	return 0;
-}
\ No newline at end of file
+out:
+	// `i` is the number of bytes of this piece that were processed. Unless
+	// the input contained an EOF, that is all of it.
+	if (i > size) {
+		i = size;
+	}
+
+	if (ret == 0 && is_number_state(curr_state)) {
+		number_save(tokenizer, token, input, i, base);
+	}
+
+	line_counter_append(tokenizer.lines, input, i);
+	tokenizer.offset = base + i;
+	result.characters_processed = tokenizer.offset;
+	result.lines_processed = line_counter_lines(tokenizer.lines, ret == 1);
+
+	tokenizer.state = curr_state;
+	tokenizer.token = token;
+	tokenizer.sign_char = sign_char;
+	tokenizer.hash = hash;
+	return ret;
+}
+
+// Each combination of modes gets its own copy of the loop with the mode known
+// at compile time, so that the checks on it disappear.
+typedef int (*TokenizerFeedFn)(Tokenizer &, char *, int, bool, TokenResult &);
+
+template <size_t... modes>
+static constexpr std::array<TokenizerFeedFn, sizeof...(modes)>
+make_feed_fns(std::index_sequence<modes...>)
+{
+	return {{ tokenizer_feed_impl<modes>... }};
+}
+
+static constexpr std::array<TokenizerFeedFn, TOKENIZE_MODE_SIZE> tokenizer_feed_fns =
+	make_feed_fns(std::make_index_sequence<TOKENIZE_MODE_SIZE>());
+
+/**md
+ *
+ * ### Checking the Input is UTF-8
+ *
+ * The machine treats every byte of a multi-byte character as `IDCHAR`, which
+ * lets identifiers be written in any script without the tokenizer having to
+ * decode anything. That only works if the bytes really do make up valid
+ * characters, so before a piece of input is tokenized, `util_utf8_span` checks
+ * it. It skips any block of pure ASCII at once, which is most of any input,
+ * and only looks at the sequences in the other blocks, with vector
+ * instructions where the CPU has them.
+ *
+ * The piece is then tokenized up to the first byte that isn't valid, which is
+ * reported as an error, just as if the machine had run into it. A character
+ * cut off by the end of a piece is carried over to the next piece in
+ * `tokenizer.utf8`, and is an error only if the input ends with it.
+ *
+ */
+
+// Returns false if `input` isn't valid UTF-8, with `valid` set to the offset of
+// the first byte that isn't. That is `size` for a character cut off by the end
+// of the input.
+static bool utf8_check(Tokenizer &tokenizer, const char *input, size_t size, bool end,
+                       size_t &valid)
+{
+	size_t i = 0, len, n;
+
+	// An empty piece, which may well be NULL, only matters if it ends the
+	// input in the middle of a character.
+	if (size == 0) {
+		valid = 0;
+		return !(end && tokenizer.utf8_size);
+	}
+
+	if (tokenizer.utf8_size) {
+		size_t have = tokenizer.utf8_size;
+		size_t take = (size < 4 - have) ? size : 4 - have;
+		char seq[4];
+
+		memcpy(seq, tokenizer.utf8, have);
+		memcpy(seq + have, input, take);
+		n = util_utf8_sequence(seq, have + take, len);
+		if (n < len && n == have + take && !end) {
+			memcpy(tokenizer.utf8 + have, input, take);
+			tokenizer.utf8_size += take;
+			valid = size;
+			return true;
+		} else if (n < len) {
+			valid = n - have;
+			return false;
+		}
+		i = len - have;
+		tokenizer.utf8_size = 0;
+	}
+
+	i += util_utf8_span(input + i, size - i);
+	if (i < size) {
+		n = util_utf8_sequence(input + i, size - i, len);
+		if (n == size - i && !end) {
+			memcpy(tokenizer.utf8, input + i, n);
+			tokenizer.utf8_size = n;
+			valid = size;
+			return true;
+		}
+		valid = i + n;
+		return false;
+	}
+
+	valid = size;
+	return true;
+}
+
+static inline int tokenizer_feed_mode(Tokenizer &tokenizer, char *input, int size,
+                                      bool end, TokenResult &result)
+{
+	return tokenizer_feed_fns[tokenizer.mode & (TOKENIZE_MODE_SIZE - 1)](
+		tokenizer, input, size, end, result);
+}
+
+// Runs the tokenizer on the input that is valid UTF-8, and reports the rest
+// as an error.
+static int tokenizer_feed_checked(Tokenizer &tokenizer, char *input, int size,
+                                  bool end, TokenResult &result)
+{
+	if (tokenizer.state == TOKEN_STATE_END || tokenizer.state == TOKEN_STATE_ERROR) {
+		return tokenizer_feed_mode(tokenizer, input, size, end, result);
+	}
+
+	size_t valid;
+	if (utf8_check(tokenizer, input, size, end, valid)) {
+		return tokenizer_feed_mode(tokenizer, input, size, end, result);
+	}
+
+	int ret = tokenizer_feed_mode(tokenizer, input, valid, false, result);
+	if (ret != 0) {
+		return ret;
+	}
+
+	char c = (valid < (size_t) size) ? input[valid] : '\0';
+	LineCounter lines = tokenizer.lines;
+	line_counter_append(lines, input + valid, (valid < (size_t) size) ? 1 : 0);
+	set_error(tokenizer, lines, tokenizer.offset, tokenizer.state, TOKEN_INPUT_OTHER, c, result);
+	return -1;
+}
+
+int tokenizer_feed(Tokenizer &tokenizer, char *input, int size, bool end, TokenResult &result)
+{
+#ifdef BLINDFORTH_PROFILE
+	token_counters_local.feeds++;
+	int ret = tokenizer_feed_checked(tokenizer, input, size, end, result);
+	token_counters_flush();
+	return ret;
+#else
+	return tokenizer_feed_checked(tokenizer, input, size, end, result);
+#endif
+}
+
+static const char *const token_state_names[TOKEN_STATE_SIZE] = {
+	"ERROR", "NONE", "SIGN", "INT", "DOT", "REAL",
+	"SQUOTE_STRING", "DQUOTE_STRING", "ID", "DEBUG", "END",
+};
+
+static const char *const token_input_names[TOKEN_INPUT_SIZE] = {
+	"EOF", "WHITESPACE", "ALPHABET", "NUMERIC", "DOT", "DOUBLEQUOTE",
+	"SINGLEQUOTE", "SIGN", "COLON", "BACKSLASH", "IDCHAR", "OTHER",
+};
+
+/**md
+ *
+ * ### Drawing the Transition Matrix
+ *
+ * `tokenizer_graphviz` draws `token_states` as a graph for Graphviz, so that
+ * the machine of the dialect that was built can be looked at as a whole, like
+ * the diagrams earlier on. Every
+ * input that takes a state to the same next state goes on one edge, or else
+ * an edge in the graph would be drawn for each of the inputs in a row, most of
+ * them to `TOKEN_STATE_ERROR`. Nothing leaves `TOKEN_STATE_ERROR` or
+ * `TOKEN_STATE_END`, so their rows aren't drawn.
+ *
+ * With the number of times each edge was taken (see `token_counters_edges`),
+ * every edge is labelled with its count, and drawn thicker the more it was
+ * taken, on a logarithmic scale. This shows which states the tokenizer
+ * spends its time in for some input, and so which are worth a faster path.
+ * Without counts, the edges to `TOKEN_STATE_ERROR` are drawn faintly instead,
+ * and with them, the edges that were never taken.
+ *
+ */
+
+void tokenizer_graphviz(FILE *f, const uint64_t (*hits)[TOKEN_STATE_SIZE])
+{
+	Graphviz graph(f);
+	uint64_t max = 0;
+
+	graph.start("tokenizer");
+	for (int i = 0; i < TOKEN_STATE_SIZE; i++) {
+		if (!token_dialect_has(BLINDFORTH_DIALECT, (TokenState) i)) {
+			continue;
+		} else if (i == TOKEN_STATE_ERROR) {
+			graph.trap(i, token_state_names[i]);
+		} else if (i == TOKEN_STATE_END) {
+			graph.accept(i, token_state_names[i]);
+		} else {
+			graph.node(i, token_state_names[i]);
+		}
+	}
+
+	for (int i = 0; hits && i < TOKEN_STATE_SIZE; i++) {
+		for (int j = 0; j < TOKEN_STATE_SIZE; j++) {
+			max = (hits[i][j] > max) ? hits[i][j] : max;
+		}
+	}
+
+	for (int i = 0; i < TOKEN_STATE_SIZE; i++) {
+		if (i == TOKEN_STATE_ERROR || i == TOKEN_STATE_END ||
+		    !token_dialect_has(BLINDFORTH_DIALECT, (TokenState) i)) {
+			continue;
+		}
+
+		for (int j = 0; j < TOKEN_STATE_SIZE; j++) {
+			std::string label;
+			int width;
+
+			for (int k = 0; k < TOKEN_INPUT_SIZE; k++) {
+				if (token_states.next[i][k] == j) {
+					label += label.empty() ? "" : ", ";
+					label += token_input_names[k];
+				}
+			}
+			if (label.empty()) {
+				continue;
+			}
+
+			if (!hits) {
+				width = (j == TOKEN_STATE_ERROR) ? 0 : 1;
+			} else if (hits[i][j] == 0) {
+				width = 0;
+			} else {
+				width = (max > 1) ? 1 + (int) (7 * log((double) hits[i][j]) / log((double) max)) : 1;
+				label += "\\n" + std::to_string(hits[i][j]);
+			}
+
+			graph.edge(i, j, label.c_str(), width);
+		}
+	}
+	graph.end();
+}
+
+#ifdef BLINDFORTH_PROFILE
+
+static const char *const token_type_names[TOKEN_TYPE_SIZE] = {
+	"NONE", "INT", "REAL", "STRING", "ID", "DEBUG_COMMAND",
+};
+
+TokenCounters token_counters_get()
+{
+	std::lock_guard<std::mutex> lock(token_counters_mutex);
+	return token_counters_total;
+}
+
+void token_counters_reset()
+{
+	std::lock_guard<std::mutex> lock(token_counters_mutex);
+	memset(&token_counters_total, 0, sizeof(token_counters_total));
+}
+
+void token_counters_write(CounterWriter &w)
+{
+	TokenCounters counters = token_counters_get();
+
+	counter_write(w, "blindforth_tokenizer_feeds_total", counters.feeds, NULL, NULL);
+	for (int i = 0; i < TOKEN_STATE_SIZE; i++) {
+		counter_write(w, "blindforth_tokenizer_bytes_total", counters.bytes[i],
+		              "state", token_state_names[i]);
+	}
+	for (int i = 0; i < TOKEN_STATE_SIZE; i++) {
+		counter_write(w, "blindforth_tokenizer_skipped_bytes_total", counters.skipped[i],
+		              "state", token_state_names[i]);
+	}
+	for (int i = 0; i < TOKEN_INPUT_SIZE; i++) {
+		counter_write(w, "blindforth_tokenizer_inputs_total", counters.inputs[i],
+		              "input", token_input_names[i]);
+	}
+	for (int i = 0; i < TOKEN_STATE_SIZE; i++) {
+		for (int j = 0; j < TOKEN_STATE_SIZE; j++) {
+			if (counters.transitions[i][j]) {
+				counter_write(w, "blindforth_tokenizer_transitions_total",
+				              counters.transitions[i][j],
+				              "from", token_state_names[i], "to", token_state_names[j]);
+			}
+		}
+	}
+	for (int i = 0; i < TOKEN_TYPE_SIZE; i++) {
+		counter_write(w, "blindforth_tokenizer_tokens_total", counters.tokens[i],
+		              "type", token_type_names[i]);
+	}
+	counter_write(w, "blindforth_tokenizer_buffer_strings_total", counters.buffer_strings, NULL, NULL);
+	counter_write(w, "blindforth_tokenizer_buffer_moves_total", counters.buffer_moves, NULL, NULL);
+	counter_write(w, "blindforth_tokenizer_buffer_blocks_total", counters.buffer_blocks, NULL, NULL);
+	counter_write(w, "blindforth_tokenizer_buffer_bytes_total", counters.buffer_bytes, NULL, NULL);
+}
+
+void token_counters_edges(const TokenCounters &counters,
+                          uint64_t hits[TOKEN_STATE_SIZE][TOKEN_STATE_SIZE])
+{
+	for (int i = 0; i < TOKEN_STATE_SIZE; i++) {
+		// Every byte read one at a time in a state either leaves it, or stays,
+		// and the bytes skipped over all stay.
+		uint64_t left = 0;
+		for (int j = 0; j < TOKEN_STATE_SIZE; j++) {
+			hits[i][j] = counters.transitions[i][j];
+			left += (i != j) ? counters.transitions[i][j] : 0;
+		}
+		hits[i][i] = counters.bytes[i] - left + counters.skipped[i];
+	}
+}
+
+#endif
+
+void tokenizer_reset(Tokenizer &tokenizer)
+{
+	tokenizer = Tokenizer(tokenizer.mode);
+}
+
+int tokenize(char *input, int size, bool end, TokenResult &result)
+{
+	Tokenizer tokenizer(TOKENIZE_REFERENCE);
+	return tokenizer_feed(tokenizer, input, size, end, result);
+}
+
+int tokenize_dfa(char *input, int size, bool end, TokenResult &result)
+{
+	Tokenizer tokenizer(TOKENIZE_DFA);
+	return tokenizer_feed(tokenizer, input, size, end, result);
+}
+
+int tokenize_fast(char *input, int size, bool end, TokenResult &result)
+{
+	Tokenizer tokenizer(TOKENIZE_DFA | TOKENIZE_SKIP);
+	return tokenizer_feed(tokenizer, input, size, end, result);
+}
+
+int tokenize_views(char *input, int size, bool end, TokenResult &result)
+{
+	Tokenizer tokenizer(TOKENIZE_DFA | TOKENIZE_SKIP | TOKENIZE_VIEWS);
+	return tokenizer_feed(tokenizer, input, size, end, result);
+}
+
+int tokenize_stream(char *input, int size, bool end, TokenResult &result)
+{
+	Tokenizer tokenizer(TOKENIZE_DFA | TOKENIZE_SKIP | TOKENIZE_VIEWS | TOKENIZE_STREAM);
+	return tokenizer_feed(tokenizer, input, size, end, result);
+}
+
+int tokenize_interned(char *input, int size, bool end, TokenResult &result)
+{
+	Tokenizer tokenizer(TOKENIZE_DFA | TOKENIZE_SKIP | TOKENIZE_VIEWS | TOKENIZE_INTERN);
+	return tokenizer_feed(tokenizer, input, size, end, result);
+}
@@ -0,0 +1,671 @@
+/**
+ *
+ * tokenizer.hpp - Types and functions exported by the tokenizer
+ *
+ * Copyright (c) 2022 Anamitra Ghorui
+ *
+ * LICENSE_HERE
+ *
+ */
+
+#ifndef BLINDFORTH_TOKENIZER_HPP
+#define BLINDFORTH_TOKENIZER_HPP
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utility>
+#include <vector>
+
+#include "symbol.hpp"
+#include "util.hpp"
+
+/**md
+ *
+ * Tokenizer Types
+ * ===============
+ *
+ * This file is a companion to `tokenizer.cpp`. It holds the types the tokenizer
+ * works with, so that the later stages can use them too. The reasoning behind
+ * each of them is explained in `tokenizer.cpp`, just before the point where it
+ * sends you here.
+ *
+ */
+
+/**md
+ *
+ * ### `enum TokenType`
+ *
+ * `TokenType` lists all of the types of tokens that the tokenizer output will
+ * contain. This includes all the types I discussed earlier, and a default
+ * "none" value that might come in handy.
+ *
+ */
+
+typedef enum TokenType {
+	TOKEN_TYPE_NONE          = 0,
+	TOKEN_TYPE_INT           = 1,
+	TOKEN_TYPE_REAL          = 2,
+	TOKEN_TYPE_STRING        = 3,
+	TOKEN_TYPE_ID            = 4,
+	TOKEN_TYPE_DEBUG_COMMAND = 5,
+	TOKEN_TYPE_SIZE // This simply marks the number of enum values
+} TokenType;
+
+/**md
+ *
+ * ### `enum TokenState`
+ *
+ * `TokenState` lists all the states that the tokenizer will be in. One slight
+ * deviation I have made here is that there are separate states for maintaining
+ * single-quoted strings and double-quoted strings. This simplifies our code
+ * slightly by not having to maintain a variable to remember whether this is
+ * a single or double quoted string.
+ *
+ */
+
+typedef enum TokenState {
+	TOKEN_STATE_ERROR         = 0,
+	TOKEN_STATE_NONE          = 1,
+	TOKEN_STATE_SIGN          = 2,
+	TOKEN_STATE_INT           = 3,
+	TOKEN_STATE_DOT           = 4,
+	TOKEN_STATE_REAL          = 5,
+	TOKEN_STATE_SQUOTE_STRING = 6,
+	TOKEN_STATE_DQUOTE_STRING = 7,
+	TOKEN_STATE_ID            = 8,
+	TOKEN_STATE_DEBUG         = 9,
+	TOKEN_STATE_END           = 10,
+	TOKEN_STATE_SIZE // This simply marks the number of enum values
+} TokenState;
+
+/**md
+ *
+ * ### `struct TokenInput`
+ *
+ * `TokenInput` contains the possible types of input that the tokenizer will
+ * receive.
+ *
+ */
+
+
+typedef enum TokenInput {
+	TOKEN_INPUT_EOF         = 0,
+	TOKEN_INPUT_WHITESPACE  = 1,
+	TOKEN_INPUT_ALPHABET    = 2,
+	TOKEN_INPUT_NUMERIC     = 3,
+	TOKEN_INPUT_DOT         = 4,
+	TOKEN_INPUT_DOUBLEQUOTE = 5,
+	TOKEN_INPUT_SINGLEQUOTE = 6,
+	TOKEN_INPUT_SIGN        = 7,
+	TOKEN_INPUT_COLON       = 8,
+	TOKEN_INPUT_BACKSLASH   = 9, // unused for now.
+	TOKEN_INPUT_IDCHAR      = 10,
+	TOKEN_INPUT_OTHER       = 11,
+	TOKEN_INPUT_SIZE // This simply marks the number of enum values
+} TokenInput;
+
+
+/**md
+ *
+ * ## `union TokenData`
+ *
+ * This is what we will store our token data. It's a union, which allows us to
+ * reuse the same storage for different things.
+ *
+ * Identifiers and strings are stored here using allocated pointers. The reason
+ * this works is because both identifiers and strings are a string of
+ * characters.
+ *
+ * If the whole input stays in memory while its tokens are being used (because
+ * it was read in full, or mapped into memory), there's no need to copy the
+ * strings anywhere at all. A token can simply point back at the input, with
+ * the offset and length of its text. That's what `TokenView` is for. The
+ * `TOKENIZE_VIEWS` mode (see below) makes the tokenizer store these instead of
+ * pointers.
+ *
+ * With the `TOKENIZE_INTERN` mode, identifiers and debug commands don't keep
+ * their text at all, just the id of their symbol in a `SymbolTable`.
+ */
+
+typedef struct TokenView {
+	uint32_t offset; // Offset of the text in the input
+	uint32_t length; // Length of the text
+} TokenView;
+
+typedef union TokenData {
+	int64_t i;
+	double r;
+	void *s;
+	TokenView v;
+	uint32_t sym; // Symbol id, with TOKENIZE_INTERN
+} TokenData;
+
+/**md
+ *
+ * ## `struct Token`
+ *
+ * This is what we will store our token data. It's a union, which allows us to
+ * reuse the same storage for different things.
+ *
+ * Identifiers and strings are stored here using allocated pointers. The reason
+ * this works is because both identifiers and strings are a string of
+ * characters.
+ *
+ * Each token also remembers where it started in the input, as a byte offset.
+ * Line and column numbers can be worked out from that when they are needed.
+ * The offset fits in what would otherwise be padding between the type and the
+ * data, so it doesn't make the token any larger.
+ */
+
+
+typedef struct Token {
+	TokenType type;
+	unsigned int offset; // Offset of the first symbol of the token in the input
+	TokenData data;
+} Token;
+
+/**md
+ *
+ * ### `struct TokenError`
+ *
+ * `TokenError` is returned when the tokenizer encounters any erroneous input.
+ * It returns the current position in the input (`current_offset`), the line
+ * number (`line_pos`) and the column position (`col_pos`), and the current
+ * type of the token that the
+ *
+ * The line number counts from 0 and the column from 1, as found by
+ * `line_counter_resolve` (see util.hpp).
+ *
+ * `curr_guess` is never `TOKEN_STATE_ERROR` for an actual error, since it is
+ * the state the tokenizer was in just before it. A result starts out with its
+ * error cleared to all zeros, so `token_result_failed` can tell whether there
+ * has been one.
+ *
+ */
+
+typedef struct TokenError {
+	unsigned int curr_offset;
+	unsigned int line_pos;
+	unsigned int col_pos;
+	TokenState curr_guess;
+	TokenInput curr_input;
+	char curr_input_val;
+} Tokenerror;
+
+
+/**md
+ *
+ * ### `struct TokenResult`
+ *
+ * `TokenResult` is what will be returned by the tokenizer.
+ *
+ * **TODO** contents of struct might change.
+ *
+ * I have used
+ *
+ * String/Symbol storage is handled by allocating large blocks of memory, and
+ * then copying the strings into them one after another, along with the null
+ * terminator. This prevents us from doing a large number of calls to malloc,
+ * not make data fragment in memory, forget about freeing data, and so on.
+ *
+ * (This used to be a single `std::vector<char>`, but a vector moves its
+ * contents elsewhere when it grows, which left every string pointer we had
+ * handed out so far pointing at freed memory.)
+ *
+ * A block never moves once it has been allocated. When a block fills up, we
+ * simply start a new one, so the strings already stored stay exactly where they
+ * are. All of the blocks are freed together when the `TokenResult` goes away.
+ * `token_buffer_reset` empties the buffer but keeps the blocks around, so that
+ * something like a REPL, which tokenizes one line after another, can reuse the
+ * same memory for every line.
+ *
+ * This kind of allocator is usually called a ''bump'' or ''arena'' allocator.
+ */
+
+#define CHAR_BLOCK_SIZE 4096
+
+typedef struct CharBlock {
+	char *data;
+	size_t size;
+} CharBlock;
+
+typedef struct CharBuffer {
+	std::vector<CharBlock> blocks; // Every block allocated so far
+	size_t current;                // Index of the block being filled
+	char *pos;                     // Next free character in the current block
+	char *limit;                   // End of the current block
+	char *string;                  // Start of the string being built
+
+	CharBuffer() {
+		current = 0;
+		pos = NULL;
+		limit = NULL;
+		string = NULL;
+	}
+
+	CharBuffer(CharBuffer &&other) : CharBuffer() {
+		*this = std::move(other);
+	}
+
+	CharBuffer &operator=(CharBuffer &&other) {
+		std::swap(blocks, other.blocks);
+		std::swap(current, other.current);
+		std::swap(pos, other.pos);
+		std::swap(limit, other.limit);
+		std::swap(string, other.string);
+		return *this;
+	}
+
+	CharBuffer(const CharBuffer &) = delete;
+	CharBuffer &operator=(const CharBuffer &) = delete;
+
+	~CharBuffer() {
+		for (size_t i = 0; i < blocks.size(); i++) {
+			free(blocks[i].data);
+		}
+	}
+} CharBuffer;
+
+/**md
+ *
+ * ### `struct TokenStream`
+ *
+ * A `Token` is 16 bytes, but only 12 of them are actually used: the type is a
+ * 4 byte enum with 6 possible values, and the data has to start at a multiple
+ * of 8 bytes. Something like a parser, that mostly looks at the types of the
+ * tokens and only now and then at their data, also ends up pulling all of the
+ * data into the cache along with them.
+ *
+ * `TokenStream` stores the same tokens as three separate arrays instead: one
+ * byte for the type of each token, its data, and its offset. This takes up 13
+ * bytes per token, and a loop over only the types reads just one byte per
+ * token. Keeping the offsets is optional; if `keep_offsets` is false, the
+ * `offsets` array stays empty and a token takes up 9 bytes.
+ *
+ * The `TOKENIZE_STREAM` mode (see below) makes the tokenizer fill
+ * `result.stream` instead of `result.tokens`. `token_stream_get` puts a single
+ * token back together, for code that still wants to work with `Token`.
+ *
+ * Since the arrays hold no pointers, a stream can also just refer to arrays
+ * that are kept somewhere else, like in an image that many processes have
+ * mapped at once (see image.hpp), instead of each of them copying it.
+ * `token_stream_share` makes a stream like that, which can then only be read.
+ *
+ */
+
+typedef struct TokenStream {
+	std::vector<uint8_t> types;        // TokenType of each token
+	std::vector<TokenData> data;       // Data of each token
+	std::vector<unsigned int> offsets; // Offset of each token, if kept
+	bool keep_offsets;
+
+	// Used instead of the arrays above, with `token_stream_share`
+	bool shared;
+	const uint8_t *shared_types;
+	const TokenData *shared_data;
+	const unsigned int *shared_offsets;
+	size_t shared_size;
+
+	TokenStream() {
+		keep_offsets = true;
+		shared = false;
+		shared_types = NULL;
+		shared_data = NULL;
+		shared_offsets = NULL;
+		shared_size = 0;
+	}
+} TokenStream;
+
+static inline size_t token_stream_size(const TokenStream &stream)
+{
+	return stream.shared ? stream.shared_size : stream.types.size();
+}
+
+static inline void token_stream_push(TokenStream &stream, const Token &token)
+{
+	assert(!stream.shared);
+	stream.types.push_back((uint8_t) token.type);
+	stream.data.push_back(token.data);
+	if (stream.keep_offsets) {
+		stream.offsets.push_back(token.offset);
+	}
+}
+
+// The offset is 0 if the stream does not keep them.
+static inline Token token_stream_get(const TokenStream &stream, size_t i)
+{
+	Token token;
+	if (stream.shared) {
+		token.type = (TokenType) stream.shared_types[i];
+		token.offset = stream.shared_offsets ? stream.shared_offsets[i] : 0;
+		token.data = stream.shared_data[i];
+		return token;
+	}
+	token.type = (TokenType) stream.types[i];
+	token.offset = stream.keep_offsets ? stream.offsets[i] : 0;
+	token.data = stream.data[i];
+	return token;
+}
+
+// Makes `stream` refer to `size` tokens in the arrays given, which must stay
+// around for as long as it is used. `offsets` can be NULL. Anything that was in
+// the stream before is thrown away.
+static inline void token_stream_share(TokenStream &stream, size_t size, const uint8_t *types,
+                                      const TokenData *data, const unsigned int *offsets)
+{
+	stream = TokenStream();
+	stream.keep_offsets = offsets != NULL;
+	stream.shared = true;
+	stream.shared_types = types;
+	stream.shared_data = data;
+	stream.shared_offsets = offsets;
+	stream.shared_size = size;
+}
+
+typedef struct TokenResult {
+	unsigned int characters_processed; // Counted over all calls with this result
+	unsigned int lines_processed;      // Counted over all calls with this result
+	TokenError error;
+	CharBuffer buffer;
+	std::vector<Token> tokens;
+	TokenStream stream;                // Used instead of `tokens` with TOKENIZE_STREAM
+	const char *source;                // The input, if the tokens are views into it
+	SymbolTable *symbols;              // Where identifiers go, with TOKENIZE_INTERN
+
+	TokenResult() {
+		characters_processed = 0;
+		lines_processed = 0;
+		error = TokenError();
+		source = NULL;
+		symbols = NULL;
+	}
+} TokenResult;
+
+// Whether the tokenizer has found an error since the result was made or reset.
+static inline bool token_result_failed(const TokenResult &result)
+{
+	return result.error.curr_guess != TOKEN_STATE_ERROR;
+}
+
+/**md
+ *
+ * ### Functions `token_text` and `token_length`
+ *
+ * These return the text of a string, identifier or debug command token and its
+ * length, whether it was copied into the buffer, is a view into the input, or
+ * is the name of a symbol. Note that a view is not followed by a null
+ * character.
+ *
+ */
+
+static inline bool token_is_symbol(const TokenResult &result, const Token &token)
+{
+	return result.symbols && token.type != TOKEN_TYPE_STRING;
+}
+
+static inline const char *token_text(const TokenResult &result, const Token &token)
+{
+	if (token_is_symbol(result, token)) {
+		return symbol_name(*result.symbols, token.data.sym);
+	}
+	if (result.source) {
+		return result.source + token.data.v.offset;
+	}
+	return (const char *) token.data.s;
+}
+
+static inline size_t token_length(const TokenResult &result, const Token &token)
+{
+	if (token_is_symbol(result, token)) {
+		return symbol_length(*result.symbols, token.data.sym);
+	}
+	if (result.source) {
+		return token.data.v.length;
+	}
+	return strlen((const char *) token.data.s);
+}
+
+/**md
+ *
+ * ### `enum TokenizeMode`
+ *
+ * The tokenizer can run in a few different ways, which are explained along
+ * with the `tokenize` function. All of them give the same results.
+ *
+ * With `TOKENIZE_VIEWS`, every piece of input given to a `Tokenizer` must come
+ * from one contiguous block of memory, in order, and that block must outlive
+ * the tokens. `result.source` is set to its start.
+ *
+ * With `TOKENIZE_INTERN`, `result.symbols` must be set to the table that the
+ * identifiers are to be interned into.
+ *
+ */
+
+typedef enum TokenizeMode {
+	TOKENIZE_REFERENCE = 0,      // Plain loop over `states`
+	TOKENIZE_DFA       = 1 << 0, // Use the compiled DFA table
+	TOKENIZE_SKIP      = 1 << 1, // Skip self-looping runs with the vector scanners
+	TOKENIZE_VIEWS     = 1 << 2, // Store text as views into the input, not copies
+	TOKENIZE_STREAM    = 1 << 3, // Store tokens in `result.stream`
+	TOKENIZE_INTERN    = 1 << 4, // Intern identifiers into `result.symbols`
+	TOKENIZE_MODE_SIZE = 1 << 5  // This simply marks the number of combinations
+} TokenizeMode;
+
+/**md
+ *
+ * ### `enum TokenDialect`
+ *
+ * Not every build needs the whole language. A dialect leaves out the parts of
+ * it that aren't wanted, and is picked when building, by defining
+ * `BLINDFORTH_DIALECT` to a combination of these flags. The default is all of
+ * them. For example, a build with
+ *
+ *     -DBLINDFORTH_DIALECT='(TOKEN_DIALECT_ALL & ~TOKEN_DIALECT_DEBUG)'
+ *
+ * has no debug commands: `:break`, or a `:` followed by any other name, is a
+ * syntax error, and the code that builds their names is not compiled in. A `:`
+ * on its own, which starts a definition, is still a token in every dialect.
+ * How that works is explained along with the transition matrix.
+ *
+ * Only the transitions change. The tables the tokenizer runs on keep a row
+ * for every state, even those a dialect can never reach, so they are the same
+ * size in every dialect.
+ *
+ */
+
+typedef enum TokenDialect {
+	TOKEN_DIALECT_REAL   = 1 << 0, // Real numbers, such as `1.5` and `.5`
+	TOKEN_DIALECT_SQUOTE = 1 << 1, // Strings in single quotes
+	TOKEN_DIALECT_DQUOTE = 1 << 2, // Strings in double quotes
+	TOKEN_DIALECT_DEBUG  = 1 << 3, // Debug commands, such as `:break`, but not `:`
+	TOKEN_DIALECT_ALL    = (1 << 4) - 1
+} TokenDialect;
+
+#ifndef BLINDFORTH_DIALECT
+#define BLINDFORTH_DIALECT TOKEN_DIALECT_ALL
+#endif
+
+// Whether the dialect has a state at all. The others are never reached.
+// `DEBUG` is always there, since a bare `:` is a token in it.
+static constexpr bool token_dialect_has(int dialect, TokenState state)
+{
+	switch (state) {
+	case TOKEN_STATE_DOT:
+	case TOKEN_STATE_REAL:
+		return dialect & TOKEN_DIALECT_REAL;
+	case TOKEN_STATE_SQUOTE_STRING:
+		return dialect & TOKEN_DIALECT_SQUOTE;
+	case TOKEN_STATE_DQUOTE_STRING:
+		return dialect & TOKEN_DIALECT_DQUOTE;
+	default:
+		return true;
+	}
+}
+
+// Whether the dialect has the transition from `from` to `to`. Without debug
+// commands, nothing can be added to the name of one after the `:`.
+static constexpr bool token_dialect_allows(int dialect, TokenState from, TokenState to)
+{
+	return token_dialect_has(dialect, to) &&
+	       (dialect & TOKEN_DIALECT_DEBUG || from != TOKEN_STATE_DEBUG || to != TOKEN_STATE_DEBUG);
+}
+
+/**md
+ *
+ * ### `struct Tokenizer`
+ *
+ * `Tokenizer` holds everything the tokenizer needs to remember in between two
+ * pieces of input: the state it was in, the token it was in the middle of
+ * building, and how far into the input it has got. This lets us feed it input
+ * as it arrives, in pieces of any size, even if a token is split between two
+ * of them.
+ *
+ * The line counter only remembers how many lines it has seen and where the
+ * last one started, so a `Tokenizer` uses the same amount of memory however
+ * long the input is.
+ *
+ * The input must be valid UTF-8, which is checked before the tokenizer reads
+ * it. A character can be split between two pieces as well, so the bytes of it
+ * in the first piece are kept until the next one arrives.
+ *
+ */
+
+typedef struct Tokenizer {
+	int mode;           // A combination of `TokenizeMode` flags
+	TokenState state;   // The current state
+	Token token;        // The token being built
+
+	// state-specific variables
+	char sign_char;     // The sign symbol, in case it turns out to be an identifier
+	uint32_t hash;      // Hash of the identifier being built, with TOKENIZE_INTERN
+	std::vector<char> number; // The start of a number split between pieces
+
+	unsigned int offset; // Offset of the next piece of input
+	LineCounter lines;   // Line endings seen in the input so far
+
+	char utf8[4];        // A UTF-8 sequence cut off by the end of the last piece
+	uint8_t utf8_size;
+
+	Tokenizer(int mode = TOKENIZE_REFERENCE) {
+		this->mode = mode;
+		state = TOKEN_STATE_NONE;
+		token = Token();
+		sign_char = 0;
+		hash = 0;
+		offset = 0;
+		memset(utf8, 0, sizeof(utf8));
+		utf8_size = 0;
+	}
+} Tokenizer;
+
+/**md
+ *
+ * ### `struct TokenCounters`
+ *
+ * Building with `BLINDFORTH_PROFILE` defined makes the tokenizer count what it
+ * does. Without it, none of the counting is compiled in at all. The counts
+ * tell whether an input keeps the tokenizer busy with strings, identifiers or
+ * numbers, which is what decides where it's worth making it faster:
+ *
+ * - `bytes` counts the bytes read one at a time, by the state they were read
+ *   in, and `inputs` the same bytes by their class. `skipped` counts the bytes
+ *   a fast path went over in one go (see `TOKENIZE_SKIP`), by state.
+ * - `transitions` counts each change of state, from one to the other.
+ * - `tokens` counts the tokens made, by type.
+ * - The `buffer_` counts are about the buffer the text of tokens is copied
+ *   into: how many strings were started in it, how often a string had to move
+ *   to another block, and how many blocks were allocated, of how many bytes.
+ *
+ * Each thread counts on its own, and adds its counts to the total whenever it
+ * leaves `tokenizer_feed`. `token_counters_write` writes the total as JSON, or
+ * in the text format Prometheus reads (see `CounterWriter` in util.hpp).
+ *
+ */
+
+#ifdef BLINDFORTH_PROFILE
+
+typedef struct TokenCounters {
+	uint64_t feeds;                                          // Calls to tokenizer_feed
+	uint64_t bytes[TOKEN_STATE_SIZE];
+	uint64_t skipped[TOKEN_STATE_SIZE];
+	uint64_t inputs[TOKEN_INPUT_SIZE];
+	uint64_t transitions[TOKEN_STATE_SIZE][TOKEN_STATE_SIZE]; // [from][to]
+	uint64_t tokens[TOKEN_TYPE_SIZE];
+	uint64_t buffer_strings;
+	uint64_t buffer_moves;
+	uint64_t buffer_blocks;
+	uint64_t buffer_bytes;
+} TokenCounters;
+
+// The counts of every thread, as of the last time each left tokenizer_feed.
+TokenCounters token_counters_get();
+void token_counters_reset();
+void token_counters_write(CounterWriter &writer);
+
+// The number of times each edge of the transition matrix was taken, with
+// `hits[from][to]`, for `tokenizer_graphviz`.
+void token_counters_edges(const TokenCounters &counters,
+                          uint64_t hits[TOKEN_STATE_SIZE][TOKEN_STATE_SIZE]);
+
+#endif
+
+/**md
+ *
+ * ### Functions
+ *
+ * `tokenizer_feed` gives the next piece of input to a `Tokenizer`. Tokens are
+ * appended to `result`, which must be the same for every piece. `end` marks
+ * the last piece. It returns 1 once the tokenization is complete, 0 when it
+ * needs more input, and -1 on an error.
+ *
+ * `tokenize` and its variants tokenize a complete input in one go.
+ *
+ * `token_result_reset` empties a result, keeping all of its memory, so that it
+ * can be reused for the next input.
+ *
+ * `token_stream_reserve` makes room in a stream for the number of tokens that
+ * an input of `size` bytes is likely to contain. The tokenizer does this by
+ * itself with the first piece of input, so it's only needed to set aside room
+ * for a whole input that will be fed in small pieces.
+ *
+ * `tokenizer_graphviz` writes the transition matrix to `f` as a Graphviz
+ * graph, with the number of times each edge was taken if `hits` isn't NULL.
+ *
+ */
+
+int tokenizer_feed(Tokenizer &tokenizer, char *input, int size, bool end, TokenResult &result);
+void tokenizer_reset(Tokenizer &tokenizer);
+
+// Empties a buffer, keeping its blocks for reuse.
+void token_buffer_reset(CharBuffer &buffer);
+
+// Moves the strings of `src` into `dst`, without copying them.
+void token_buffer_adopt(CharBuffer &dst, CharBuffer &src);
+
+// Throws away the string being built, as if it had never been started. The
+// space it took up is used again by the next one.
+static inline void token_buffer_discard(CharBuffer &buffer)
+{
+	if (buffer.string) {
+		buffer.pos = buffer.string;
+	}
+	buffer.string = NULL;
+}
+
+// Empties a result so that it can be used for a new input.
+void token_result_reset(TokenResult &result);
+
+void token_stream_reserve(TokenStream &stream, size_t size);
+
+int tokenize(char *input, int size, bool end, TokenResult &result);
+int tokenize_dfa(char *input, int size, bool end, TokenResult &result);
+int tokenize_fast(char *input, int size, bool end, TokenResult &result);
+int tokenize_views(char *input, int size, bool end, TokenResult &result);
+int tokenize_stream(char *input, int size, bool end, TokenResult &result);
+int tokenize_interned(char *input, int size, bool end, TokenResult &result);
+
+void tokenizer_graphviz(FILE *f, const uint64_t (*hits)[TOKEN_STATE_SIZE]);
+
+#endif
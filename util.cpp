@@ -0,0 +1,860 @@
+/**
+ *
+ * util.cpp - Miscellaneous helpers shared by the different stages
+ *
+ * Copyright (c) 2022 Anamitra Ghorui
+ *
+ * LICENSE_HERE
+ *
+ */
+
+#include "util.hpp"
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define UTIL_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define UTIL_NEON 1
+#include <arm_neon.h>
+#endif
+
+/**
+ * Scalar implementations. These are also used to finish off the tails of
+ * blocks that are too short for the vector implementations.
+ */
+
+static inline bool is_whitespace(char c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static size_t whitespace_span_scalar(const char *s, size_t n)
+{
+	size_t i = 0;
+	while (i < n && is_whitespace(s[i])) {
+		i++;
+	}
+	return i;
+}
+
+static inline bool string_stop(char c, char quote)
+{
+	return c == quote || c == '\0' || c == '\xff';
+}
+
+static void line_masks_scalar(const char *s, size_t n, uint64_t &lf, uint64_t &cr)
+{
+	lf = 0;
+	cr = 0;
+	for (size_t i = 0; i < n; i++) {
+		lf |= (uint64_t) (s[i] == '\n') << i;
+		cr |= (uint64_t) (s[i] == '\r') << i;
+	}
+}
+
+static size_t string_span_scalar(const char *s, size_t n, char quote)
+{
+	size_t i = 0;
+	while (i < n && !string_stop(s[i], quote)) {
+		i++;
+	}
+	return i;
+}
+
+// Returns how many bytes of the sequence starting at `s` are valid, and sets
+// `len` to the number of bytes the whole sequence takes. The sequence is
+// complete if the two are the same, and was cut off by the end of `s` if
+// fewer bytes were valid only because `n` ran out. The ranges are those of
+// Table 3-7 in the Unicode standard, which rule out overlong forms, surrogates
+// and anything above U+10FFFF.
+static size_t utf8_sequence_scalar(const char *s, size_t n, size_t &len)
+{
+	unsigned char c = s[0];
+	unsigned char lo = 0x80, hi = 0xBF;
+	size_t i;
+
+	if (c < 0x80) {
+		len = 1;
+		return 1;
+	} else if (c >= 0xC2 && c <= 0xDF) {
+		len = 2;
+	} else if (c >= 0xE0 && c <= 0xEF) {
+		len = 3;
+		lo = (c == 0xE0) ? 0xA0 : 0x80;
+		hi = (c == 0xED) ? 0x9F : 0xBF;
+	} else if (c >= 0xF0 && c <= 0xF4) {
+		len = 4;
+		lo = (c == 0xF0) ? 0x90 : 0x80;
+		hi = (c == 0xF4) ? 0x8F : 0xBF;
+	} else {
+		len = 1;
+		return 0;
+	}
+
+	for (i = 1; i < len && i < n; i++) {
+		unsigned char d = s[i];
+		if (d < lo || d > hi) {
+			break;
+		}
+		lo = 0x80;
+		hi = 0xBF;
+	}
+	return i;
+}
+
+static size_t utf8_span_scalar(const char *s, size_t n)
+{
+	size_t i = 0;
+
+	while (i < n) {
+		size_t len;
+		if ((unsigned char) s[i] < 0x80) {
+			i++;
+		} else if (utf8_sequence_scalar(s + i, n - i, len) == len) {
+			i += len;
+		} else {
+			break;
+		}
+	}
+	return i;
+}
+
+// The start of the sequence that `s[i - 1]` is part of, if everything before
+// `i` is valid.
+static inline size_t utf8_boundary(const char *s, size_t i)
+{
+	size_t j = i;
+	while (j > 0 && i - j < 4) {
+		j--;
+		if (((unsigned char) s[j] & 0xC0) != 0x80) {
+			break;
+		}
+	}
+	return j;
+}
+
+#ifdef UTIL_X86
+
+/**
+ * SSE2 is part of the x86-64 baseline, so it needs no target attribute.
+ */
+
+static inline __m128i whitespace_sse2(__m128i v)
+{
+	return _mm_or_si128(
+		_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+		             _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+		_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')),
+		             _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))));
+}
+
+static size_t whitespace_span_sse2(const char *s, size_t n)
+{
+	size_t i = 0;
+
+	for (; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+		unsigned int mask = ~_mm_movemask_epi8(whitespace_sse2(v)) & 0xFFFF;
+		if (mask) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+
+	return i + whitespace_span_scalar(s + i, n - i);
+}
+
+static size_t string_span_sse2(const char *s, size_t n, char quote)
+{
+	const __m128i q = _mm_set1_epi8(quote);
+	const __m128i nul = _mm_setzero_si128();
+	const __m128i ff = _mm_set1_epi8('\xff');
+	size_t i = 0;
+
+	for (; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+		__m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, q),
+			_mm_or_si128(_mm_cmpeq_epi8(v, nul), _mm_cmpeq_epi8(v, ff)));
+		unsigned int mask = _mm_movemask_epi8(m);
+		if (mask) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+
+	return i + string_span_scalar(s + i, n - i, quote);
+}
+
+static void line_masks_sse2(const char *s, size_t n, uint64_t &lf, uint64_t &cr)
+{
+	if (n < 64) {
+		line_masks_scalar(s, n, lf, cr);
+		return;
+	}
+
+	lf = 0;
+	cr = 0;
+	for (int k = 0; k < 4; k++) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (s + 16 * k));
+		lf |= (uint64_t) (unsigned int) _mm_movemask_epi8(
+			_mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))) << (16 * k);
+		cr |= (uint64_t) (unsigned int) _mm_movemask_epi8(
+			_mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))) << (16 * k);
+	}
+}
+
+// Blocks of ASCII are skipped 16 bytes at a time. Anywhere else, sequences are
+// decoded one by one until the next block of ASCII.
+static size_t utf8_span_sse2(const char *s, size_t n)
+{
+	size_t i = 0;
+
+	while (i + 16 <= n) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+		unsigned int mask = _mm_movemask_epi8(v);
+		size_t len;
+
+		if (!mask) {
+			i += 16;
+			continue;
+		}
+
+		i += __builtin_ctz(mask);
+		if (utf8_sequence_scalar(s + i, n - i, len) != len) {
+			return i;
+		}
+		i += len;
+	}
+
+	return i + utf8_span_scalar(s + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static size_t whitespace_span_avx2(const char *s, size_t n)
+{
+	size_t i = 0;
+
+	for (; i + 32 <= n; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *) (s + i));
+		__m256i m = _mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+			                _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))),
+			_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')),
+			                _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r'))));
+		uint32_t mask = ~(uint32_t) _mm256_movemask_epi8(m);
+		if (mask) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+
+	return i + whitespace_span_sse2(s + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static size_t string_span_avx2(const char *s, size_t n, char quote)
+{
+	const __m256i q = _mm256_set1_epi8(quote);
+	const __m256i nul = _mm256_setzero_si256();
+	const __m256i ff = _mm256_set1_epi8('\xff');
+	size_t i = 0;
+
+	for (; i + 32 <= n; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *) (s + i));
+		__m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(v, q),
+			_mm256_or_si256(_mm256_cmpeq_epi8(v, nul), _mm256_cmpeq_epi8(v, ff)));
+		uint32_t mask = (uint32_t) _mm256_movemask_epi8(m);
+		if (mask) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+
+	return i + string_span_sse2(s + i, n - i, quote);
+}
+
+/**
+ * Validating UTF-8 32 bytes at a time, without decoding it, as described by
+ * John Keiser and Daniel Lemire in "Validating UTF-8 In Less Than One
+ * Instruction Per Byte". Every error shows up in the first two bytes of a
+ * sequence, or in how many continuation bytes follow its first byte. So each
+ * byte is looked at together with the byte before it, by looking up both
+ * nibbles of the first one and the high nibble of the second in three tables
+ * of the errors they allow. A bit that is set in all three is an error:
+ */
+
+#define UTF8_TOO_SHORT  (1 << 0) // 11______ 0_______ or 11______ 11______
+#define UTF8_TOO_LONG   (1 << 1) // 0_______ 10______
+#define UTF8_OVERLONG_3 (1 << 2) // 11100000 100_____
+#define UTF8_TOO_LARGE  (1 << 3) // 11110100 1001____ and above
+#define UTF8_SURROGATE  (1 << 4) // 11101101 101_____
+#define UTF8_OVERLONG_2 (1 << 5) // 1100000_ 10______
+#define UTF8_TOO_LARGE_1000 (1 << 6) // 11110101 1000____ and above
+#define UTF8_OVERLONG_4 (1 << 6) // 11110000 1000____
+#define UTF8_TWO_CONTS  (1 << 7) // 10______ 10______
+#define UTF8_CARRY (UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS)
+
+#define UTF8_TABLE(...) _mm256_setr_epi8(__VA_ARGS__, __VA_ARGS__)
+
+// The bytes of `v`, with the last `k` bytes of `prev` shifted in.
+#define UTF8_PREV(v, prev, k) \
+	_mm256_alignr_epi8((v), _mm256_permute2x128_si256((prev), (v), 0x21), 16 - (k))
+
+__attribute__((target("avx2")))
+static inline __m256i utf8_errors_avx2(__m256i v, __m256i prev)
+{
+	const __m256i nibble = _mm256_set1_epi8(0x0F);
+	const __m256i byte_1_high_table = UTF8_TABLE(
+		// 0_______ ________
+		UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+		UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+		// 10______ ________
+		UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS,
+		// 1100____ ________
+		UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+		// 1101____ ________
+		UTF8_TOO_SHORT,
+		// 1110____ ________
+		UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+		// 1111____ ________
+		UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4);
+	const __m256i byte_1_low_table = UTF8_TABLE(
+		// ____0000 ________
+		UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4,
+		// ____0001 ________
+		UTF8_CARRY | UTF8_OVERLONG_2,
+		// ____001_ ________
+		UTF8_CARRY,
+		UTF8_CARRY,
+		// ____0100 ________
+		UTF8_CARRY | UTF8_TOO_LARGE,
+		// ____0101 ________ and up
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		// ____1101 ________
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000);
+	const __m256i byte_2_high_table = UTF8_TABLE(
+		// ________ 0_______
+		UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+		UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+		// ________ 1000____
+		UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 |
+		UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+		// ________ 1001____
+		UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 |
+		UTF8_TOO_LARGE,
+		// ________ 101_____
+		UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,
+		UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,
+		// ________ 11______
+		UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT);
+
+	__m256i prev1 = UTF8_PREV(v, prev, 1);
+	__m256i byte_1_high = _mm256_shuffle_epi8(byte_1_high_table,
+		_mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble));
+	__m256i byte_1_low = _mm256_shuffle_epi8(byte_1_low_table,
+		_mm256_and_si256(prev1, nibble));
+	__m256i byte_2_high = _mm256_shuffle_epi8(byte_2_high_table,
+		_mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+	__m256i special = _mm256_and_si256(_mm256_and_si256(byte_1_high, byte_1_low), byte_2_high);
+
+	// The third and fourth bytes of a sequence must be continuation bytes,
+	// and are the only continuation bytes allowed to follow one. Subtracting
+	// with saturation leaves the high bit set only after a first byte of
+	// 111_____ two bytes back, or 1111____ three bytes back.
+	__m256i third = _mm256_subs_epu8(UTF8_PREV(v, prev, 2), _mm256_set1_epi8(0xE0 - 0x80));
+	__m256i fourth = _mm256_subs_epu8(UTF8_PREV(v, prev, 3), _mm256_set1_epi8(0xF0 - 0x80));
+	__m256i must_be_cont = _mm256_and_si256(_mm256_or_si256(third, fourth),
+	                                        _mm256_set1_epi8((char) 0x80));
+
+	return _mm256_xor_si256(must_be_cont, special);
+}
+
+// Blocks of ASCII are skipped, as long as the block before didn't end in the
+// middle of a sequence. If a block has an error in it, the sequences from just
+// before it on are decoded one by one, to find out exactly where it is.
+__attribute__((target("avx2")))
+static size_t utf8_span_avx2(const char *s, size_t n)
+{
+	__m256i prev = _mm256_setzero_si256();
+	size_t i = 0;
+
+	for (; i + 32 <= n; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *) (s + i));
+
+		if (!_mm256_movemask_epi8(v)) {
+			if (i > 0 && ((unsigned char) s[i - 1] >= 0xC0 ||
+			              (unsigned char) s[i - 2] >= 0xE0 ||
+			              (unsigned char) s[i - 3] >= 0xF0)) {
+				break;
+			}
+		} else {
+			__m256i errors = utf8_errors_avx2(v, prev);
+			if (!_mm256_testz_si256(errors, errors)) {
+				break;
+			}
+		}
+		prev = v;
+	}
+
+	i = utf8_boundary(s, i);
+	return i + utf8_span_scalar(s + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void line_masks_avx2(const char *s, size_t n, uint64_t &lf, uint64_t &cr)
+{
+	if (n < 64) {
+		line_masks_scalar(s, n, lf, cr);
+		return;
+	}
+
+	__m256i lo = _mm256_loadu_si256((const __m256i *) s);
+	__m256i hi = _mm256_loadu_si256((const __m256i *) (s + 32));
+	__m256i vlf = _mm256_set1_epi8('\n');
+	__m256i vcr = _mm256_set1_epi8('\r');
+
+	lf = (uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, vlf)) |
+	     (uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, vlf)) << 32;
+	cr = (uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, vcr)) |
+	     (uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, vcr)) << 32;
+}
+
+#endif
+
+#ifdef UTIL_NEON
+
+/**
+ * NEON has no movemask, so we narrow each compare result to 4 bits and find
+ * the first set nibble in the resulting 64 bit value.
+ */
+
+static inline uint64_t neon_mask(uint8x16_t m)
+{
+	uint8x8_t nibbles = vshrn_n_u16(vreinterpretq_u16_u8(m), 4);
+	return vget_lane_u64(vreinterpret_u64_u8(nibbles), 0);
+}
+
+static inline uint8x16_t whitespace_neon(uint8x16_t v)
+{
+	return vorrq_u8(vorrq_u8(vceqq_u8(v, vdupq_n_u8(' ')), vceqq_u8(v, vdupq_n_u8('\t'))),
+	                vorrq_u8(vceqq_u8(v, vdupq_n_u8('\n')), vceqq_u8(v, vdupq_n_u8('\r'))));
+}
+
+static size_t whitespace_span_neon(const char *s, size_t n)
+{
+	size_t i = 0;
+
+	for (; i + 16 <= n; i += 16) {
+		uint8x16_t v = vld1q_u8((const uint8_t *) (s + i));
+		uint64_t mask = ~neon_mask(whitespace_neon(v));
+		if (mask) {
+			return i + (__builtin_ctzll(mask) >> 2);
+		}
+	}
+
+	return i + whitespace_span_scalar(s + i, n - i);
+}
+
+static size_t string_span_neon(const char *s, size_t n, char quote)
+{
+	const uint8x16_t q = vdupq_n_u8((uint8_t) quote);
+	const uint8x16_t ff = vdupq_n_u8(0xFF);
+	size_t i = 0;
+
+	for (; i + 16 <= n; i += 16) {
+		uint8x16_t v = vld1q_u8((const uint8_t *) (s + i));
+		uint8x16_t m = vorrq_u8(vceqq_u8(v, q), vorrq_u8(vceqzq_u8(v), vceqq_u8(v, ff)));
+		uint64_t mask = neon_mask(m);
+		if (mask) {
+			return i + (__builtin_ctzll(mask) >> 2);
+		}
+	}
+
+	return i + string_span_scalar(s + i, n - i, quote);
+}
+
+// A movemask over four vectors: each compare result is reduced to one bit
+// per byte by weighting and pairwise adding.
+static inline uint64_t neon_movemask64(uint8x16_t m0, uint8x16_t m1,
+                                       uint8x16_t m2, uint8x16_t m3)
+{
+	const uint8x16_t bits = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+	uint8x16_t a = vpaddq_u8(vandq_u8(m0, bits), vandq_u8(m1, bits));
+	uint8x16_t b = vpaddq_u8(vandq_u8(m2, bits), vandq_u8(m3, bits));
+	uint8x16_t c = vpaddq_u8(a, b);
+	c = vpaddq_u8(c, c);
+	return vgetq_lane_u64(vreinterpretq_u64_u8(c), 0);
+}
+
+static size_t utf8_span_neon(const char *s, size_t n)
+{
+	size_t i = 0;
+
+	while (i + 16 <= n) {
+		uint8x16_t v = vld1q_u8((const uint8_t *) (s + i));
+		uint64_t mask = neon_mask(vcgeq_u8(v, vdupq_n_u8(0x80)));
+		size_t len;
+
+		if (!mask) {
+			i += 16;
+			continue;
+		}
+
+		i += __builtin_ctzll(mask) >> 2;
+		if (utf8_sequence_scalar(s + i, n - i, len) != len) {
+			return i;
+		}
+		i += len;
+	}
+
+	return i + utf8_span_scalar(s + i, n - i);
+}
+
+static void line_masks_neon(const char *s, size_t n, uint64_t &lf, uint64_t &cr)
+{
+	if (n < 64) {
+		line_masks_scalar(s, n, lf, cr);
+		return;
+	}
+
+	const uint8_t *p = (const uint8_t *) s;
+	uint8x16_t v0 = vld1q_u8(p), v1 = vld1q_u8(p + 16);
+	uint8x16_t v2 = vld1q_u8(p + 32), v3 = vld1q_u8(p + 48);
+	uint8x16_t vlf = vdupq_n_u8('\n'), vcr = vdupq_n_u8('\r');
+
+	lf = neon_movemask64(vceqq_u8(v0, vlf), vceqq_u8(v1, vlf),
+	                     vceqq_u8(v2, vlf), vceqq_u8(v3, vlf));
+	cr = neon_movemask64(vceqq_u8(v0, vcr), vceqq_u8(v1, vcr),
+	                     vceqq_u8(v2, vcr), vceqq_u8(v3, vcr));
+}
+
+#endif
+
+/**
+ * Runtime dispatch. The function pointers start out pointing at a resolver
+ * which picks the best implementation and then calls it. Threads may all call
+ * a resolver at once, which is why the pointers are atomic. They all write the
+ * same implementations, so relaxed ordering is enough.
+ */
+
+static size_t whitespace_span_resolve(const char *s, size_t n);
+static size_t string_span_resolve(const char *s, size_t n, char quote);
+static void line_masks_resolve(const char *s, size_t n, uint64_t &lf, uint64_t &cr);
+static size_t utf8_span_resolve(const char *s, size_t n);
+
+typedef size_t (*WhitespaceSpanFn)(const char *, size_t);
+typedef size_t (*StringSpanFn)(const char *, size_t, char);
+typedef void (*LineMasksFn)(const char *, size_t, uint64_t &, uint64_t &);
+typedef size_t (*Utf8SpanFn)(const char *, size_t);
+
+static std::atomic<UtilSimd> simd_current(UTIL_SIMD_NONE);
+static std::atomic<WhitespaceSpanFn> whitespace_span_fn(whitespace_span_resolve);
+static std::atomic<StringSpanFn> string_span_fn(string_span_resolve);
+static std::atomic<LineMasksFn> line_masks_fn(line_masks_resolve);
+static std::atomic<Utf8SpanFn> utf8_span_fn(utf8_span_resolve);
+
+// The implementation currently picked for a scanner.
+#define DISPATCH(fn) (fn).load(std::memory_order_relaxed)
+
+UtilSimd util_simd_detect()
+{
+#if defined(UTIL_X86)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		return UTIL_SIMD_AVX2;
+	}
+	if (__builtin_cpu_supports("sse2")) {
+		return UTIL_SIMD_SSE2;
+	}
+#elif defined(UTIL_NEON)
+	return UTIL_SIMD_NEON;
+#endif
+	return UTIL_SIMD_NONE;
+}
+
+UtilSimd util_simd_current()
+{
+	if (DISPATCH(whitespace_span_fn) == whitespace_span_resolve) {
+		util_simd_select(util_simd_detect());
+	}
+	return DISPATCH(simd_current);
+}
+
+int util_simd_select(UtilSimd level)
+{
+	UtilSimd best = util_simd_detect();
+
+	switch (level) {
+	case UTIL_SIMD_NONE:
+		whitespace_span_fn.store(whitespace_span_scalar, std::memory_order_relaxed);
+		string_span_fn.store(string_span_scalar, std::memory_order_relaxed);
+		line_masks_fn.store(line_masks_scalar, std::memory_order_relaxed);
+		utf8_span_fn.store(utf8_span_scalar, std::memory_order_relaxed);
+		break;
+
+#if defined(UTIL_X86)
+	case UTIL_SIMD_SSE2:
+		if (best < UTIL_SIMD_SSE2) {
+			return -1;
+		}
+		whitespace_span_fn.store(whitespace_span_sse2, std::memory_order_relaxed);
+		string_span_fn.store(string_span_sse2, std::memory_order_relaxed);
+		line_masks_fn.store(line_masks_sse2, std::memory_order_relaxed);
+		utf8_span_fn.store(utf8_span_sse2, std::memory_order_relaxed);
+		break;
+
+	case UTIL_SIMD_AVX2:
+		if (best < UTIL_SIMD_AVX2) {
+			return -1;
+		}
+		whitespace_span_fn.store(whitespace_span_avx2, std::memory_order_relaxed);
+		string_span_fn.store(string_span_avx2, std::memory_order_relaxed);
+		line_masks_fn.store(line_masks_avx2, std::memory_order_relaxed);
+		utf8_span_fn.store(utf8_span_avx2, std::memory_order_relaxed);
+		break;
+#elif defined(UTIL_NEON)
+	case UTIL_SIMD_NEON:
+		whitespace_span_fn.store(whitespace_span_neon, std::memory_order_relaxed);
+		string_span_fn.store(string_span_neon, std::memory_order_relaxed);
+		line_masks_fn.store(line_masks_neon, std::memory_order_relaxed);
+		utf8_span_fn.store(utf8_span_neon, std::memory_order_relaxed);
+		break;
+#endif
+
+	default:
+		return -1;
+	}
+
+	simd_current.store(level, std::memory_order_relaxed);
+	return 0;
+}
+
+static size_t whitespace_span_resolve(const char *s, size_t n)
+{
+	util_simd_select(util_simd_detect());
+	return DISPATCH(whitespace_span_fn)(s, n);
+}
+
+static size_t string_span_resolve(const char *s, size_t n, char quote)
+{
+	util_simd_select(util_simd_detect());
+	return DISPATCH(string_span_fn)(s, n, quote);
+}
+
+static void line_masks_resolve(const char *s, size_t n, uint64_t &lf, uint64_t &cr)
+{
+	util_simd_select(util_simd_detect());
+	DISPATCH(line_masks_fn)(s, n, lf, cr);
+}
+
+static size_t utf8_span_resolve(const char *s, size_t n)
+{
+	util_simd_select(util_simd_detect());
+	return DISPATCH(utf8_span_fn)(s, n);
+}
+
+size_t util_whitespace_span(const char *s, size_t n)
+{
+	return DISPATCH(whitespace_span_fn)(s, n);
+}
+
+size_t util_string_span(const char *s, size_t n, char quote)
+{
+	return DISPATCH(string_span_fn)(s, n, quote);
+}
+
+size_t util_utf8_span(const char *s, size_t n)
+{
+	return DISPATCH(utf8_span_fn)(s, n);
+}
+
+size_t util_utf8_sequence(const char *s, size_t n, size_t &len)
+{
+	return utf8_sequence_scalar(s, n, len);
+}
+
+/**
+ * Line counting. Everything goes through `scan_lines`, which works on blocks of
+ * 64 bytes. The carries hold whether the last byte of the previous block was a
+ * '\n' or a '\r'. If `starts` is not NULL, the offset of every line start found
+ * is appended to it.
+ */
+
+static void scan_lines(const char *s, size_t n, LineCounter &counter,
+                       std::vector<unsigned int> *starts)
+{
+	for (size_t i = 0; i < n; i += 64) {
+		size_t len = (n - i < 64) ? n - i : 64;
+		uint64_t lf, cr;
+
+		DISPATCH(line_masks_fn)(s + i, len, lf, cr);
+
+		uint64_t valid = (len == 64) ? ~(uint64_t) 0 : ((uint64_t) 1 << len) - 1;
+		uint64_t line_starts = ((lf << 1) | counter.carry_lf) |
+		                       (((cr << 1) | counter.carry_cr) & ~lf);
+		line_starts &= valid;
+
+		counter.carry_lf = (lf >> (len - 1)) & 1;
+		counter.carry_cr = (cr >> (len - 1)) & 1;
+
+		if (line_starts) {
+			unsigned int base = counter.size + i;
+			counter.lines += __builtin_popcountll(line_starts);
+			counter.line_start = base + 63 - __builtin_clzll(line_starts);
+
+			if (starts) {
+				while (line_starts) {
+					starts->push_back(base + __builtin_ctzll(line_starts));
+					line_starts &= line_starts - 1;
+				}
+			}
+		}
+	}
+
+	counter.size += n;
+}
+
+void line_counter_append(LineCounter &counter, const char *s, size_t n)
+{
+	scan_lines(s, n, counter, NULL);
+}
+
+unsigned int line_counter_lines(const LineCounter &counter, bool end)
+{
+	// A trailing '\n' always ends a line, even if nothing follows it yet.
+	return counter.lines + counter.carry_lf + (end ? counter.carry_cr : 0);
+}
+
+void line_counter_resolve(const LineCounter &counter, unsigned int offset,
+                          unsigned int &line, unsigned int &col)
+{
+	line = counter.lines;
+	col = offset - counter.line_start + 1;
+}
+
+void line_index_append(LineIndex &index, const char *s, size_t n)
+{
+	scan_lines(s, n, index.counter, &index.starts);
+}
+
+void line_index_finish(LineIndex &index)
+{
+	LineCounter &counter = index.counter;
+
+	if (counter.carry_lf || counter.carry_cr) {
+		index.starts.push_back(counter.size);
+		counter.lines++;
+		counter.line_start = counter.size;
+		counter.carry_lf = 0;
+		counter.carry_cr = 0;
+	}
+}
+
+unsigned int line_index_lines(const LineIndex &index)
+{
+	return line_counter_lines(index.counter, false);
+}
+
+void line_index_resolve(const LineIndex &index, unsigned int offset,
+                        unsigned int &line, unsigned int &col)
+{
+	// Find the last line that starts at or before `offset`.
+	size_t lo = 0, hi = index.starts.size();
+	while (hi - lo > 1) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (index.starts[mid] <= offset) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+
+	line = lo;
+	col = offset - index.starts[lo] + 1;
+}
+
+unsigned int util_count_lines(const char *s, size_t n, bool end)
+{
+	LineCounter counter;
+	line_counter_append(counter, s, n);
+	return line_counter_lines(counter, end);
+}
+
+void counter_begin(CounterWriter &writer, FILE *f, CounterFormat format)
+{
+	writer.f = f;
+	writer.format = format;
+	writer.last = NULL;
+	if (format == COUNTER_FORMAT_JSON) {
+		fprintf(f, "[");
+	}
+}
+
+// Both formats escape '"' and '\\' in the same way.
+static void counter_label(FILE *f, const char *s)
+{
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\') {
+			fputc('\\', f);
+		}
+		fputc(*s, f);
+	}
+}
+
+void counter_write(CounterWriter &writer, const char *name, uint64_t value,
+                   const char *key1, const char *label1,
+                   const char *key2, const char *label2)
+{
+	FILE *f = writer.f;
+	bool same = writer.last && strcmp(writer.last, name) == 0;
+
+	if (writer.format == COUNTER_FORMAT_JSON) {
+		fprintf(f, "%s\n  {\"name\": \"%s\", \"labels\": {", writer.last ? "," : "", name);
+		if (key1) {
+			fprintf(f, "\"%s\": \"", key1);
+			counter_label(f, label1);
+			fprintf(f, "\"");
+		}
+		if (key2) {
+			fprintf(f, ", \"%s\": \"", key2);
+			counter_label(f, label2);
+			fprintf(f, "\"");
+		}
+		fprintf(f, "}, \"value\": %llu}", (unsigned long long) value);
+	} else {
+		if (!same) {
+			fprintf(f, "# TYPE %s counter\n", name);
+		}
+		fprintf(f, "%s", name);
+		if (key1) {
+			fprintf(f, "{%s=\"", key1);
+			counter_label(f, label1);
+			fprintf(f, "\"");
+			if (key2) {
+				fprintf(f, ",%s=\"", key2);
+				counter_label(f, label2);
+				fprintf(f, "\"");
+			}
+			fprintf(f, "}");
+		}
+		fprintf(f, " %llu\n", (unsigned long long) value);
+	}
+
+	writer.last = name;
+}
+
+void counter_end(CounterWriter &writer)
+{
+	if (writer.format == COUNTER_FORMAT_JSON) {
+		fprintf(writer.f, "\n]\n");
+	}
+}
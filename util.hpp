@@ -0,0 +1,179 @@
+/**
+ *
+ * util.hpp - Miscellaneous helpers shared by the different stages
+ *
+ * Copyright (c) 2022 Anamitra Ghorui
+ *
+ * LICENSE_HERE
+ *
+ */
+
+#ifndef BLINDFORTH_UTIL_HPP
+#define BLINDFORTH_UTIL_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+/**
+ * Vectorized byte scanning
+ * ========================
+ *
+ * These functions scan a block of bytes 16 or 32 at a time, depending on what
+ * the CPU supports. The implementation is picked at runtime the first time
+ * any of them is called, and can be overridden with `util_simd_select`.
+ */
+
+typedef enum UtilSimd {
+	UTIL_SIMD_NONE = 0, // Plain scalar loops
+	UTIL_SIMD_SSE2 = 1,
+	UTIL_SIMD_AVX2 = 2,
+	UTIL_SIMD_NEON = 3
+} UtilSimd;
+
+// Returns the best implementation supported by the current CPU.
+UtilSimd util_simd_detect();
+
+// Returns the implementation currently in use.
+UtilSimd util_simd_current();
+
+// Forces a specific implementation. Returns a value less than 0 if the CPU
+// does not support it. Call it before starting any threads that scan: threads
+// already scanning may go on using the old implementation for a while.
+int util_simd_select(UtilSimd level);
+
+// Returns the length of the run of whitespace (spaces, tabs, '\n' and '\r') at
+// the start of `s`.
+size_t util_whitespace_span(const char *s, size_t n);
+
+// Returns the length of the run at the start of `s` that contains none of
+// `quote`, '\0' or '\xff'.
+size_t util_string_span(const char *s, size_t n, char quote);
+
+// Returns the length of the run at the start of `s` that is made of complete,
+// valid UTF-8 sequences. `s` must start at the start of a sequence. The run
+// ends at a sequence that is either invalid, or cut off by the end of `s`,
+// which `util_utf8_sequence` tells apart.
+size_t util_utf8_span(const char *s, size_t n);
+
+// Returns how many bytes of the UTF-8 sequence at the start of `s` are valid,
+// and sets `len` to the length of the whole sequence. If fewer than `len`
+// bytes are valid but all of `s` is, the sequence was cut off by its end.
+size_t util_utf8_sequence(const char *s, size_t n, size_t &len);
+
+/**
+ * Line Index
+ * ==========
+ *
+ * Line and column numbers are only needed when something has to be reported
+ * to the user, so instead of counting them while tokenizing, we find them
+ * afterwards from a byte offset.
+ *
+ * A line ends at a '\n' (Linux, New MacOS), at a '\r' (Old MacOS), or at a
+ * "\r\n" pair (Windows), which counts as a single line ending. Put another way,
+ * a new line starts at offset `p` if the byte before it is a '\n', or if the
+ * byte before it is a '\r' and the byte at `p` is not a '\n'.
+ *
+ * Since this rule only looks at two neighbouring bytes, we can check it for 64
+ * bytes at once: compare the bytes against '\n' and '\r' to get two bit masks,
+ * shift them by one, and combine them. The number of lines is then a popcount
+ * of the result, and the set bits are the line starts.
+ *
+ * `LineCounter` only keeps the number of lines and where the last one started,
+ * so it uses constant memory however much input goes through it. `LineIndex`
+ * also keeps the offset of the start of every line, so that any number of
+ * offsets can be resolved with a binary search. Input can be appended to both
+ * in pieces.
+ */
+
+typedef struct LineCounter {
+	unsigned int lines;      // Line starts found so far, not counting the first
+	unsigned int line_start; // Offset of the last line start found
+	unsigned int size;       // Number of bytes counted so far
+	uint64_t carry_lf;       // Last byte counted was a '\n'
+	uint64_t carry_cr;       // Last byte counted was a '\r'
+
+	LineCounter() {
+		lines = 0;
+		line_start = 0;
+		size = 0;
+		carry_lf = 0;
+		carry_cr = 0;
+	}
+} LineCounter;
+
+typedef struct LineIndex {
+	LineCounter counter;
+	std::vector<unsigned int> starts; // starts[k] holds the offset of line k
+
+	LineIndex() {
+		starts.push_back(0);
+	}
+} LineIndex;
+
+// Appends `n` bytes to the counter.
+void line_counter_append(LineCounter &counter, const char *s, size_t n);
+
+// Returns the number of line endings counted so far. A trailing '\r' only
+// counts as a line ending at the `end` of the input, since a '\n' might still
+// follow it otherwise.
+unsigned int line_counter_lines(const LineCounter &counter, bool end);
+
+// Finds the line (counting from 0) and the column (counting from 1) of the
+// byte at `offset`, which must be on the last line counted so far. A line
+// ending belongs to the line it ends.
+void line_counter_resolve(const LineCounter &counter, unsigned int offset,
+                          unsigned int &line, unsigned int &col);
+
+// Appends `n` bytes to the index.
+void line_index_append(LineIndex &index, const char *s, size_t n);
+
+// Marks the end of the input, turning a trailing line ending into a line
+// start.
+void line_index_finish(LineIndex &index);
+
+// Returns the number of line endings indexed so far.
+unsigned int line_index_lines(const LineIndex &index);
+
+// Like `line_counter_resolve`, but for any offset.
+void line_index_resolve(const LineIndex &index, unsigned int offset,
+                        unsigned int &line, unsigned int &col);
+
+// Counts the line endings in `s`. If `end` is not set, a trailing '\r' is not
+// counted.
+unsigned int util_count_lines(const char *s, size_t n, bool end);
+
+/**
+ * Counters
+ * ========
+ *
+ * Counts that are meant to be looked at by other programs are printed one
+ * sample at a time with a `CounterWriter`, either as a JSON array of samples
+ * or in the text format read by Prometheus. Each sample has a name, a value,
+ * and up to two labels, such as the state or the word it is about. Samples of
+ * the same name should be written one after another.
+ */
+
+typedef enum CounterFormat {
+	COUNTER_FORMAT_JSON,
+	COUNTER_FORMAT_PROMETHEUS
+} CounterFormat;
+
+typedef struct CounterWriter {
+	FILE *f;
+	CounterFormat format;
+	const char *last;  // Name of the last sample written
+} CounterWriter;
+
+void counter_begin(CounterWriter &writer, FILE *f, CounterFormat format);
+
+// `key2` and `label2`, or all four, may be NULL. Keys are written as they are,
+// so they must be plain names.
+void counter_write(CounterWriter &writer, const char *name, uint64_t value,
+                   const char *key1, const char *label1,
+                   const char *key2 = NULL, const char *label2 = NULL);
+
+void counter_end(CounterWriter &writer);
+
+#endif